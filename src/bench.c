@@ -0,0 +1,669 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/** @file bench.c
+ * @brief Microbenchmarks for the UTF-8 and string-view layer
+ *
+ * Generates a set of synthetic corpora and times the UTF-8 parser,
+ * the bulk kernels and the `str.h` helpers against each of them on
+ * a pinned CPU. Results are written to stdout as JSON.
+ *
+ * @author Juuso Alasuutari
+ */
+#ifndef _GNU_SOURCE
+# define _GNU_SOURCE
+#endif
+
+#include <errno.h>
+#include <inttypes.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#if defined __x86_64__ || defined __i386__
+# include <x86intrin.h>
+# define BENCH_HAVE_TSC 1
+#else
+# define BENCH_HAVE_TSC 0
+#endif
+
+#include "str.h"
+#include "utf8.h"
+
+#ifdef UTF8_ENGINE_DFA
+# define BENCH_ENGINE "dfa"
+#else
+# define BENCH_ENGINE "fsm"
+#endif
+
+/** @brief Approximate token length used to split a corpus for the
+ *         `buf_append` benchmark.
+ */
+#define BENCH_TOKEN 32U
+
+/** @brief Corpus kinds.
+ *
+ * Columns: name, generator.
+ */
+#define BENCH_CORPORA(F) \
+	F(ascii,   gen_ascii)   \
+	F(paths,   gen_paths)   \
+	F(latin1,  gen_latin1)  \
+	F(cjk,     gen_cjk)     \
+	F(emoji,   gen_emoji)   \
+	F(invalid, gen_invalid)
+
+/** @brief Benchmarks.
+ *
+ * Columns: name, function, whether to run it on invalid input.
+ * The string-view helpers report every error on stderr, so they
+ * are only run against valid corpora.
+ */
+#define BENCH_FUNCS(F) \
+	F(parse,      run_parse,      true)  \
+	F(validate,   run_validate,   true)  \
+	F(count,      run_count,      true)  \
+	F(decode,     run_decode,     true)  \
+	F(ascii_span, run_ascii_span, true)  \
+	F(len,        run_len,        false) \
+	F(trim,       run_trim,       false) \
+	F(buf_append, run_buf_append, false) \
+	F(buf_grow,   run_buf_grow,   false)
+
+struct opts {
+	char const *corpora;
+	char const *funcs;
+	size_t      size;
+	size_t      bad_at;
+	uint64_t    seed;
+	unsigned    warmup;
+	unsigned    iters;
+	int         cpu;
+};
+
+struct corpus {
+	char const *name;
+	uint8_t    *ptr;     //< Null-terminated corpus
+	size_t      size;    //< Size in bytes, excluding the null byte
+	uint32_t   *dec;     //< Scratch output for `utf8_decode()`
+	struct ref *tok;     //< Tokens for `buf_append()`
+	size_t      n_tok;
+	char       *out;     //< Scratch output for `buf_append()`
+	bool        valid;
+};
+
+struct rng {
+	uint64_t s;
+};
+
+/** @brief splitmix64 step; good enough for corpus generation.
+ */
+static force_inline uint64_t
+rng_next (struct rng *const r)
+{
+	uint64_t z = (r->s += UINT64_C(0x9e3779b97f4a7c15));
+	z = (z ^ (z >> 30U)) * UINT64_C(0xbf58476d1ce4e5b9);
+	z = (z ^ (z >> 27U)) * UINT64_C(0x94d049bb133111eb);
+	return z ^ (z >> 31U);
+}
+
+static force_inline uint32_t
+rng_range (struct rng *const r,
+           uint32_t const    lo,
+           uint32_t const    hi)
+{
+	return lo + (uint32_t)(rng_next(r) % (uint64_t)(hi - lo + 1U));
+}
+
+/** @brief Encode a code point; the caller guarantees it is valid.
+ */
+static size_t
+put_cp (uint8_t *const p,
+        uint32_t const c)
+{
+	if (c < 0x80U) {
+		p[0] = (uint8_t)c;
+		return 1U;
+	}
+	if (c < 0x800U) {
+		p[0] = (uint8_t)(0xc0U | (c >> 6U));
+		p[1] = (uint8_t)(0x80U | (c & 0x3fU));
+		return 2U;
+	}
+	if (c < 0x10000U) {
+		p[0] = (uint8_t)(0xe0U | (c >> 12U));
+		p[1] = (uint8_t)(0x80U | ((c >> 6U) & 0x3fU));
+		p[2] = (uint8_t)(0x80U | (c & 0x3fU));
+		return 3U;
+	}
+	p[0] = (uint8_t)(0xf0U | (c >> 18U));
+	p[1] = (uint8_t)(0x80U | ((c >> 12U) & 0x3fU));
+	p[2] = (uint8_t)(0x80U | ((c >> 6U) & 0x3fU));
+	p[3] = (uint8_t)(0x80U | (c & 0x3fU));
+	return 4U;
+}
+
+static uint32_t
+cp_ascii (struct rng *const r)
+{
+	uint32_t c = rng_range(r, 0U, 15U);
+	return c ? rng_range(r, 0x21U, 0x7eU) : ' ';
+}
+
+static uint32_t
+cp_latin1 (struct rng *const r)
+{
+	// Roughly two thirds from the Latin-1 Supplement
+	return rng_range(r, 0U, 2U) ? rng_range(r, 0xa0U, 0xffU)
+	                            : cp_ascii(r);
+}
+
+static uint32_t
+cp_cjk (struct rng *const r)
+{
+	return rng_range(r, 0U, 31U) ? rng_range(r, 0x4e00U, 0x9fffU)
+	                             : ' ';
+}
+
+static uint32_t
+cp_emoji (struct rng *const r)
+{
+	return rng_range(r, 0U, 31U) ? rng_range(r, 0x1f300U, 0x1faffU)
+	                             : ' ';
+}
+
+/** @brief Fill a buffer with code points from a generator, padding
+ *         the end with ASCII so no sequence is cut in half.
+ */
+static void
+gen_cp (uint8_t          *p,
+        size_t const      n,
+        struct rng *const r,
+        uint32_t        (*cp)(struct rng *))
+{
+	uint8_t *const e = p + n;
+	while (e - p >= 4)
+		p += put_cp(p, cp(r));
+	while (p < e)
+		*p++ = 'x';
+}
+
+static void
+gen_ascii (uint8_t            *p,
+           size_t const        n,
+           struct rng *const   r,
+           useless size_t      bad)
+{
+	gen_cp(p, n, r, cp_ascii);
+}
+
+/** @brief Space-separated relative paths like make sees in
+ *         prerequisite lists.
+ */
+static void
+gen_paths (uint8_t            *p,
+           size_t const        n,
+           struct rng *const   r,
+           useless size_t      bad)
+{
+	static char const *const dir[] = {
+		"src", "lib", "include", "build", "obj", "test", "util",
+		"core", "net", "io", "third_party", "gen", "arch", "x86"
+	};
+	static char const *const ext[] = {
+		".c", ".h", ".o", ".d", ".cc", ".S", ".mk", ".so"
+	};
+	size_t i = 0;
+	while (i + 80U < n) {
+		unsigned depth = rng_range(r, 1U, 4U);
+		for (unsigned d = 0; d < depth; ++d) {
+			char const *s = dir[rng_range(r, 0U, 13U)];
+			size_t l = strlen(s);
+			memcpy(&p[i], s, l);
+			i += l;
+			p[i++] = '/';
+		}
+		unsigned l = rng_range(r, 3U, 12U);
+		for (unsigned k = 0; k < l; ++k)
+			p[i++] = (uint8_t)rng_range(r, 'a', 'z');
+		i += (size_t)sprintf((char *)&p[i], "_%u%s",
+		                     rng_range(r, 0U, 999U),
+		                     ext[rng_range(r, 0U, 7U)]);
+		p[i++] = ' ';
+	}
+	while (i < n)
+		p[i++] = ' ';
+}
+
+static void
+gen_latin1 (uint8_t            *p,
+            size_t const        n,
+            struct rng *const   r,
+            useless size_t      bad)
+{
+	gen_cp(p, n, r, cp_latin1);
+}
+
+static void
+gen_cjk (uint8_t            *p,
+         size_t const        n,
+         struct rng *const   r,
+         useless size_t      bad)
+{
+	gen_cp(p, n, r, cp_cjk);
+}
+
+static void
+gen_emoji (uint8_t            *p,
+           size_t const        n,
+           struct rng *const   r,
+           useless size_t      bad)
+{
+	gen_cp(p, n, r, cp_emoji);
+}
+
+/** @brief ASCII with a single 0xff byte at offset `bad`.
+ */
+static void
+gen_invalid (uint8_t            *p,
+             size_t const        n,
+             struct rng *const   r,
+             size_t const        bad)
+{
+	gen_cp(p, n, r, cp_ascii);
+	p[bad < n ? bad : n - 1U] = 0xffU;
+}
+
+/** @brief Split a corpus into tokens of about @ref BENCH_TOKEN
+ *         bytes on code point boundaries.
+ */
+static bool
+tokenize (struct corpus *const c)
+{
+	size_t max = c->size / BENCH_TOKEN + 1U;
+	c->tok = malloc(max * sizeof *c->tok);
+	if (!c->tok)
+		return false;
+
+	uint8_t const *p = c->ptr, *const e = p + c->size;
+	while (p < e) {
+		uint8_t const *q = p + BENCH_TOKEN;
+		if (q > e)
+			q = e;
+		while (q < e && (*q & 0xc0U) == 0x80U)
+			++q;
+		struct ref *t = &c->tok[c->n_tok++];
+		t->imm = (char const *)p;
+		t->len.n_bytes = (size_t)(q - p);
+		t->len.n_chars = 0;
+		(void)utf8_count(p, t->len.n_bytes, &t->len.n_chars);
+		p = q;
+	}
+	return true;
+}
+
+static bool
+corpus_init (struct corpus *const     c,
+             char const *const        name,
+             void                   (*gen)(uint8_t *, size_t,
+                                           struct rng *, size_t),
+             struct opts const *const o)
+{
+	*c = (struct corpus){.name = name, .size = o->size};
+	c->ptr = malloc(o->size + 1U);
+	c->dec = malloc(o->size * sizeof *c->dec);
+	c->out = malloc(o->size + 1U);
+	if (!c->ptr || !c->dec || !c->out) {
+		perror("malloc");
+		return false;
+	}
+
+	struct rng r = {o->seed};
+	gen(c->ptr, o->size, &r, o->bad_at);
+	c->ptr[o->size] = '\0';
+	c->valid = utf8_validate(c->ptr, c->size);
+
+	if (!tokenize(c)) {
+		perror("malloc");
+		return false;
+	}
+	return true;
+}
+
+static void
+corpus_fini (struct corpus *const c)
+{
+	free(c->tok);
+	free(c->out);
+	free(c->dec);
+	free(c->ptr);
+}
+
+static size_t
+run_parse (struct corpus *const c)
+{
+	struct utf8 u = utf8();
+	uint8_t const *p = c->ptr, *const e = p + c->size;
+	size_t n = 0;
+	while (p < e) {
+		p = utf8_parse_next_code_point(&u, p);
+		if (u.error)
+			break;
+		++n;
+	}
+	return n;
+}
+
+static size_t
+run_validate (struct corpus *const c)
+{
+	return utf8_validate(c->ptr, c->size);
+}
+
+static size_t
+run_count (struct corpus *const c)
+{
+	size_t n = 0;
+	(void)utf8_count(c->ptr, c->size, &n);
+	return n;
+}
+
+static size_t
+run_decode (struct corpus *const c)
+{
+	size_t n = 0;
+	(void)utf8_decode(c->dec, c->ptr, c->size, &n);
+	return n;
+}
+
+static size_t
+run_ascii_span (struct corpus *const c)
+{
+	return utf8_ascii_span(c->ptr, c->size);
+}
+
+static size_t
+run_len (struct corpus *const c)
+{
+	return len((char const *)c->ptr).n_chars;
+}
+
+static size_t
+run_trim (struct corpus *const c)
+{
+	return trim((char const *)c->ptr).len.n_chars;
+}
+
+static size_t
+run_buf_append (struct corpus *const c)
+{
+	struct buf b = {
+		.str = {
+			.mut = c->out,
+			.len = {0U, 0U}
+		},
+		.cap = c->size + 1U
+	};
+	for (size_t i = 0; i < c->n_tok; ++i)
+		buf_append(&b, &c->tok[i]);
+	buf_terminate(&b);
+	return b.str.len.n_chars;
+}
+
+/** @brief Like `buf_append`, but into an arena-backed buffer which
+ *         starts out empty and grows as needed.
+ */
+static size_t
+run_buf_grow (struct corpus *const c)
+{
+	static struct arena mem;
+	struct buf b = buf_arena(&mem);
+	for (size_t i = 0; i < c->n_tok; ++i) {
+		if (!buf_reserve(&b, c->tok[i].len.n_bytes + 1U))
+			break;
+		buf_append(&b, &c->tok[i]);
+	}
+	buf_terminate(&b);
+	arena_reset(&mem);
+	return b.str.len.n_chars;
+}
+
+static force_inline uint64_t
+now_ns (void)
+{
+	struct timespec ts;
+	(void)clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * UINT64_C(1000000000)
+	     + (uint64_t)ts.tv_nsec;
+}
+
+static force_inline uint64_t
+now_tsc (void)
+{
+#if BENCH_HAVE_TSC
+	return __rdtsc();
+#else
+	return 0;
+#endif
+}
+
+static int
+cmp_u64 (void const *a,
+         void const *b)
+{
+	uint64_t x = *(uint64_t const *)a, y = *(uint64_t const *)b;
+	return (x > y) - (x < y);
+}
+
+/** @brief Nearest-rank percentile of a sorted sample.
+ */
+static uint64_t
+pct (uint64_t const *const v,
+     size_t const          n,
+     unsigned const        p)
+{
+	return v[(p * (n - 1U) + 50U) / 100U];
+}
+
+/** @brief Check if `name` is in the comma-separated `list`. A null
+ *         list matches everything.
+ */
+static bool
+selected (char const *const list,
+          char const *const name)
+{
+	if (!list)
+		return true;
+	size_t l = strlen(name);
+	for (char const *p = list; *p; ) {
+		char const *q = strchr(p, ',');
+		size_t n = q ? (size_t)(q - p) : strlen(p);
+		if (n == l && !memcmp(p, name, l))
+			return true;
+		if (!q)
+			break;
+		p = q + 1;
+	}
+	return false;
+}
+
+static volatile size_t sink;
+
+static void
+run (char const *const        func,
+     size_t                 (*fn)(struct corpus *),
+     struct corpus *const     c,
+     struct opts const *const o,
+     uint64_t *const          ns,
+     uint64_t *const          tsc,
+     bool const               first)
+{
+	for (unsigned i = 0; i < o->warmup; ++i)
+		sink = fn(c);
+
+	for (unsigned i = 0; i < o->iters; ++i) {
+		uint64_t t0 = now_ns(), c0 = now_tsc();
+		sink = fn(c);
+		uint64_t c1 = now_tsc(), t1 = now_ns();
+		ns[i] = t1 - t0;
+		tsc[i] = c1 - c0;
+	}
+
+	qsort(ns, o->iters, sizeof *ns, cmp_u64);
+	qsort(tsc, o->iters, sizeof *tsc, cmp_u64);
+
+	uint64_t med = pct(ns, o->iters, 50U);
+	double bps = med ? (double)c->size * 1e9 / (double)med : 0.0;
+
+	printf("%s\n    {\"bench\": \"%s\", \"corpus\": \"%s\", "
+	       "\"valid\": %s, \"bytes\": %zu, \"ns\": {\"min\": %" PRIu64
+	       ", \"p50\": %" PRIu64 ", \"p90\": %" PRIu64 ", \"p99\": %"
+	       PRIu64 ", \"max\": %" PRIu64 "}, \"bytes_per_sec\": %.0f, "
+	       "\"cycles_per_byte\": ",
+	       first ? "" : ",", func, c->name, c->valid ? "true" : "false",
+	       c->size, ns[0], med, pct(ns, o->iters, 90U),
+	       pct(ns, o->iters, 99U), ns[o->iters - 1U], bps);
+	if (BENCH_HAVE_TSC)
+		printf("%.4f}", (double)pct(tsc, o->iters, 50U)
+		                / (double)c->size);
+	else
+		printf("null}");
+}
+
+static int
+usage (char const *const argv0,
+       int const         ret)
+{
+	(void)fprintf(ret ? stderr : stdout,
+		"Usage: %s [options]\n"
+		"  -b LIST  benchmarks to run (comma-separated)\n"
+		"  -k LIST  corpora to use (comma-separated)\n"
+		"  -s SIZE  corpus size in bytes (default 65536)\n"
+		"  -o OFF   offset of the invalid byte (default SIZE/2)\n"
+		"  -w N     warm-up iterations (default 16)\n"
+		"  -n N     timed iterations (default 256)\n"
+		"  -c CPU   CPU to pin to (default: current CPU)\n"
+		"  -S SEED  corpus generator seed\n"
+		"\nBenchmarks:"
+		#define F(name, ...) " " #name
+		BENCH_FUNCS(F)
+		#undef F
+		"\nCorpora:"
+		#define F(name, ...) " " #name
+		BENCH_CORPORA(F)
+		#undef F
+		"\n", argv0);
+	return ret;
+}
+
+static bool
+parse_num (char const *const s,
+           uint64_t *const   v)
+{
+	char *e;
+	errno = 0;
+	unsigned long long n = strtoull(s, &e, 0);
+	if (errno || e == s || *e)
+		return false;
+	*v = n;
+	return true;
+}
+
+int
+main (int    argc,
+      char **argv)
+{
+	struct opts o = {
+		.size   = 65536U,
+		.bad_at = SIZE_MAX,
+		.seed   = UINT64_C(0x6465656d),
+		.warmup = 16U,
+		.iters  = 256U,
+		.cpu    = -1
+	};
+
+	for (int c; (c = getopt(argc, argv, "b:k:s:o:w:n:c:S:h")) != -1; ) {
+		uint64_t v = 0;
+		switch (c) {
+		case 'b': o.funcs = optarg; continue;
+		case 'k': o.corpora = optarg; continue;
+		case 'h': return usage(argv[0], 0);
+		case '?': return usage(argv[0], 2);
+		}
+		if (!parse_num(optarg, &v)) {
+			(void)fprintf(stderr, "%s: bad number: %s\n",
+			              argv[0], optarg);
+			return 2;
+		}
+		switch (c) {
+		case 's': o.size = (size_t)v; break;
+		case 'o': o.bad_at = (size_t)v; break;
+		case 'w': o.warmup = (unsigned)v; break;
+		case 'n': o.iters = (unsigned)v; break;
+		case 'c': o.cpu = (int)v; break;
+		case 'S': o.seed = v; break;
+		}
+	}
+	if (o.size < 64U || !o.iters)
+		return usage(argv[0], 2);
+	if (o.bad_at == SIZE_MAX)
+		o.bad_at = o.size / 2U;
+
+	if (o.cpu < 0)
+		o.cpu = sched_getcpu();
+	if (o.cpu >= 0) {
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(o.cpu, &set);
+		if (sched_setaffinity(0, sizeof set, &set)) {
+			perror("sched_setaffinity");
+			o.cpu = -1;
+		}
+	}
+
+	uint64_t *ns = malloc(o.iters * sizeof *ns);
+	uint64_t *tsc = malloc(o.iters * sizeof *tsc);
+	if (!ns || !tsc) {
+		perror("malloc");
+		return 1;
+	}
+
+	printf("{\n  \"engine\": \"" BENCH_ENGINE "\",\n"
+	       "  \"cpu\": %d,\n  \"size\": %zu,\n  \"invalid_at\": %zu,\n"
+	       "  \"seed\": %" PRIu64 ",\n  \"warmup\": %u,\n"
+	       "  \"iters\": %u,\n  \"results\": [",
+	       o.cpu, o.size, o.bad_at, o.seed, o.warmup, o.iters);
+
+	int ret = 0;
+	bool first = true;
+	struct corpus c;
+
+	#define FUNC(name, fn, on_invalid)                             \
+	if (selected(o.funcs, #name) && (c.valid || on_invalid)) {    \
+		run(#name, fn, &c, &o, ns, tsc, first);               \
+		first = false;                                        \
+	}
+
+	#define CORPUS(name, gen)                                      \
+	if (selected(o.corpora, #name)) {                             \
+		if (!corpus_init(&c, #name, gen, &o)) {               \
+			corpus_fini(&c);                              \
+			ret = 1;                                      \
+			goto end;                                     \
+		}                                                     \
+		BENCH_FUNCS(FUNC)                                     \
+		corpus_fini(&c);                                      \
+	}
+
+	BENCH_CORPORA(CORPUS)
+
+	#undef CORPUS
+	#undef FUNC
+
+end:
+	printf("\n  ]\n}\n");
+	free(tsc);
+	free(ns);
+	return ret;
+}
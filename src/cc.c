@@ -0,0 +1,236 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/** @file cc.c
+ *
+ * @author Juuso Alasuutari
+ */
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "cc.h"
+#include "jobs.h"
+
+struct cc_info
+cc_info (char const *const ver)
+{
+	struct cc_info cc = {
+		.clang = ver && strstr(ver, "clang"),
+		.major = 0
+	};
+
+	for (char const *p = ver; p && *p; ++p) {
+		if (*p < '0' || *p > '9')
+			continue;
+		char *end;
+		long const v = strtol(p, &end, 10);
+		if (*end == '.') {
+			cc.major = (int)v;
+			break;
+		}
+		p = end - 1;
+	}
+
+	return cc;
+}
+
+/** @brief Names of the values of `enum cc_lto_mode`
+ */
+static char const *const cc_lto_name[] = {"full", "thin", "incremental"};
+
+int
+cc_lto_find (char const *const mode)
+{
+	struct ref m = trim(mode);
+	for (size_t i = 0; m.imm && i < array_size(cc_lto_name); ++i) {
+		if (m.len.n_bytes == strlen(cc_lto_name[i])
+		    && !strncmp(m.imm, cc_lto_name[i], m.len.n_bytes))
+			return (int)i;
+	}
+
+	if (m.imm && m.len.n_bytes)
+		(void)fprintf(stderr, "lto: unknown mode: %.*s\n",
+		              (int)m.len.n_bytes, m.imm);
+	return -1;
+}
+
+int
+cc_lto_flags (char *const               buf,
+              size_t const              size,
+              struct cc_info const      cc,
+              enum cc_lto_mode const    mode,
+              bool const                link,
+              struct ref const          dir,
+              unsigned long long const  mib)
+{
+	int n = 0;
+	if (cc.clang) {
+		n = snprintf(buf, size, "%s", mode ? "-flto=thin" : "-flto");
+		if (link && mode)
+			n += snprintf(&buf[n], size - (size_t)n,
+			              " -fuse-ld=lld -Wl,--thinlto-jobs=%u",
+			              jobs_limit());
+	} else {
+		n = snprintf(buf, size, "%s", link ? "-flto=auto" : "-flto");
+	}
+
+	if (!link || mode != CC_LTO_INCREMENTAL || !dir.imm || !dir.len.n_bytes)
+		return n;
+
+	if (!cc.clang && cc.major < 15) {
+		static bool warned;
+		if (!warned)
+			(void)fprintf(stderr, "lto: incremental LTO needs GCC 15 or "
+			              "Clang, linking without a cache\n");
+		warned = true;
+		return n;
+	}
+
+	char path[PATH_MAX];
+	(void)snprintf(path, sizeof path, "%.*s", (int)dir.len.n_bytes, dir.imm);
+	char *const slash = strrchr(path, '/');
+	if (slash && slash != path) {
+		*slash = '\0';
+		(void)mkdir(path, 0755);
+		*slash = '/';
+	}
+	(void)mkdir(path, 0755);
+
+	if (cc.clang)
+		n += snprintf(&buf[n], size - (size_t)n,
+		              " -Wl,--thinlto-cache-dir=%.*s"
+		              " -Wl,--thinlto-cache-policy=cache_size_bytes=%llum",
+		              (int)dir.len.n_bytes, dir.imm, mib);
+	else
+		n += snprintf(&buf[n], size - (size_t)n, " -flto-incremental=%.*s",
+		              (int)dir.len.n_bytes, dir.imm);
+	return n;
+}
+
+/** @brief File in an LTO cache, see @ref cc_lto_prune()
+ */
+struct cc_lto_ent {
+	struct timespec mtime;
+	off_t           size;
+	char           *name;
+};
+
+static int
+cc_lto_ent_cmp (void const *const a,
+                void const *const b)
+{
+	struct timespec const *const x = &((struct cc_lto_ent const *)a)->mtime;
+	struct timespec const *const y = &((struct cc_lto_ent const *)b)->mtime;
+	if (x->tv_sec != y->tv_sec)
+		return x->tv_sec < y->tv_sec ? -1 : 1;
+	return (x->tv_nsec > y->tv_nsec) - (x->tv_nsec < y->tv_nsec);
+}
+
+void
+cc_lto_prune (char const *const path,
+              uint64_t const    limit)
+{
+	DIR *const dir = path[0] ? opendir(path) : nullptr;
+	if (!dir)
+		return;
+
+	struct cc_lto_ent *ent = nullptr;
+	size_t n = 0U, cap = 0U;
+	uint64_t total = 0U;
+	for (struct dirent *e; (e = readdir(dir)); ) {
+		struct stat st;
+		if (e->d_name[0] == '.'
+		    || fstatat(dirfd(dir), e->d_name, &st, AT_SYMLINK_NOFOLLOW)
+		    || !S_ISREG(st.st_mode))
+			continue;
+
+		if (n == cap) {
+			cap = cap ? cap * 2U : 256U;
+			struct cc_lto_ent *const p = realloc(ent, cap * sizeof *ent);
+			if (!p)
+				break;
+			ent = p;
+		}
+
+		char *const name = strdup(e->d_name);
+		if (!name)
+			break;
+		ent[n++] = (struct cc_lto_ent){st.st_mtim, st.st_size, name};
+		total += (uint64_t)st.st_size;
+	}
+
+	if (n && total > limit)
+		qsort(ent, n, sizeof *ent, cc_lto_ent_cmp);
+	for (size_t i = 0; i < n; ++i) {
+		if (total > limit && !unlinkat(dirfd(dir), ent[i].name, 0))
+			total -= (uint64_t)ent[i].size;
+		free(ent[i].name);
+	}
+
+	free(ent);
+	(void)closedir(dir);
+}
+
+int
+cc_pgo_find (char const *const mode)
+{
+	struct ref const m = trim(mode);
+	if (m.imm && m.len.n_bytes == 3U && !strncmp(m.imm, "use", 3U))
+		return CC_PGO_USE;
+	if (m.imm && m.len.n_bytes == 8U && !strncmp(m.imm, "generate", 8U))
+		return CC_PGO_GENERATE;
+
+	(void)fprintf(stderr, "pgo: unknown mode: %.*s\n",
+	              m.imm ? (int)m.len.n_bytes : 0, m.imm ? m.imm : "");
+	return -1;
+}
+
+int
+cc_pgo_flags (char *const             buf,
+              size_t const            size,
+              struct cc_info const    cc,
+              enum cc_pgo_mode const  mode,
+              struct ref const        dir,
+              struct ref const        src)
+{
+	bool const use = mode == CC_PGO_USE;
+	if (cc.clang)
+		return snprintf(buf, size, "%s%.*s%s",
+		                use ? "-fprofile-use=" : "-fprofile-generate=",
+		                (int)dir.len.n_bytes, dir.imm,
+		                use ? "/profile" : "/data");
+
+	int n = snprintf(buf, size, "%s%.*s/data%s",
+	                 use ? "-fprofile-use=" : "-fprofile-generate=",
+	                 (int)dir.len.n_bytes, dir.imm,
+	                 !use ? " -fprofile-update=atomic"
+	                 : cc.major && cc.major < 10
+	                 ? " -Wno-missing-profile"
+	                 : " -fprofile-partial-training -Wno-missing-profile");
+	if (n > 0 && (size_t)n < size && src.imm && src.len.n_bytes)
+		n += snprintf(&buf[n], size - (size_t)n, " -dumpbase %.*s",
+		              (int)src.len.n_bytes, src.imm);
+	return n;
+}
+
+int
+cc_pgo_merge (char *const       buf,
+              size_t const      size,
+              struct ref const  dir,
+              char const *const tool)
+{
+	int const d = (int)dir.len.n_bytes;
+	if (tool)
+		return snprintf(buf, size, "%s merge -output=%.*s/profile %.*s/data"
+		                " && cksum <%.*s/profile >%.*s/profile.id",
+		                tool, d, dir.imm, d, dir.imm, d, dir.imm, d, dir.imm);
+
+	return snprintf(buf, size, "find %.*s/data -name '*.gcda' -print0"
+	                " | LC_ALL=C sort -z | xargs -0r cat | cksum >%.*s/profile.id"
+	                " && touch %.*s/profile",
+	                d, dir.imm, d, dir.imm, d, dir.imm);
+}
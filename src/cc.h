@@ -0,0 +1,182 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/** @file cc.h
+ * @brief Compiler detection and link-time and profile-guided
+ *        optimization flags
+ * @author Juuso Alasuutari
+ */
+#ifndef DEEM_SRC_CC_H_
+#define DEEM_SRC_CC_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "compat.h"
+#include "str.h"
+#include "util.h"
+
+/** @brief Compiler behind `CC`
+ */
+struct cc_info {
+	bool clang; //< Whether it's Clang rather than GCC
+	int  major; //< Major version, 0 if unknown
+};
+
+/**
+ * @brief Identify a compiler by its `--version` output.
+ *
+ * @param ver The output, or `nullptr` if there was none.
+ * @return The compiler. The first number with a dot in it is taken
+ *         to be the version.
+ */
+extern struct cc_info
+cc_info (char const *ver);
+
+/**
+ * @brief Get the precompiled header suffix of a compiler.
+ *
+ * @param cc The compiler.
+ * @return `gch` for GCC and `pch` for Clang, which is what each looks
+ *         for next to a header given with `-include`.
+ */
+static force_inline char const *
+cc_pch_ext (struct cc_info const cc)
+{
+	return cc.clang ? "pch" : "gch";
+}
+
+/** @brief Link-time optimization modes
+ */
+enum cc_lto_mode {
+	CC_LTO_FULL,
+	CC_LTO_THIN,
+	CC_LTO_INCREMENTAL
+};
+
+/**
+ * @brief Look up a link-time optimization mode by name.
+ *
+ * @param mode `full`, `thin`, or `incremental`, with or without
+ *             surrounding whitespace.
+ * @return The mode, or -1 if there's no such mode. An unknown mode
+ *         other than an empty string is reported on `stderr`.
+ */
+extern int
+cc_lto_find (char const *mode) nonnull_in();
+
+/**
+ * @brief Render link-time optimization flags.
+ *
+ * With Clang, #CC_LTO_THIN is ThinLTO with lld running as many
+ * backend jobs as make has job slots, and #CC_LTO_INCREMENTAL adds the
+ * ThinLTO cache in `dir`, limited to `mib` MiB.
+ *
+ * GCC has no ThinLTO, but its LTRANS partitions are its counterpart:
+ * both #CC_LTO_FULL and #CC_LTO_THIN link with `-flto=auto`, which runs
+ * them through make's jobserver. #CC_LTO_INCREMENTAL adds the LTRANS
+ * cache of GCC 15 and later in `dir`, see @ref cc_lto_prune().
+ *
+ * The cache directory and its parent are created if they don't exist.
+ *
+ * @param buf Output buffer.
+ * @param size Size of the output buffer.
+ * @param cc The compiler.
+ * @param mode The mode.
+ * @param link Whether the flags are for linking rather than compiling.
+ * @param dir Cache directory, or an empty reference for none.
+ * @param mib Cache size limit of lld in MiB.
+ * @return Like `snprintf()`.
+ */
+extern int
+cc_lto_flags (char               *buf,
+              size_t              size,
+              struct cc_info      cc,
+              enum cc_lto_mode    mode,
+              bool                link,
+              struct ref          dir,
+              unsigned long long  mib) nonnull_in(1);
+
+/**
+ * @brief Prune an LTO cache.
+ *
+ * lld limits the size of its ThinLTO cache itself, but GCC only
+ * limits the number of entries. The least recently modified files
+ * are removed until the directory is within the limit.
+ *
+ * @param path The cache directory.
+ * @param limit Size limit in bytes.
+ */
+extern void
+cc_lto_prune (char const *path,
+              uint64_t    limit) nonnull_in();
+
+/** @brief Profile-guided optimization modes
+ */
+enum cc_pgo_mode {
+	CC_PGO_GENERATE,
+	CC_PGO_USE
+};
+
+/**
+ * @brief Look up a profile-guided optimization mode by name.
+ *
+ * @param mode `generate` or `use`, with or without surrounding
+ *             whitespace.
+ * @return The mode, or -1 if there's no such mode. An unknown mode is
+ *         reported on `stderr`.
+ */
+extern int
+cc_pgo_find (char const *mode) nonnull_in();
+
+/**
+ * @brief Render profile-guided optimization flags.
+ *
+ * #CC_PGO_GENERATE instruments the code to write its counters in
+ * `dir`/data, and #CC_PGO_USE optimizes with the profile. GCC reads
+ * the `.gcda` files directly, and with `-fprofile-partial-training` code
+ * which the training didn't run is still optimized normally. GCC names
+ * the files after the object, so `src`, the same in both builds, is
+ * given as `-dumpbase` to make the names match. Clang reads the
+ * profile merged by @ref cc_pgo_merge().
+ *
+ * @param buf Output buffer.
+ * @param size Size of the output buffer.
+ * @param cc The compiler.
+ * @param mode The mode.
+ * @param dir Profile directory.
+ * @param src Source file, or an empty reference.
+ * @return Like `snprintf()`.
+ */
+extern int
+cc_pgo_flags (char             *buf,
+              size_t            size,
+              struct cc_info    cc,
+              enum cc_pgo_mode  mode,
+              struct ref        dir,
+              struct ref        src) nonnull_in(1);
+
+/**
+ * @brief Render the command which finishes a training run.
+ *
+ * With `tool`, e.g. `llvm-profdata`, Clang's raw profiles in `dir`/data
+ * are merged into `dir`/profile. GCC's counters are used as they are,
+ * so without `tool` `dir`/profile is only touched.
+ *
+ * A checksum of the profile data is written to `dir`/profile.id for the
+ * digest command of the optimized objects. Otherwise a profile trained
+ * by an earlier `make train-LIB` would leave them only stale by
+ * timestamp, and content digest mode would touch them instead of
+ * compiling them with the new profile.
+ *
+ * @param buf Output buffer.
+ * @param size Size of the output buffer.
+ * @param dir Profile directory.
+ * @param tool Profile merge tool of Clang, or `nullptr` for GCC.
+ * @return Like `snprintf()`.
+ */
+extern int
+cc_pgo_merge (char       *buf,
+              size_t      size,
+              struct ref  dir,
+              char const *tool) nonnull_in(1);
+
+#endif /* DEEM_SRC_CC_H_ */
@@ -124,4 +124,8 @@ diag_clang(ignored "-Wpre-c11-compat")
 # define __has_builtin(x) 0
 #endif // !__has_builtin
 
+#ifndef __has_attribute
+# define __has_attribute(x) 0
+#endif // !__has_attribute
+
 #endif /* DEEM_SRC_COMPAT_H_ */
@@ -0,0 +1,1183 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/** @file deem-cc.c
+ * @brief Compile cache for `$(library)` object rules
+ *
+ * Runs in front of a compile command, e.g.
+ * `deem-cc -d DIR -- cc -c -o foo.o foo.c`. The source is run through
+ * the preprocessor, and the object is looked up by a digest of the
+ * preprocessed translation unit, the command line and the identity of
+ * the compiler binary. A hit is restored from the cache directory by
+ * reflink, hardlink or copy; a miss runs the real compile and stores
+ * its object. Commands which don't produce exactly one object are run
+ * unchanged.
+ *
+ * With `-t`, the start time and duration of the command are appended
+ * to a trace log, whether or not the cache is in use.
+ *
+ * With `-b`, the standard output and error of the command are kept in
+ * memory until it's done, and then written to standard output at once
+ * after a banner line.
+ *
+ * @author Juuso Alasuutari
+ */
+#ifndef _GNU_SOURCE
+# define _GNU_SOURCE
+#endif
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <linux/fs.h>
+#include <poll.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "digest.h"
+
+extern char **environ;
+
+/** @brief Fraction of the size limit which eviction leaves in use,
+ *         in tenths
+ */
+#define CC_EVICT_TO 8U
+
+/** @brief Command line options
+ */
+struct cc_opt {
+	char const *dir;    //< Cache directory
+	char const *stats;  //< File to append hit and miss records to
+	char const *zip;    //< Compressor program, or `nullptr`
+	uint64_t    max;    //< Size limit of the cache in bytes
+	bool        link;   //< Whether hits may be restored by hardlink
+	char const *trace;  //< Trace log, or `nullptr`
+	char const *name;   //< Target name in the trace
+	char const *cat;    //< Category in the trace
+	char const *banner; //< First line of buffered output, or `nullptr`
+	int         out;    //< Standard output of deem-cc if buffered, or -1
+};
+
+/** @brief What a compile command does
+ */
+struct cc_cmd {
+	char      **argv;
+	int         argc;
+	char const *out;  //< Object file
+	char const *mf;   //< Dependency file, or `nullptr`
+	bool        c;    //< Whether `-c` was given
+	bool        md;   //< Whether `-MD` or `-MMD` was given
+	bool        mt;   //< Whether `-MT` or `-MQ` was given
+	bool        g;    //< Whether debug info was requested
+	bool        odd;  //< Whether the command can't be cached
+	unsigned    n_in; //< Number of input files
+};
+
+/** @brief Options which take their value as a separate argument
+ */
+static char const *const cc_arg_opt[] = {
+	"--param", "-D", "-I", "-L", "-MF", "-MQ", "-MT", "-T", "-U",
+	"-Xassembler", "-Xlinker", "-Xpreprocessor", "-aux-info",
+	"-dumpbase", "-dumpdir", "-idirafter", "-imacros", "-imultilib", "-include", "-iprefix",
+	"-iquote", "-isysroot", "-isystem", "-iwithprefix",
+	"-iwithprefixbefore", "-l", "-o", "-u", "-x", "-z"
+};
+
+/** @brief Options whose output isn't just the object and `-MD` file
+ *
+ * A trailing `*` matches any suffix.
+ */
+static char const *const cc_odd_opt[] = {
+	"--coverage", "-E", "-M", "-MM", "-S", "-Wp,*", "-fcallgraph-info*",
+	"-fdump-*", "-fstack-usage", "-ftest-coverage", "-gsplit-dwarf",
+	"-save-temps*"
+};
+
+static bool
+cc_is (char const *const a,
+       char const *const opt)
+{
+	return !strcmp(a, opt);
+}
+
+static bool
+cc_has_prefix (char const *const a,
+               char const *const pfx)
+{
+	return !strncmp(a, pfx, strlen(pfx));
+}
+
+/**
+ * @brief Classify the arguments of a compile command.
+ * @param cmd The command, with `argv` and `argc` set.
+ */
+static void
+cc_parse (struct cc_cmd *const cmd)
+{
+	for (int i = 1; i < cmd->argc; ++i) {
+		char const *const a = cmd->argv[i];
+		if (a[0] != '-' || !a[1]) {
+			if (a[0] == '-' || a[0] == '@')
+				cmd->odd = true;
+			++cmd->n_in;
+			continue;
+		}
+
+		for (size_t k = 0; k < array_size(cc_odd_opt); ++k) {
+			char const *const o = cc_odd_opt[k];
+			size_t const n = strlen(o) - 1U;
+			if (o[n] == '*' ? !strncmp(a, o, n) : cc_is(a, o))
+				cmd->odd = true;
+		}
+
+		if (cc_is(a, "-c")) {
+			cmd->c = true;
+		} else if (cc_is(a, "-MD") || cc_is(a, "-MMD")) {
+			cmd->md = true;
+		} else if (a[1] == 'g' && !cc_is(a, "-g0")) {
+			cmd->g = true;
+		}
+
+		char const *val = nullptr;
+		for (size_t k = 0; k < array_size(cc_arg_opt); ++k) {
+			if (cc_is(a, cc_arg_opt[k])) {
+				if (++i == cmd->argc) {
+					cmd->odd = true;
+					return;
+				}
+				val = cmd->argv[i];
+				break;
+			}
+		}
+
+		if (cc_has_prefix(a, "-o")) {
+			cmd->out = val ? val : &a[2];
+		} else if (cc_has_prefix(a, "-MF")) {
+			cmd->mf = val ? val : &a[3];
+		} else if (cc_has_prefix(a, "-MT") || cc_has_prefix(a, "-MQ")) {
+			cmd->mt = true;
+		}
+	}
+
+	if (!cmd->c || !cmd->out || cmd->n_in != 1U)
+		cmd->odd = true;
+}
+
+/**
+ * @brief Check if an argument only controls the names of outputs.
+ *
+ * Such arguments are left out of the cache key so that builds in
+ * different `O=` directories share their objects.
+ *
+ * @param argv The arguments.
+ * @param i Index of the argument; advanced past a separate value.
+ * @return `true` if the argument is left out of the key.
+ */
+static bool
+cc_key_skip (char *const *const argv,
+             int *const         i)
+{
+	char const *const a = argv[*i];
+	if (cc_is(a, "-MD") || cc_is(a, "-MMD") || cc_is(a, "-MP"))
+		return true;
+
+	static char const *const out[] = {"-o", "-MF", "-MT", "-MQ"};
+	for (size_t k = 0; k < array_size(out); ++k) {
+		if (cc_is(a, out[k])) {
+			if (argv[*i + 1])
+				++*i;
+			return true;
+		}
+		if (cc_has_prefix(a, out[k]))
+			return true;
+	}
+
+	return false;
+}
+
+static int
+cc_wait (pid_t const pid)
+{
+	int st;
+	while (waitpid(pid, &st, 0) < 0) {
+		if (errno != EINTR) {
+			perror("waitpid");
+			return 127;
+		}
+	}
+
+	return WIFEXITED(st) ? WEXITSTATUS(st) : 128 + WTERMSIG(st);
+}
+
+/**
+ * @brief Run a program with some of its standard streams redirected.
+ *
+ * @param argv The program and its arguments.
+ * @param in File to read standard input from, or -1.
+ * @param out File to write standard output to, or -1.
+ * @param err File to write standard error to, or -1.
+ * @return The process ID, or -1 on failure.
+ */
+static pid_t
+cc_spawn (char *const *const argv,
+          int const          in,
+          int const          out,
+          int const          err)
+{
+	posix_spawn_file_actions_t fa;
+	pid_t pid = -1;
+
+	if (posix_spawn_file_actions_init(&fa))
+		return -1;
+
+	int const fd[3] = {in, out, err};
+	bool ok = true;
+	for (int i = 0; i < 3; ++i)
+		if (fd[i] >= 0 && posix_spawn_file_actions_adddup2(&fa, fd[i], i))
+			ok = false;
+
+	int e = ok ? posix_spawnp(&pid, argv[0], &fa, nullptr, argv, environ)
+	           : ENOMEM;
+	(void)posix_spawn_file_actions_destroy(&fa);
+	if (e) {
+		(void)fprintf(stderr, "%s: %s\n", argv[0], strerror(e));
+		return -1;
+	}
+
+	return pid;
+}
+
+/**
+ * @brief Copy the rest of a file.
+ *
+ * Tries `copy_file_range()` first, then plain reads and writes.
+ *
+ * @param in Source file.
+ * @param out Destination file.
+ * @return `true` on success, `false` otherwise.
+ */
+static bool
+cc_copy (int const in,
+         int const out)
+{
+	for (;;) {
+		ssize_t n = copy_file_range(in, nullptr, out, nullptr,
+		                            SSIZE_MAX, 0U);
+		if (!n)
+			return true;
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EXDEV || errno == EINVAL || errno == EBADF
+			    || errno == ENOSYS || errno == EOPNOTSUPP)
+				break;
+			return false;
+		}
+	}
+
+	char buf[65536];
+	for (;;) {
+		ssize_t n = read(in, buf, sizeof buf);
+		if (!n)
+			return true;
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return false;
+		}
+		for (ssize_t k = 0, w; k < n; k += w) {
+			w = write(out, &buf[k], (size_t)(n - k));
+			if (w < 0) {
+				if (errno != EINTR)
+					return false;
+				w = 0;
+			}
+		}
+	}
+}
+
+/**
+ * @brief Copy a file through the compressor, or as is without one.
+ *
+ * A plain copy is a reflink where the file system supports it.
+ *
+ * @param o Options.
+ * @param in Source file, positioned at the start.
+ * @param out Destination file, empty.
+ * @param unzip Whether to decompress rather than compress.
+ * @return `true` on success, `false` otherwise.
+ */
+static bool
+cc_xfer (struct cc_opt const *const o,
+         int const                  in,
+         int const                  out,
+         bool const                 unzip)
+{
+	if (!o->zip)
+		return !ioctl(out, FICLONE, in) || cc_copy(in, out);
+
+	// Understood by zstd, xz and gzip alike
+	char *argv[] = {(char *)o->zip, unzip ? "-dc" : "-c", nullptr};
+	pid_t pid = cc_spawn(argv, in, out, -1);
+	return pid > 0 && !cc_wait(pid);
+}
+
+/**
+ * @brief Create a directory and its parents.
+ * @param path The directory path, modified temporarily.
+ * @return `true` if the directory exists, `false` otherwise.
+ */
+static bool
+cc_mkdirs (char *const path)
+{
+	for (char *p = path; (p = strchr(p + 1, '/')); ) {
+		*p = '\0';
+		int e = mkdir(path, 0755) ? errno : 0;
+		*p = '/';
+		if (e && e != EEXIST)
+			return false;
+	}
+
+	return !mkdir(path, 0755) || errno == EEXIST;
+}
+
+/** @brief Cache entry found while evicting
+ */
+struct cc_ent {
+	struct timespec mtime; //< Last use
+	uint64_t        size;  //< Size of the object and its messages
+	char           *name;  //< Path relative to the cache directory
+};
+
+static int
+cc_ent_cmp (void const *const a,
+            void const *const b)
+{
+	struct timespec const *const x = &((struct cc_ent const *)a)->mtime;
+	struct timespec const *const y = &((struct cc_ent const *)b)->mtime;
+	if (x->tv_sec != y->tv_sec)
+		return x->tv_sec < y->tv_sec ? -1 : 1;
+	return (x->tv_nsec > y->tv_nsec) - (x->tv_nsec < y->tv_nsec);
+}
+
+/**
+ * @brief Remove the least recently used entries.
+ *
+ * The caller holds the lock on the size file.
+ *
+ * @param o Options.
+ * @param limit Size to shrink the cache to in bytes.
+ * @return The size of the cache after eviction in bytes.
+ */
+static uint64_t
+cc_evict (struct cc_opt const *const o,
+          uint64_t const             limit)
+{
+	struct cc_ent *ent = nullptr;
+	size_t n = 0U, cap = 0U;
+	uint64_t total = 0U;
+
+	int const dfd = open(o->dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	DIR *const top = dfd < 0 ? nullptr : fdopendir(dup(dfd));
+	for (struct dirent *d; top && (d = readdir(top)); ) {
+		if (strlen(d->d_name) != 2U || d->d_name[0] == '.')
+			continue;
+
+		int const sfd = openat(dfd, d->d_name,
+		                       O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+		DIR *const sub = sfd < 0 ? nullptr : fdopendir(sfd);
+		for (struct dirent *e; sub && (e = readdir(sub)); ) {
+			struct stat st;
+			if (e->d_name[0] == '.'
+			    || fstatat(sfd, e->d_name, &st, AT_SYMLINK_NOFOLLOW)
+			    || !S_ISREG(st.st_mode))
+				continue;
+
+			total += (uint64_t)st.st_size;
+			size_t const len = strlen(e->d_name);
+			if (len > 4U && !strcmp(&e->d_name[len - 4U], ".err"))
+				continue;
+
+			if (n == cap) {
+				cap = cap ? cap * 2U : 256U;
+				struct cc_ent *const p = realloc(ent, cap * sizeof *ent);
+				if (!p)
+					break;
+				ent = p;
+			}
+
+			char *const name = malloc(len + 8U);
+			if (!name)
+				break;
+			(void)sprintf(name, "%s/%s", d->d_name, e->d_name);
+			ent[n++] = (struct cc_ent){st.st_mtim, (uint64_t)st.st_size, name};
+		}
+		if (sub)
+			(void)closedir(sub);
+		else if (sfd >= 0)
+			(void)close(sfd);
+	}
+	if (top)
+		(void)closedir(top);
+
+	if (n)
+		qsort(ent, n, sizeof *ent, cc_ent_cmp);
+
+	for (size_t i = 0; i < n; ++i) {
+		if (total > limit && !unlinkat(dfd, ent[i].name, 0)) {
+			total -= ent[i].size;
+
+			struct stat st;
+			(void)strcat(ent[i].name, ".err");
+			if (!fstatat(dfd, ent[i].name, &st, 0)
+			    && !unlinkat(dfd, ent[i].name, 0))
+				total -= (uint64_t)st.st_size;
+		}
+		free(ent[i].name);
+	}
+
+	free(ent);
+	if (dfd >= 0)
+		(void)close(dfd);
+	return total;
+}
+
+/**
+ * @brief Add to the recorded size of the cache, and evict if it has
+ *        grown past the limit.
+ *
+ * @param o Options.
+ * @param add Bytes added to the cache.
+ */
+static void
+cc_account (struct cc_opt const *const o,
+            uint64_t const             add)
+{
+	char path[PATH_MAX];
+	(void)snprintf(path, sizeof path, "%s/size", o->dir);
+	int const fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+	if (fd < 0)
+		return;
+
+	if (!flock(fd, LOCK_EX)) {
+		char buf[32];
+		ssize_t n = pread(fd, buf, sizeof buf - 1U, 0);
+		uint64_t total = 0U;
+		if (n > 0) {
+			buf[n] = '\0';
+			total = strtoull(buf, nullptr, 10);
+		}
+
+		total += add;
+		if (total > o->max)
+			total = cc_evict(o, o->max / 10U * CC_EVICT_TO);
+
+		n = snprintf(buf, sizeof buf, "%" PRIu64 "\n", total);
+		if (ftruncate(fd, 0) || pwrite(fd, buf, (size_t)n, 0) != n)
+			perror(path);
+	}
+
+	(void)close(fd);
+}
+
+/**
+ * @brief Append a record to the statistics file.
+ * @param o Options.
+ * @param line The record, written with a single `write()`.
+ */
+static void
+cc_note (struct cc_opt const *const o,
+         char const *const          line)
+{
+	if (!o->stats)
+		return;
+
+	int const fd = open(o->stats, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC,
+	                    0644);
+	if (fd >= 0) {
+		if (write(fd, line, strlen(line)) < 0)
+			perror(o->stats);
+		(void)close(fd);
+	}
+}
+
+/** @brief Copy a file to standard error.
+ */
+static void
+cc_replay (int const fd)
+{
+	(void)fflush(stderr);
+	if (fd >= 0 && !lseek(fd, 0, SEEK_SET))
+		(void)cc_copy(fd, STDERR_FILENO);
+}
+
+/**
+ * @brief Restore an object from the cache.
+ *
+ * @param o Options.
+ * @param entry Path of the cache entry.
+ * @param out Path of the object file.
+ * @return `true` on a hit, `false` otherwise.
+ */
+static bool
+cc_restore (struct cc_opt const *const o,
+            char *const                entry,
+            char const *const          out)
+{
+	int const fd = open(entry, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return false;
+
+	// Mark the entry as recently used
+	(void)utimensat(AT_FDCWD, entry, nullptr, 0);
+
+	char tmp[PATH_MAX];
+	(void)snprintf(tmp, sizeof tmp, "%s.%ld.tmp", out, (long)getpid());
+	(void)unlink(tmp);
+
+	bool ok = o->link && !o->zip && !link(entry, tmp);
+	if (!ok) {
+		int const tfd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+		                     0644);
+		ok = tfd >= 0 && cc_xfer(o, fd, tfd, true);
+		if (tfd >= 0)
+			(void)close(tfd);
+	}
+	(void)close(fd);
+
+	struct stat st;
+	if (!ok || stat(tmp, &st) || rename(tmp, out)) {
+		(void)unlink(tmp);
+		return false;
+	}
+
+	size_t const len = strlen(entry);
+	(void)strcpy(&entry[len], ".err");
+	int const efd = open(entry, O_RDONLY | O_CLOEXEC);
+	entry[len] = '\0';
+	if (efd >= 0) {
+		cc_replay(efd);
+		(void)close(efd);
+	}
+
+	char line[32];
+	(void)snprintf(line, sizeof line, "h %" PRIu64 "\n", (uint64_t)st.st_size);
+	cc_note(o, line);
+	return true;
+}
+
+/**
+ * @brief Move a temporary file into the cache.
+ *
+ * @param tmp The temporary file.
+ * @param dst The entry path.
+ * @return The size of the file in bytes, or 0 on failure.
+ */
+static uint64_t
+cc_commit (char const *const tmp,
+           char const *const dst)
+{
+	struct stat st;
+	if (stat(tmp, &st) || rename(tmp, dst)) {
+		(void)unlink(tmp);
+		return 0U;
+	}
+
+	return (uint64_t)st.st_size;
+}
+
+/**
+ * @brief Store an object in the cache.
+ *
+ * The entry is written to a temporary file and renamed into place, so
+ * concurrent builds never see a partial entry. Compiler messages are
+ * stored next to the object and replayed on a hit.
+ *
+ * @param o Options.
+ * @param entry Path of the cache entry.
+ * @param out Path of the object file.
+ * @param err Compiler messages, or -1.
+ */
+static void
+cc_store (struct cc_opt const *const o,
+          char *const                entry,
+          char const *const          out,
+          int const                  err)
+{
+	char tmp[PATH_MAX];
+	char *const slash = strrchr(entry, '/');
+	*slash = '\0';
+	bool const dir_ok = cc_mkdirs(entry);
+	(void)snprintf(tmp, sizeof tmp, "%s/.tmp.%ld", entry, (long)getpid());
+	*slash = '/';
+	if (!dir_ok)
+		return;
+
+	uint64_t add = 0U;
+	size_t const len = strlen(entry);
+	(void)strcpy(&entry[len], ".err");
+	off_t const n_err = err >= 0 ? lseek(err, 0, SEEK_END) : 0;
+	if (n_err > 0) {
+		int const tfd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+		                     0644);
+		bool ok = tfd >= 0 && !lseek(err, 0, SEEK_SET) && cc_copy(err, tfd);
+		if (tfd >= 0)
+			(void)close(tfd);
+		add += ok ? cc_commit(tmp, entry) : 0U;
+	} else {
+		(void)unlink(entry);
+	}
+	entry[len] = '\0';
+
+	int const fd = open(out, O_RDONLY | O_CLOEXEC);
+	int const tfd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	bool const ok = fd >= 0 && tfd >= 0 && cc_xfer(o, fd, tfd, false);
+	if (fd >= 0)
+		(void)close(fd);
+	if (tfd >= 0)
+		(void)close(tfd);
+	if (ok)
+		add += cc_commit(tmp, entry);
+	else
+		(void)unlink(tmp);
+
+	if (add)
+		cc_account(o, add);
+}
+
+/**
+ * @brief Get the preprocessing variant of a compile command.
+ *
+ * `-c` is replaced with `-E` and the output goes to standard output.
+ * A `-MD` file is given an explicit name and target, which are the
+ * defaults of the compile command, so that it is written even when the
+ * compile is skipped.
+ *
+ * @param cmd The compile command.
+ * @param mf Buffer for the name of the `-MD` file.
+ * @return The argument vector, or `nullptr` on failure.
+ */
+static char **
+cc_pp_argv (struct cc_cmd const *const cmd,
+            char                       mf[PATH_MAX])
+{
+	char **const argv = malloc(((size_t)cmd->argc + 5U) * sizeof *argv);
+	if (!argv)
+		return nullptr;
+
+	int n = 0;
+	for (int i = 0; i < cmd->argc; ++i) {
+		char *const a = cmd->argv[i];
+		if (i && cc_is(a, "-c")) {
+			argv[n++] = "-E";
+		} else if (i && cc_is(a, "-o")) {
+			++i;
+		} else if (!i || !cc_has_prefix(a, "-o")) {
+			argv[n++] = a;
+		}
+	}
+
+	if (cmd->md && !cmd->mf) {
+		char const *const base = strrchr(cmd->out, '/');
+		char const *const dot = strrchr(base ? base : cmd->out, '.');
+		int const len = dot ? (int)(dot - cmd->out) : (int)strlen(cmd->out);
+		(void)snprintf(mf, PATH_MAX, "%.*s.d", len, cmd->out);
+		argv[n++] = "-MF";
+		argv[n++] = mf;
+	}
+	if (cmd->md && !cmd->mt) {
+		argv[n++] = "-MQ";
+		argv[n++] = (char *)cmd->out;
+	}
+
+	argv[n] = nullptr;
+	return argv;
+}
+
+/**
+ * @brief Read a pipe to its end.
+ *
+ * @param fd The read end of the pipe.
+ * @param n Receives the number of bytes read.
+ * @return The bytes, or `nullptr` on failure.
+ */
+static char *
+cc_slurp (int const     fd,
+          size_t *const n)
+{
+	size_t cap = 1U << 20U, len = 0U;
+	char *buf = malloc(cap);
+
+	while (buf) {
+		if (len == cap) {
+			char *const p = realloc(buf, cap *= 2U);
+			if (!p)
+				break;
+			buf = p;
+		}
+
+		ssize_t const k = read(fd, &buf[len], cap - len);
+		if (k > 0) {
+			len += (size_t)k;
+		} else if (!k) {
+			*n = len;
+			return buf;
+		} else if (errno != EINTR) {
+			break;
+		}
+	}
+
+	free(buf);
+	return nullptr;
+}
+
+/**
+ * @brief Find a program the way `posix_spawnp()` does.
+ *
+ * @param name The program name.
+ * @param path Buffer for the path of the program.
+ * @param st Receives the program's file status.
+ * @return `true` if the program was found, `false` otherwise.
+ */
+static bool
+cc_which (char const *const name,
+          char              path[PATH_MAX],
+          struct stat *const st)
+{
+	if (strchr(name, '/')) {
+		(void)snprintf(path, PATH_MAX, "%s", name);
+		return !stat(path, st);
+	}
+
+	char const *dirs = getenv("PATH");
+	if (!dirs)
+		dirs = "/bin:/usr/bin";
+
+	for (char const *p = dirs;; ++p) {
+		char const *const end = strchrnul(p, ':');
+		int const k = (int)(end - p);
+		(void)snprintf(path, PATH_MAX, "%.*s/%s",
+		               k ? k : 1, k ? p : ".", name);
+		if (!stat(path, st) && S_ISREG(st->st_mode))
+			return true;
+		if (!*end)
+			return false;
+		p = end;
+	}
+}
+
+/**
+ * @brief Hash the profile read by `-fprofile-use=PATH`.
+ *
+ * The profile changes with each training run while the command stays
+ * the same. With Clang PATH is a merged profile and with GCC a
+ * directory of `.gcda` files, so the path, size and modification time
+ * of each file under it are hashed, in no particular order.
+ *
+ * @param path The file or directory.
+ * @param depth Directories left to descend into.
+ * @return The hash, or 0 if there's nothing there.
+ */
+static uint64_t
+cc_key_profile (char const *const path,
+                unsigned const    depth)
+{
+	struct stat st;
+	if (stat(path, &st))
+		return 0U;
+
+	if (!S_ISDIR(st.st_mode)) {
+		uint64_t const id[3] = {
+			(uint64_t)st.st_size,
+			(uint64_t)st.st_mtim.tv_sec,
+			(uint64_t)st.st_mtim.tv_nsec
+		};
+		return digest(id, sizeof id, digest(path, strlen(path), 0U));
+	}
+
+	DIR *const d = depth ? opendir(path) : nullptr;
+	if (!d)
+		return 0U;
+
+	uint64_t h = 0U;
+	char sub[PATH_MAX];
+	for (struct dirent *e; (e = readdir(d));) {
+		if (e->d_name[0] == '.' && (!e->d_name[1] ||
+		    (e->d_name[1] == '.' && !e->d_name[2])))
+			continue;
+		if ((size_t)snprintf(sub, sizeof sub, "%s/%s", path, e->d_name)
+		    < sizeof sub)
+			h ^= cc_key_profile(sub, depth - 1U);
+	}
+
+	(void)closedir(d);
+	return h;
+}
+
+/**
+ * @brief Compute the cache entry path of a compile.
+ *
+ * @param o Options.
+ * @param cmd The compile command.
+ * @param pp The preprocessed translation unit.
+ * @param n Length of `pp` in bytes.
+ * @param entry Buffer for the entry path.
+ * @return `true` on success, `false` if the compiler wasn't found.
+ */
+static bool
+cc_key (struct cc_opt const *const o,
+        struct cc_cmd const *const cmd,
+        char const *const          pp,
+        size_t const               n,
+        char                       entry[PATH_MAX])
+{
+	char path[PATH_MAX];
+	struct stat st;
+	if (!cc_which(cmd->argv[0], path, &st))
+		return false;
+
+	uint64_t h[2] = {
+		digest(pp, n, UINT64_C(0x6465656d2d6363)),
+		digest(pp, n, UINT64_C(0x9e3779b97f4a7c15))
+	};
+
+	uint64_t const id[3] = {
+		(uint64_t)st.st_size,
+		(uint64_t)st.st_mtim.tv_sec,
+		(uint64_t)st.st_mtim.tv_nsec
+	};
+
+	uint64_t prof = 0U;
+	for (int i = 1; i < cmd->argc; ++i)
+		if (cc_has_prefix(cmd->argv[i], "-fprofile-use="))
+			prof ^= cc_key_profile(&cmd->argv[i][sizeof "-fprofile-use=" - 1U], 64U);
+
+	for (int k = 0; k < 2; ++k) {
+		h[k] = digest(path, strlen(path) + 1U, h[k]);
+		h[k] = digest(id, sizeof id, h[k]);
+		if (prof)
+			h[k] = digest(&prof, sizeof prof, h[k]);
+		for (int i = 1; i < cmd->argc; ++i)
+			if (!cc_key_skip(cmd->argv, &i))
+				h[k] = digest(cmd->argv[i], strlen(cmd->argv[i]) + 1U, h[k]);
+	}
+
+	// Debug info records the working directory
+	if (cmd->g && getcwd(path, sizeof path))
+		for (int k = 0; k < 2; ++k)
+			h[k] = digest(path, strlen(path) + 1U, h[k]);
+
+	char const *sfx = "";
+	if (o->zip) {
+		char const *const base = strrchr(o->zip, '/');
+		sfx = base ? base + 1 : o->zip;
+	}
+
+	int const len = snprintf(entry, PATH_MAX,
+	                         "%s/%02x/%014" PRIx64 "%016" PRIx64 "%s%s",
+	                         o->dir, (unsigned)(h[0] >> 56U),
+	                         h[0] & UINT64_C(0xffffffffffffff), h[1],
+	                         *sfx ? "." : "", sfx);
+
+	// Leave room for the ".err" suffix
+	return len > 0 && len < PATH_MAX - 4;
+}
+
+/**
+ * @brief Preprocess, and look up or populate the cache.
+ *
+ * @param o Options.
+ * @param cmd The compile command.
+ * @return The exit status of the compile, or -1 if the command should
+ *         be run uncached.
+ */
+static int
+cc_run (struct cc_opt const *const o,
+        struct cc_cmd const *const cmd)
+{
+	char mf[PATH_MAX];
+	char **const pp_argv = cc_pp_argv(cmd, mf);
+	if (!pp_argv)
+		return -1;
+
+	// Preprocessor messages are printed by the compile, or replayed
+	FILE *const pp_err = tmpfile();
+	int p[2];
+	if (!pp_err || pipe2(p, O_CLOEXEC)) {
+		if (pp_err)
+			(void)fclose(pp_err);
+		free(pp_argv);
+		return -1;
+	}
+
+	pid_t const pid = cc_spawn(pp_argv, -1, p[1], fileno(pp_err));
+	(void)close(p[1]);
+	free(pp_argv);
+
+	size_t n = 0U;
+	char *const pp = pid > 0 ? cc_slurp(p[0], &n) : nullptr;
+	(void)close(p[0]);
+	int const st = pid > 0 ? cc_wait(pid) : -1;
+	(void)fclose(pp_err);
+
+	char entry[PATH_MAX];
+	bool const ok = pp && !st && cc_key(o, cmd, pp, n, entry);
+	free(pp);
+	if (!ok)
+		return -1;
+
+	if (cc_restore(o, entry, cmd->out))
+		return 0;
+
+	FILE *const err = tmpfile();
+	pid_t const cc = cc_spawn(cmd->argv, -1, -1, err ? fileno(err) : -1);
+	int const ret = cc > 0 ? cc_wait(cc) : 127;
+	if (err)
+		cc_replay(fileno(err));
+
+	cc_note(o, "m\n");
+	if (!ret)
+		cc_store(o, entry, cmd->out, err ? fileno(err) : -1);
+
+	if (err)
+		(void)fclose(err);
+	return ret;
+}
+
+/** @brief Read the monotonic clock in microseconds.
+ */
+static uint64_t
+cc_now (void)
+{
+	struct timespec ts;
+	(void)clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * UINT64_C(1000000)
+	     + (uint64_t)ts.tv_nsec / UINT64_C(1000);
+}
+
+/**
+ * @brief Append a command to the trace log.
+ *
+ * The record is a single line written with a single `write()` to a
+ * file opened in append mode, so concurrent jobs need no lock:
+ * `START DURATION PID CATEGORY NAME`, with times in microseconds.
+ *
+ * @param o Options.
+ * @param t0 Start time from @ref cc_now().
+ */
+static void
+cc_trace (struct cc_opt const *const o,
+          uint64_t const             t0)
+{
+	uint64_t const t1 = cc_now();
+	char line[PATH_MAX + 128];
+	int n = snprintf(line, sizeof line, "%" PRIu64 " %" PRIu64 " %ld %s %s\n",
+	                 t0, t1 - t0, (long)getpid(),
+	                 o->cat ? o->cat : "-", o->name ? o->name : "-");
+	if (n < 0)
+		return;
+	if ((size_t)n >= sizeof line) {
+		n = (int)sizeof line - 1;
+		line[n - 1] = '\n';
+	}
+
+	int const fd = open(o->trace, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC,
+	                    0644);
+	if (fd >= 0) {
+		if (write(fd, line, (size_t)n) < 0)
+			perror(o->trace);
+		(void)close(fd);
+	}
+}
+
+/**
+ * @brief Run a command uncached.
+ *
+ * Without tracing or buffering, deem-cc is replaced by the command.
+ *
+ * @param o Options.
+ * @param argv The command.
+ * @return The exit status of the command.
+ */
+static int
+cc_exec (struct cc_opt const *const o,
+         char *const *const         argv)
+{
+	if (o->trace || o->out >= 0) {
+		pid_t const pid = cc_spawn(argv, -1, -1, -1);
+		return pid > 0 ? cc_wait(pid) : 127;
+	}
+
+	(void)execvp(argv[0], argv);
+	(void)fprintf(stderr, "%s: %s\n", argv[0], strerror(errno));
+	return 127;
+}
+
+/**
+ * @brief Redirect standard output and error to memory.
+ *
+ * The output of the command goes to an anonymous in-memory file, so
+ * the command never waits on the terminal and nothing touches the
+ * disk. If that isn't possible, the banner is printed right away and
+ * the output isn't buffered.
+ *
+ * @param o Options. The original standard output is kept in `out`.
+ * @return The in-memory file, or -1.
+ */
+static int
+cc_buffer (struct cc_opt *const o)
+{
+	int const fd = memfd_create("deem-cc", MFD_CLOEXEC);
+	o->out = fd < 0 ? -1 : fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 3);
+	if (o->out < 0 || dup2(fd, STDOUT_FILENO) < 0
+	    || dup2(fd, STDERR_FILENO) < 0) {
+		if (fd >= 0)
+			(void)close(fd);
+		if (o->out >= 0) {
+			(void)dup2(o->out, STDOUT_FILENO);
+			(void)close(o->out);
+			o->out = -1;
+		}
+		(void)printf("%s\n", o->banner);
+		(void)fflush(stdout);
+		return -1;
+	}
+
+	return fd;
+}
+
+/**
+ * @brief Write the banner and the buffered output with one `writev()`.
+ *
+ * Small enough output reaches a pipe in one piece, and a terminal
+ * isn't interrupted mid-line by other jobs.
+ *
+ * @param o Options.
+ * @param fd The in-memory file from @ref cc_buffer().
+ */
+static void
+cc_flush (struct cc_opt const *const o,
+          int const                  fd)
+{
+	(void)fflush(stdout);
+	(void)fflush(stderr);
+
+	struct stat st;
+	size_t const n = fstat(fd, &st) ? 0U : (size_t)st.st_size;
+	void *const map = n ? mmap(nullptr, n, PROT_READ, MAP_PRIVATE, fd, 0)
+	                    : MAP_FAILED;
+
+	struct iovec iov[] = {
+		{.iov_base = (void *)o->banner, .iov_len = strlen(o->banner)},
+		{.iov_base = "\n",              .iov_len = 1U},
+		{.iov_base = map,               .iov_len = n}
+	};
+
+	struct iovec *const end = &iov[map == MAP_FAILED ? 2 : 3];
+	for (struct iovec *v = iov; v < end;) {
+		ssize_t w = writev(o->out, v, (int)(end - v));
+		if (w < 0) {
+			if (errno == EAGAIN)
+				(void)poll(&(struct pollfd){.fd = o->out, .events = POLLOUT},
+				           1U, -1);
+			else if (errno != EINTR)
+				break;
+			continue;
+		}
+		for (; v < end && (size_t)w >= v->iov_len; ++v)
+			w -= (ssize_t)v->iov_len;
+		if (v < end) {
+			v->iov_base = (char *)v->iov_base + w;
+			v->iov_len -= (size_t)w;
+		}
+	}
+
+	if (map != MAP_FAILED)
+		(void)munmap(map, n);
+	(void)close(fd);
+}
+
+static int
+usage (char const *const argv0,
+       int const         ret)
+{
+	(void)fprintf(ret ? stderr : stdout,
+		"Usage: %s [options] -- COMPILER ARG...\n"
+		"  -d DIR   cache directory\n"
+		"  -s FILE  append hit and miss records to FILE\n"
+		"  -m MiB   cache size limit (default 1024)\n"
+		"  -z PROG  compress entries with PROG (e.g. zstd)\n"
+		"  -l       restore hits by hardlink when possible\n"
+		"  -t FILE  append the start time and duration to FILE\n"
+		"  -n NAME  target name in the trace\n"
+		"  -c CAT   category in the trace, e.g. CC\n"
+		"  -b TEXT  buffer the output, and print it after TEXT\n",
+		argv0);
+	return ret;
+}
+
+int
+main (int    argc,
+      char **argv)
+{
+	struct cc_opt o = {
+		.max = UINT64_C(1024) << 20U,
+		.out = -1
+	};
+
+	for (int c; (c = getopt(argc, argv, "+d:s:m:z:lt:n:c:b:h")) != -1; ) {
+		char *e;
+		switch (c) {
+		case 'd': o.dir = optarg; break;
+		case 's': o.stats = optarg; break;
+		case 'z': o.zip = *optarg ? optarg : nullptr; break;
+		case 'l': o.link = true; break;
+		case 't': o.trace = optarg; break;
+		case 'n': o.name = optarg; break;
+		case 'c': o.cat = optarg; break;
+		case 'b': o.banner = optarg; break;
+		case 'm':
+			errno = 0;
+			o.max = strtoull(optarg, &e, 10) << 20U;
+			if (errno || e == optarg || *e)
+				return usage(argv[0], 2);
+			break;
+		case 'h': return usage(argv[0], 0);
+		default: return usage(argv[0], 2);
+		}
+	}
+	if (optind == argc)
+		return usage(argv[0], 2);
+
+	struct cc_cmd cmd = {
+		.argv = &argv[optind],
+		.argc = argc - optind
+	};
+
+	int const buf = o.banner ? cc_buffer(&o) : -1;
+	uint64_t const t0 = o.trace ? cc_now() : 0U;
+	int ret = -1;
+	if (o.dir) {
+		cc_parse(&cmd);
+		if (!cmd.odd)
+			ret = cc_run(&o, &cmd);
+	}
+
+	if (ret < 0)
+		ret = cc_exec(&o, cmd.argv);
+	if (o.trace)
+		cc_trace(&o, t0);
+	if (buf >= 0)
+		cc_flush(&o, buf);
+	return ret;
+}
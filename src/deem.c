@@ -1,12 +1,36 @@
 /* SPDX-License-Identifier: LGPL-3.0-or-later */
-#include <assert.h>
+#ifndef _GNU_SOURCE
+# define _GNU_SOURCE
+#endif
+
+#include <dirent.h>
+#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
 
 #include <gnumake.h>
 
+#include "cc.h"
+#include "deps.h"
+#include "depsdb.h"
+#include "digest.h"
+#include "jobs.h"
+#include "kvdb.h"
+#include "ljf.h"
+#include "memo.h"
+#include "prof.h"
+#include "str.h"
+#include "tmpl.h"
+#include "trace.h"
 #include "utf8.h"
+#include "walk.h"
 
 const int plugin_is_GPL_compatible;
 
@@ -16,136 +40,125 @@ enum flavor {
 	flavor_recursive
 };
 
-/** @brief String length
- */
-struct len {
-	size_t n_bytes; //< String length in bytes
-	size_t n_chars; //< String length in Unicode characters
+struct str {
+	char *ptr;
+	size_t len;
 };
 
-static struct len
-len (char const *str);
+/** @brief Scratch memory for generated makefile text
+ *
+ * String buffers built by the functions below live here until the
+ * outermost deem function or @ref deem_eval() returns, at which point
+ * the arena is reset for the next call. A function may expand its
+ * arguments, which can call other deem functions, so nothing is reset
+ * while any of them is still running.
+ */
+static struct arena deem_arena;
 
-/** @brief String pointer + length in bytes + length in code points
+/** @brief Nesting depth of deem functions and @ref deem_eval(), see
+ *         @ref deem_call()
  */
-struct ref {
-	union {
-		char       *mut;
-		char const *imm;
-	};
-	struct len len;
-};
+static unsigned deem_depth;
 
-static force_inline struct ref
-ref (char const *const str)
+/** @brief Profile of `gmk_expand()` calls, see `DEEM_PROFILE`
+ */
+static struct prof_site deem_prof_expand = {.name = "gmk_expand"};
+
+/** @brief Profile of `gmk_eval()` calls, see `DEEM_PROFILE`
+ */
+static struct prof_site deem_prof_eval = {.name = "gmk_eval"};
+
+static char *
+deem_expand (char const *const str)
 {
-	return (struct ref){
-		.imm = str,
-		.len = len(str)
-	};
+	if (!prof_on)
+		return gmk_expand(str);
+
+	uint64_t const t0 = prof_now();
+	char *const ret = gmk_expand(str);
+	prof_add(&deem_prof_expand, t0, strlen(str), ret ? strlen(ret) : 0U);
+	return ret;
 }
 
-/** @brief String buffer
- */
-struct buf {
-	struct ref str; //< Address + current length
-	size_t     cap; //< Local or allocated size
-};
+static void
+deem_gmk_eval (char const *const str)
+{
+	if (!prof_on) {
+		gmk_eval(str, nullptr);
+		return;
+	}
 
-#define define_buf(N) \
-struct buf##N { \
-	struct buf b; \
-	char       d[N - sizeof(struct buf)]; \
-}; \
-static force_inline struct buf##N \
-buf##N (struct buf##N *const buf) \
-{ \
-	return (struct buf##N){ \
-		.b = { \
-			.str = { \
-				.mut = buf->d, \
-				.len = {0, 0} \
-			}, \
-			.cap = N - sizeof(struct buf) \
-		}, \
-		.d = {0} \
-	}; \
-} \
-static force_inline void \
-buf##N##_fini (struct buf##N *const buf) \
-{ \
-	if (buf->b.str.mut != buf->d) { \
-		free(buf->b.str.mut); \
-		*buf = buf##N(buf); \
-	} \
-}
-
-define_buf(64)
-define_buf(256)
-define_buf(1024)
-
-#undef define_buf
-
-static force_inline void
-buf_append_ (struct buf *const      buf,
-            char const *const       str,
-            struct len const *const len)
-{
-	__builtin_memcpy(&buf->str.mut[buf->str.len.n_bytes], str, len->n_bytes);
-	buf->str.len.n_bytes += len->n_bytes;
-	buf->str.len.n_chars += len->n_chars;
-}
-
-static force_inline void
-buf_append (struct buf *const       buf,
-            struct ref const *const ref)
-{
-	buf_append_(buf, ref->imm, &ref->len);
-}
-
-#define buf_append_literal(buf, lit) \
-	buf_append_((buf), (lit), \
-		&(struct len){ \
-			sizeof (lit) - 1U, \
-			sizeof (lit) - 1U \
-		})
-
-static force_inline void
-buf_terminate (struct buf *const buf)
-{
-	buf->str.mut[buf->str.len.n_bytes] = '\0';
+	uint64_t const t0 = prof_now();
+	gmk_eval(str, nullptr);
+	prof_add(&deem_prof_eval, t0, strlen(str), 0U);
 }
 
-struct str {
-	char *ptr;
-	size_t len;
-};
+/** @brief Deferred mode, enabled by setting `DEEM_BATCH=1` before
+ *         loading deem.so
+ *
+ * Generated rule text is collected in @ref deem_batch and evaluated
+ * in one go by `$(deem-flush)` instead of one `gmk_eval()` for each
+ * declaration. Arguments are expanded when the declaration is made,
+ * see @ref deem_arg(), but the rest of the generated text is only
+ * expanded at the flush.
+ */
+static bool deem_batch_mode;
+
+/** @brief Pending rule text in deferred mode
+ */
+static struct buf deem_batch;
+
+/** @brief Backing memory of @ref deem_batch
+ */
+static struct arena deem_batch_arena;
+
+/** @brief Deferred mode statistics for `DEBUG_MK`
+ */
+static struct {
+	size_t pending; //< Declarations in @ref deem_batch
+	size_t saved;   //< `gmk_eval()` calls saved so far
+} deem_batch_stats;
 
+/**
+ * @brief Check if a make variable is set to 1.
+ *
+ * The variable is looked up once, and the result is cached in `flag`.
+ *
+ * @param ref Variable reference to expand, e.g. `$(DEBUG_MK)`.
+ * @param flag Cached result; 0 if not looked up yet.
+ * @return `true` if the variable expands to 1, ignoring whitespace.
+ */
 static bool
-deem_debug (void)
+deem_flag (char const *const ref,
+           int *const        flag)
 {
-	static int debug_mk = 0;
-
-	if (!debug_mk) {
-		int debug_mk_ = -1;
-		char *str = gmk_expand("$(DEBUG_MK)");
+	if (!*flag) {
+		int flag_ = -1;
+		char *str = deem_expand(ref);
 		if (str) {
 			char const *p = str;
 			while (*p >= '\t' && (*p <= '\r' || *p == ' '))
 				++p;
 			if (*p == '1') do {
 				if (!*++p) {
-					debug_mk_ = 1;
+					flag_ = 1;
 					break;
 				}
 			} while (*p >= '\t' && (*p <= '\r' || *p == ' '));
 			gmk_free(str);
 		}
 
-		debug_mk = debug_mk_;
+		*flag = flag_;
 	}
 
-	return debug_mk == 1;
+	return *flag == 1;
+}
+
+static bool
+deem_debug (void)
+{
+	static int debug_mk = 0;
+	return deem_flag("$(DEBUG_MK)", &debug_mk);
 }
 
 static void
@@ -174,49 +187,205 @@ deem_eval (char const *const str)
 			begin = end;
 		}
 	}
-	gmk_eval(str, nullptr);
+
+	++deem_depth;
+	deem_gmk_eval(str);
+	if (!--deem_depth)
+		arena_reset(&deem_arena);
+}
+
+/**
+ * @brief Evaluate generated rule text, or queue it in deferred mode.
+ *
+ * Falls back to immediate evaluation if the text can't be queued.
+ *
+ * @param buf The null-terminated rule text.
+ */
+static void
+deem_defer (struct buf const *const buf)
+{
+	if (!deem_batch_mode ||
+	    !buf_reserve(&deem_batch, buf->str.len.n_bytes + sizeof "\n")) {
+		deem_eval(buf->str.mut);
+		return;
+	}
+
+	buf_append(&deem_batch, &buf->str);
+	buf_append_literal(&deem_batch, "\n");
+	buf_terminate(&deem_batch);
+	++deem_batch_stats.pending;
+
+	if (!deem_depth)
+		arena_reset(&deem_arena);
 }
 
-static struct ref
-trim (char const *str);
+/**
+ * @brief Expand a function argument for generated rule text.
+ *
+ * Each `$` of the expansion is doubled, since the rule text is
+ * expanded once more when it's evaluated.
+ *
+ * @param str The argument.
+ * @return The argument itself if it has no references, otherwise its
+ *         expansion in @ref deem_arena.
+ */
+static char const *
+deem_arg_now (char const *const str)
+{
+	if (!strchr(str, '$'))
+		return str;
+
+	char *exp = deem_expand(str);
+	if (!exp)
+		return str;
+
+	size_t n = 0;
+	for (char const *p = exp; *p; ++p)
+		n += *p == '$' ? 2U : 1U;
+
+	struct buf loc = buf_arena(&deem_arena);
+	char const *ret = str;
+	if (buf_reserve(&loc, n + 1U)) {
+		char *q = loc.str.mut;
+		for (char const *p = exp; *p; ++p) {
+			if (*p == '$')
+				*q++ = '$';
+			*q++ = *p;
+		}
+		*q = '\0';
+		ret = loc.str.imm;
+	}
+
+	gmk_free(exp);
+	return ret;
+}
 
 /**
- * @brief Check if the buffer has enough capacity, and allocate more
- *        if it does not.
+ * @brief Expand a function argument now if it would otherwise only
+ *        be expanded at flush time.
  *
- * This function does not resize an existing heap allocation. Trying
- * to do so will result in the old allocation being leaked.
+ * In deferred mode the generated text is evaluated later, when loop
+ * variables and the like may no longer have the same value. Unexpanded
+ * arguments are expanded up front to keep them from changing meaning,
+ * see @ref deem_arg_now().
  *
- * The only valid use case is when `buf` is embedded in a size-typed
- * stack buffer and `buf->str.mut` points at the attached storage of
- * that stack buffer. See the `define_buf()` macro etc. for details.
+ * @param str The argument.
+ * @return The argument itself, or its expansion in @ref deem_arena.
+ */
+static char const *
+deem_arg (char const *const str)
+{
+	return deem_batch_mode ? deem_arg_now(str) : str;
+}
+
+/** @brief Longest-job-first mode, enabled by setting `DEEM_LJF=1`
+ *         before loading deem.so
  *
- * @param buf The buffer to check.
- * @param size The required capacity.
- * @return `true` if the buffer had enough capacity or an allocation
- *         was made successfully, `false` otherwise.
+ * The duration of each compile and link is recorded in `$O.deem-times`
+ * through `deem-cc`, see @ref helper_init(). `$(library)` then lists
+ * the objects of each library slowest first, and the libraries are
+ * made prerequisites of `all` in order of their critical path, longest
+ * first. Make starts prerequisites in order, so the slow jobs no
+ * longer end up last while the other slots sit idle. Targets without
+ * a recorded duration are assumed to be slow. The `all` prerequisites
+ * are declared by `$(deem-flush)`, and without it the build stops
+ * rather than doing nothing. With `DEEM_LJF=report` the critical
+ * path of each library is also printed at the end of the build.
  */
-static bool
-buf_reserve (struct buf *const buf,
-             size_t            size)
+static bool deem_ljf_mode;
+
+/** @brief Print the critical path report, see @ref deem_ljf_mode
+ */
+static bool deem_ljf_report;
+
+/** @brief Recorded durations, and the targets and goals to order
+ */
+static struct ljf deem_ljf = {.db = {.fd = -1}};
+
+/** @brief Declare the held back goals as prerequisites of `all`.
+ */
+static void
+ljf_flush (void)
 {
-	assert(!buf->str.mut || buf->str.mut == (char *)&buf[1]);
+	char *const def = ljf_goals(&deem_ljf, "all:|");
+	if (def) {
+		deem_eval(def);
+		free(def);
+	}
+}
 
-	// FIXME: needs overflow check
-	size += buf->str.len.n_bytes;
-	if (size > buf->cap) {
-		char *ptr = malloc(size);
-		if (!ptr) {
-			perror("malloc");
-			return false;
-		}
-		if (buf->str.len.n_bytes)
-			__builtin_memcpy(ptr, buf->str.mut, buf->str.len.n_bytes);
-		ptr[buf->str.len.n_bytes] = '\0';
-		buf->str.mut = ptr;
-		buf->cap = size;
+/**
+ * @brief Fail if goals were never declared: `$(ljf-check)`
+ *
+ * The recipe of `.deem-ljf`, which @ref ljf_goal() makes the first
+ * prerequisite of `all`, so that a missing `$(deem-flush)` stops the
+ * build instead of leaving `all` with nothing to do.
+ */
+static char *
+ljf_check (useless char const    *f,
+           useless unsigned int   c,
+           useless char         **v)
+{
+	if (deem_ljf.n_goal) {
+		char msg[128];
+		(void)snprintf(msg, sizeof msg, "$(error deem: %zu goals were "
+		               "never added to all, $$(deem-flush) is missing)",
+		               deem_ljf.n_goal);
+		deem_eval(msg);
 	}
-	return true;
+
+	return nullptr;
+}
+
+/** @brief Evaluate all queued rule text: `$(deem-flush)`
+ *
+ * In longest-job-first mode the held back goals are declared after
+ * the rule text, see @ref deem_ljf_mode.
+ */
+static char *
+deem_flush (useless char const    *f,
+            useless unsigned int   c,
+            useless char         **v)
+{
+	if (!deem_batch.str.len.n_bytes) {
+		ljf_flush();
+		return nullptr;
+	}
+
+	size_t n = deem_batch_stats.pending;
+	deem_batch_stats.pending = 0U;
+	deem_batch_stats.saved += n - 1U;
+
+	if (deem_debug())
+		(void)fprintf(stderr, "deem-flush: %zu declarations in one eval"
+		              ", %zu evals saved in total\n", n,
+		              deem_batch_stats.saved);
+
+	/* gmk_eval() works on a copy, so declarations expanded during the
+	 * evaluation can safely start a new batch in the same buffer.
+	 */
+	char const *const str = deem_batch.str.mut;
+	deem_batch.str.len = (struct len){0U, 0U};
+	deem_eval(str);
+
+	if (!deem_batch.str.len.n_bytes) {
+		arena_reset(&deem_batch_arena);
+		deem_batch = buf_arena(&deem_batch_arena);
+	}
+
+	ljf_flush();
+	return nullptr;
+}
+
+/** @brief Complain about declarations that were never flushed.
+ */
+static void
+deem_batch_check (void)
+{
+	if (deem_batch_stats.pending)
+		(void)fprintf(stderr, "deem: %zu declarations were never "
+		              "evaluated, $(deem-flush) is missing\n",
+		              deem_batch_stats.pending);
 }
 
 /** @brief Wrap the return value of `gmk_alloc()` in a `struct buf`.
@@ -278,7 +447,7 @@ lazy_ (struct buf *buf,
 
 	#undef XLAZY
 
-	deem_eval(buf->str.mut);
+	deem_defer(buf);
 }
 
 static char *
@@ -287,9 +456,8 @@ lazy (useless char const  *f,
       char               **v)
 {
 	if (c == 2U && v[0] && v[1]) {
-		struct buf256 loc = buf256(&loc);
-		lazy_(&loc.b, v[0], v[1]);
-		buf256_fini(&loc);
+		struct buf loc = buf_arena(&deem_arena);
+		lazy_(&loc, deem_arg(v[0]), v[1]);
 	}
 
 	return nullptr;
@@ -352,6 +520,87 @@ sgr (useless char const    *f,
 	return sgr_buf(v[0], v[1], nullptr);
 }
 
+/** @brief Message prefixes registered with `$(register-msg)`
+ *
+ * The prefixes are rendered once, with colors only if standard output
+ * is a terminal, so that `$(msg)` can print without going through
+ * make's parser.
+ */
+static struct memo deem_msg;
+
+/**
+ * @brief Check if make collects the output of each job, i.e. `-O`.
+ *
+ * `$(info)` output is then part of the job output, so `$(msg)` has
+ * to go through it. The flags are only looked at once.
+ */
+static bool
+msg_sync (void)
+{
+	static int sync = -1;
+	if (sync < 0) {
+		sync = 0;
+		char *const flags = deem_expand("$(filter -O% --output-sync%,"
+		                                "$(filter-out -Onone "
+		                                "--output-sync=none,$(MAKEFLAGS)))");
+		if (flags) {
+			sync = flags[0] != '\0';
+			gmk_free(flags);
+		}
+	}
+	return sync;
+}
+
+/**
+ * @brief Print a message with a registered prefix.
+ *
+ * Make's own buffered output is flushed first to keep the order.
+ *
+ * @return `false` if the prefix isn't registered.
+ */
+static bool
+msg_write (struct ref const *const pfx,
+           char const *const       txt)
+{
+	struct memo_ent const *const e = memo_find(&deem_msg, pfx->imm,
+	                                           pfx->len.n_bytes,
+	                                           memo_hash(pfx->imm,
+	                                                     pfx->len.n_bytes));
+	if (!e)
+		return false;
+
+	struct iovec iov[] = {
+		{.iov_base = (void *)e->val, .iov_len = e->vlen},
+		{.iov_base = (void *)txt,    .iov_len = strlen(txt)},
+		{.iov_base = "\n",           .iov_len = 1U}
+	};
+
+	(void)fflush(stdout);
+	for (struct iovec *v = iov; v < &iov[array_size(iov)];) {
+		ssize_t n = writev(STDOUT_FILENO, v, (int)(&iov[array_size(iov)] - v));
+		if (n < 0) {
+			if (errno != EINTR)
+				break;
+			continue;
+		}
+		for (; v < &iov[array_size(iov)] && (size_t)n >= v->iov_len; ++v)
+			n -= (ssize_t)v->iov_len;
+		if (v < &iov[array_size(iov)]) {
+			v->iov_base = (char *)v->iov_base + n;
+			v->iov_len -= (size_t)n;
+		}
+	}
+
+	return true;
+}
+
+/**
+ * @brief Print a message: `$(msg PREFIX,TEXT)`
+ *
+ * A prefix registered with `$(register-msg)` is printed directly with
+ * `writev()`, unless make is synchronizing job output. Otherwise the
+ * message goes through `$(info $(PREFIX_pfx)TEXT)`.
+ */
 static char *
 msg (useless char const  *f,
      unsigned int         c,
@@ -364,50 +613,175 @@ msg (useless char const  *f,
 	if (!pfx_ref.imm)
 		return nullptr;
 
+	if (!msg_sync() && msg_write(&pfx_ref, v[1]))
+		return nullptr;
+
 	struct ref txt_ref = ref(v[1]);
-	struct buf64 loc = buf64(&loc);
-	if (!buf_reserve(&loc.b,
+	struct buf loc = buf_arena(&deem_arena);
+	if (!buf_reserve(&loc,
 		sizeof "$(info $(" /* pfx */ "_pfx)" /* txt */ ")"
 		+ pfx_ref.len.n_bytes + txt_ref.len.n_bytes))
 		return nullptr;
 
-	buf_append_literal(&loc.b, "$(info $(");
-	buf_append(&loc.b, &pfx_ref);
-	buf_append_literal(&loc.b, "_pfx)");
-	buf_append_(&loc.b, txt_ref.imm, &txt_ref.len);
-	buf_append_literal(&loc.b, ")");
-	buf_terminate(&loc.b);
+	buf_append_literal(&loc, "$(info $(");
+	buf_append(&loc, &pfx_ref);
+	buf_append_literal(&loc, "_pfx)");
+	buf_append_(&loc, txt_ref.imm, &txt_ref.len);
+	buf_append_literal(&loc, ")");
+	buf_terminate(&loc);
 
-	deem_eval(loc.b.str.mut);
-	buf64_fini(&loc);
+	deem_eval(loc.str.mut);
 
 	return nullptr;
 }
 
+/** @brief Output buffering mode, enabled by setting
+ *         `DEEM_BUFFER_OUTPUT=1` before loading deem.so
+ *
+ * The compile and link commands of `$(library)` run through `deem-cc`,
+ * which keeps their standard output and error in memory and writes
+ * them out at once when the command is done, after the `$(msg)`
+ * banner of the job. Output of parallel jobs is then never mixed, and
+ * unlike `--output-sync` no temporary files are involved. The banner
+ * of a link shows the file name of the target.
+ */
+static bool deem_buffer_mode;
+
+/** @brief Whether `deem-cc` prints the banners, see @ref helper_init()
+ */
+static bool deem_buffer_on;
+
+/**
+ * @brief Print the banner of a job: `$(job-msg PREFIX,TEXT)`
+ *
+ * Same as `$(msg)`, except in output buffering mode, where `deem-cc`
+ * prints the banner together with the output of the job.
+ */
+static char *
+job_msg (char const   *f,
+         unsigned int  c,
+         char        **v)
+{
+	return deem_buffer_on ? nullptr : msg(f, c, v);
+}
+
+/**
+ * @brief Render a message as a shell word:
+ *        `$(msg-banner PREFIX,TEXT)`
+ *
+ * The prefix is the one `$(msg)` would print, so a command can print
+ * the message itself.
+ */
+static char *
+msg_banner (useless char const  *f,
+            useless unsigned int c,
+            char               **v)
+{
+	struct ref pfx_ref = trim(v[0]);
+	if (!pfx_ref.imm)
+		return nullptr;
+
+	struct memo_ent const *const e = memo_find(&deem_msg, pfx_ref.imm,
+	                                           pfx_ref.len.n_bytes,
+	                                           memo_hash(pfx_ref.imm,
+	                                                     pfx_ref.len.n_bytes));
+	char *var = nullptr;
+	if (!e) {
+		struct buf ref = buf_arena(&deem_arena);
+		if (!buf_reserve(&ref, pfx_ref.len.n_bytes + sizeof "$(_pfx)"))
+			return nullptr;
+		buf_append_literal(&ref, "$(");
+		buf_append(&ref, &pfx_ref);
+		buf_append_literal(&ref, "_pfx)");
+		buf_terminate(&ref);
+		var = deem_expand(ref.str.imm);
+	}
+
+	char const *const pfx = e ? e->val : var ? var : "";
+	char const *const txt[] = {pfx, v[1]};
+	size_t size = sizeof "''";
+	for (size_t k = 0; k < array_size(txt); ++k)
+		for (char const *s = txt[k]; *s; ++s)
+			size += *s == '\'' ? sizeof "'\\''" - 1U : 1U;
+
+	char *const ret = gmk_alloc(size);
+	if (ret) {
+		char *p = ret;
+		*p++ = '\'';
+		for (size_t k = 0; k < array_size(txt); ++k) {
+			for (char const *s = txt[k]; *s; ++s) {
+				if (*s == '\'')
+					p = stpcpy(p, "'\\''");
+				else
+					*p++ = *s;
+			}
+		}
+		*p++ = '\'';
+		*p = '\0';
+	}
+
+	if (var)
+		gmk_free(var);
+	return ret;
+}
+
+/**
+ * @brief Remember the rendered prefix of a message type.
+ *
+ * A prefix which is registered again replaces the old one.
+ */
+static void
+msg_keep (struct ref const *const pfx,
+          char const *const       val)
+{
+	size_t const vn = strlen(val);
+	uint64_t const h = memo_hash(pfx->imm, pfx->len.n_bytes);
+	struct memo_ent *const e = (struct memo_ent *)
+		memo_find(&deem_msg, pfx->imm, pfx->len.n_bytes, h);
+
+	if (e) {
+		char const *const v = memo_key(&deem_msg, val, vn);
+		if (v) {
+			e->val = v;
+			e->vlen = vn;
+		}
+		return;
+	}
+
+	char const *const k = memo_key(&deem_msg, pfx->imm, pfx->len.n_bytes);
+	if (k)
+		(void)memo_insert(&deem_msg, k, pfx->len.n_bytes, h, val, vn);
+}
+
 static char *
 register_msg (useless char const    *f,
               useless unsigned int   c,
               char                 **v)
 {
-	struct buf64 sgr = buf64(&sgr);
-	if (!sgr_buf(v[1], v[0], &sgr.b))
+	struct buf sgr = buf_arena(&deem_arena);
+	if (!sgr_buf(v[1], v[0], &sgr))
 		return nullptr;
 
-	char buf[256];
-
 	struct ref pfx_ref = trim(v[0]);
-	if (!pfx_ref.imm ||
-	    pfx_ref.len.n_bytes > sizeof buf - sizeof "_pfx")
-		goto done;
+	if (!pfx_ref.imm)
+		return nullptr;
+
+	static int tty = -1;
+	if (tty < 0)
+		tty = isatty(STDOUT_FILENO);
+	msg_keep(&pfx_ref, tty ? sgr.str.imm : v[0]);
 
-	__builtin_memcpy(buf, pfx_ref.imm, pfx_ref.len.n_bytes);
-	__builtin_memcpy(&buf[pfx_ref.len.n_bytes], "_pfx", sizeof "_pfx");
+	struct buf var = buf_arena(&deem_arena);
+	if (!buf_reserve(&var, pfx_ref.len.n_bytes + sizeof "_pfx"))
+		return nullptr;
+
+	buf_append(&var, &pfx_ref);
+	buf_append_literal(&var, "_pfx");
+	buf_terminate(&var);
 
-	char *arr[] = {buf, sgr.b.str.mut};
+	char *arr[] = {var.str.mut, sgr.str.mut};
 	lazy(nullptr, 2U, arr);
 
-done:
-	buf64_fini(&sgr);
 	return nullptr;
 }
 
@@ -447,7 +821,7 @@ cat_if (char      **argv,
 {
 	// Expand the argument indicated by `side`.
 	char *str[] = {nullptr, nullptr};
-	str[side] = gmk_expand(argv[side]);
+	str[side] = deem_expand(argv[side]);
 	if (!str[side])
 		return nullptr;
 
@@ -459,7 +833,7 @@ cat_if (char      **argv,
 		return nullptr;
 	}
 
-	str[!side] = gmk_expand(argv[!side]);
+	str[!side] = deem_expand(argv[!side]);
 	if (str[!side]) do {
 		ref[!side] = trim(str[!side]);
 		if (!ref[!side].imm) {
@@ -519,104 +893,2270 @@ sfx_if (useless char const    *f,
 	return cat_if(v, left_side);
 }
 
-static char *
-library (useless char const    *f,
-         useless unsigned int   c,
-         char                 **v)
+/** @brief Template behind `$(library NAME,SRC)`
+ *
+ * `$1` is the library name and `$2` its source list. It is registered
+ * as the `library` template, so `$(define-template library,...)` can
+ * replace it. If `PCH_$1` names a header, it is precompiled with the
+ * library's `CFLAGS` and included in front of every source. If `LTO_$1`
+ * names a mode of @ref lto_flags(), the library is built with
+ * link-time optimization and its LTO cache is kept in
+ * `$O.deem-lto/$1`.
+ *
+ * If `PGO_$1` is a training command, an instrumented copy of the
+ * library is built in `$O.deem-pgo/$1`, and `train-$1` runs the command
+ * to write a profile there. The objects of the library are compiled
+ * with the profile, so it's trained again only when the sources change.
+ * `clean-$1` leaves the profile in place.
+ *
+ * The recipe flags come from private target-specific variables, which
+ * aren't visible while the makefile is read, so the commands checked in
+ * content digest mode name `LTO_$1`, `PCH_$1` and `PGO_$1` instead,
+ * plus the checksum of the profile written by @ref pgo_merge().
+ */
+static char const library_tmpl[] =
+	".PHONY: $1 clean-$1 install-$1\n"
+	"all:| $(ljf-goal $1,$O$1)\n"
+	"clean:| clean-$1\n"
+	"install:| install-$1\n"
+	"\n"
+	"override SRC_$1:=$2\n"
+	"override OBJ_$1:=$(SRC_$1:%=$O%.o-fpic)\n"
+	"override DEP_$1:=$(SRC_$1:%=$O%.d)\n"
+	"override PCH_OUT_$1:=$(if $(PCH_$1),$(PCH_$1:%=$O%.$(pch-ext)))\n"
+	"override PGO_OBJ_$1:=$(if $(PGO_$1),$(SRC_$1:%=$O.deem-pgo/$1/%.o-fpic))\n"
+	"\n"
+	"ifneq (,$(filter all $1,$(or $(MAKECMDGOALS),all)))\n"
+	"$1: $O$1\n"
+	"endif\n"
+	"\n"
+	"ifneq (,$(filter all install $1 install-$1 train-$1,$(or $(MAKECMDGOALS),all)))\n"
+	"$O$1: $(ljf-sort $O$1,$(OBJ_$1))\n"
+	"\t$(job-msg LINK,$1)\n"
+	"\t@+$(DEEM_LD) $(CC) $(CFLAGS) $(CFLAGS_$1) $(DEEM_LTO) -fPIC -shared -o $@ -MMD $(OBJ_$1)$(lto-prune $(LTO_$1),$O.deem-lto/$1)\n"
+	"\n"
+	"%.c.o-fpic: %.c\n"
+	"\t$(job-msg CC,$(@F))\n"
+	"\t@+$(DEEM_CC) $(CC) $(CFLAGS) $(CFLAGS_$(@F)) $(DEEM_LTO) $(DEEM_PCH) $(DEEM_PGO) -fPIC -c -o $@ -MMD $(deps-flags $@) $<\n"
+	"\n"
+	"ifneq (,$(LTO_$1))\n"
+	"$(OBJ_$1) $(PCH_OUT_$1): override private DEEM_LTO:=$(lto-flags $(LTO_$1),compile)\n"
+	"$O$1: override private DEEM_LTO:=$(lto-flags $(LTO_$1),link,$O.deem-lto/$1)\n"
+	"endif\n"
+	"\n"
+	"ifneq (,$(PCH_OUT_$1))\n"
+	"$(OBJ_$1): $(PCH_OUT_$1)\n"
+	"$(OBJ_$1): override private DEEM_PCH:=-include $O$(PCH_$1) -Winvalid-pch\n"
+	"$(PCH_OUT_$1): $O$(PCH_$1)\n"
+	"\t$(job-msg CC,$(@F))\n"
+	"\t@+$(DEEM_CC) $(CC) $(CFLAGS) $(DEEM_LTO) -fPIC -x c-header -c -o $@ -MMD -MF $@.d $<\n"
+	"$(load-deps $(PCH_OUT_$1:%=%.d))\n"
+	"endif\n"
+	"\n"
+	"ifneq (,$(PGO_$1))\n"
+	".PHONY: train-$1\n"
+	"train-$1: $O.deem-pgo/$1/profile\n"
+	"$(OBJ_$1): $O.deem-pgo/$1/profile\n"
+	"$(OBJ_$1): override private DEEM_PGO=$(pgo-flags use,$O.deem-pgo/$1,$<)\n"
+	"$(PGO_OBJ_$1): override private DEEM_PCH:=$(if $(PCH_$1),-include $O$(PCH_$1))\n"
+	"$(PGO_OBJ_$1): $O.deem-pgo/$1/%.o-fpic: $O%\n"
+	"\t$(job-msg CC,$(@F))\n"
+	"\t@mkdir -p $(@D)\n"
+	"\t@+$(DEEM_CC) $(CC) $(CFLAGS) $(CFLAGS_$(@F)) $(DEEM_PCH) $(pgo-flags generate,$O.deem-pgo/$1,$<) -fPIC -c -o $@ -MMD $<\n"
+	"$O.deem-pgo/$1/$1: $(PGO_OBJ_$1)\n"
+	"\t$(job-msg LINK,$1)\n"
+	"\t@+$(DEEM_LD) $(CC) $(CFLAGS) $(CFLAGS_$1) $(pgo-flags generate,$O.deem-pgo/$1) -fPIC -shared -o $@ $^\n"
+	"$O.deem-pgo/$1/profile: private export DEEM_PGO_LIB:=$O.deem-pgo/$1/$1\n"
+	"$O.deem-pgo/$1/profile: $O.deem-pgo/$1/$1\n"
+	"\t$(msg TRAIN,$1)\n"
+	"\t@$(RM) -r $(@D)/data\n"
+	"\t@$(PGO_$1)\n"
+	"\t@$(pgo-merge $(@D))\n"
+	"$(load-deps $(PGO_OBJ_$1:.o-fpic=.d))\n"
+	"endif\n"
+	"\n"
+	"$(load-deps $(DEP_$1),$(OBJ_$1),$$(CC) $$(CFLAGS) $$(CFLAGS_%) -fPIC -c $$(LTO_$1) $$(PCH_$1) $$(PGO_$1)$$(if $$(PGO_$1), $$(file <$O.deem-pgo/$1/profile.id)))\n"
+	"$(digest-check $O$1,$(OBJ_$1),$$(CC) $$(CFLAGS) $$(CFLAGS_%) -fPIC -shared $$(LTO_$1) $$(PCH_$1) $$(PGO_$1))\n"
+	"endif\n"
+	"\n"
+	"ifneq (,$(filter clean clean-$1,$(MAKECMDGOALS)))\n"
+	"clean-$1: $(eval override private WHAT_$1=$$(eval clean-$1: override private WHAT_$1:=$$$$(sort $$$$(wildcard "
+	"$O$1 $(OBJ_$1) $(DEP_$1) $(PCH_OUT_$1) $(PCH_OUT_$1:%=%.d) "
+	"$(PGO_OBJ_$1) $(PGO_OBJ_$1:.o-fpic=.d) $(if $(PGO_$1),$O.deem-pgo/$1/$1)))))$(WHAT_$1)\n"
+	"clean-$1:;$(if $(WHAT_$1),$(info \e[38;5;191mYEET\e[m    \e[38;5;119m(╯°□°)╯︵ ┻━┻\e[m $(WHAT_$1:$O%=%))"
+	"\t@$(RM) $(WHAT_$1),@:)\n"
+	"endif\n"
+	"\n"
+	"ifneq (,$(filter install install-$1,$(MAKECMDGOALS)))\n"
+	"$(eval install-$1: override private DST_$1=$(eval override private DST_$1:=$$(if $$(DESTDIR),$$(DESTDIR:/=)/)$$(if $$(libdir),$$(libdir:/=)/)$1.0)$(DST_$1))\n"
+	"install-$1: $O$1\n"
+	"\t$(msg INSTALL,$(DST_$1))\n"
+	"\t@install -DTsm 0644 $O$1 $(DST_$1)\n"
+	"endif";
+
+static struct ref const library_name = {
+	.imm = "library",
+	.len = {sizeof "library" - 1U, sizeof "library" - 1U}
+};
+
+/**
+ * @brief Render a template and evaluate the result.
+ *
+ * @param name The template name.
+ * @param arg The arguments for placeholders `$1` and up.
+ * @param n_arg The number of elements in `arg`.
+ */
+static void
+render_ (struct ref const *const name,
+         struct ref const *const arg,
+         size_t const            n_arg)
 {
-	if (c < 2U || !v[0] || !v[1])
-		return nullptr;
+	struct tmpl const *const t = tmpl_find(name);
+	if (!t) {
+		(void)fprintf(stderr, "render: %.*s: no such template\n",
+		              (int)name->len.n_bytes, name->imm);
+		return;
+	}
 
-	struct library_args {
-		struct ref pos[2];
-		bool install;
-	} args = {0};
+	struct buf loc = buf_arena(&deem_arena);
+	if (tmpl_render(t, &loc, arg, n_arg))
+		deem_defer(&loc);
+}
 
+/**
+ * @brief Compile a template: `$(define-template NAME,TEXT)`
+ *
+ * Without `TEXT`, the value of the variable `NAME` is used, which
+ * allows multi-line templates to be written with `define`.
+ */
+static char *
+define_template (useless char const  *f,
+                 unsigned int         c,
+                 char               **v)
+{
 	struct ref name = trim(v[0]);
 	if (!name.imm)
 		return nullptr;
 
-	struct ref src = trim(v[1]);
-	if (!src.imm)
-		return nullptr;
-
-	#define XLIBRARY(NAME, SRC, L, V, N) \
-	L(".PHONY: ") V(NAME) L(" clean-") V(NAME) L(" install-") V(NAME) L("\n" \
-	"all:| ") V(NAME) L("\n" \
-	"clean:| clean-") V(NAME) L("\n" \
-	"install:| install-") V(NAME) L("\n" \
-	"\n" \
-	"override SRC_") V(NAME) L(":=") V(SRC) L("\n" \
-	"override OBJ_") V(NAME) L(":=$(SRC_") V(NAME) L(":%=$O%.o-fpic)\n" \
-	"override DEP_") V(NAME) L(":=$(SRC_") V(NAME) L(":%=$O%.d)\n" \
-	"\n" \
-	"ifneq (,$(filter all ") V(NAME) L(",$(or $(MAKECMDGOALS),all)))\n") \
-	V(NAME) L(": $O") V(NAME) L("\n" \
-	"endif\n" \
-	"\n" \
-	"ifneq (,$(filter all install ") V(NAME) L(" install-") V(NAME) L(",$(or $(MAKECMDGOALS),all)))\n" \
-	"$O") V(NAME) L(": $(OBJ_") V(NAME) L(")\n" \
-	"\t$(msg LINK,") V(NAME) L(")\n" \
-	"\t@+$(CC) $(CFLAGS) $(CFLAGS_") V(NAME) L(") -fPIC -shared -o $@ -MMD $^\n" \
-	"\n" \
-	"%.c.o-fpic: %.c\n" \
-	"\t$(msg CC,$(@F))\n" \
-	"\t@+$(CC) $(CFLAGS) $(CFLAGS_$(@F)) -fPIC -c -o $@ -MMD $<\n" \
-	"\n" \
-	"-include $(DEP_") V(NAME) L(")\n" \
-	"endif\n" \
-	"\n" \
-	"ifneq (,$(filter clean clean-") V(NAME) L(",$(MAKECMDGOALS)))\n" \
-	"clean-") V(NAME) L(": $(eval override private WHAT_") V(NAME) L("=$$(eval clean-") V(NAME) L(": override private WHAT_") V(NAME) L(":=$$$$(sort $$$$(wildcard " \
-	"$O") V(NAME) L(" $(OBJ_") V(NAME) L(") $(DEP_") V(NAME) L(")))))$(WHAT_") V(NAME) L(")\n" \
-	"clean-") V(NAME) L(":;$(if $(WHAT_") V(NAME) L("),$(info \e[38;5;191mYEET\e[m    \e[38;5;119m(╯°□°)╯︵ ┻━┻\e[m $(WHAT_") V(NAME) L(":$O%=%))" \
-	"\t@$(RM) $(WHAT_") V(NAME) L("),@:)\n" \
-	"endif\n" \
-	"\n" \
-	"ifneq (,$(filter install install-") V(NAME) L(",$(MAKECMDGOALS)))\n" \
-	"$(eval install-") V(NAME) L(": override private DST_") V(NAME) L("=$(eval override private DST_") V(NAME) L(":=$$(if $$(DESTDIR),$$(DESTDIR:/=)/)$$(if $$(libdir),$$(libdir:/=)/)") V(NAME) L(".0)$(DST_") V(NAME) L("))\n" \
-	"install-") V(NAME) L(": $O") V(NAME) L("\n" \
-	"\t$(msg INSTALL,$(DST_") V(NAME) L("))\n" \
-	"\t@install -DTsm 0644 $O") V(NAME) L(" $(DST_") V(NAME) L(")\n" \
-	"endif") N()
-
-	#define lit_(x) (sizeof x - 1U) +
-	#define var_(x) (x).len.n_bytes +
-	#define nul_()  1U
+	if (c > 1U) {
+		(void)tmpl_define(&name, v[1]);
+		return nullptr;
+	}
 
-	struct buf1024 loc = buf1024(&loc);
-	if (!buf_reserve(&loc.b, XLIBRARY(name, src, lit_, var_, nul_)))
+	struct buf loc = buf_arena(&deem_arena);
+	if (!buf_reserve(&loc, sizeof "$(value " /* name */ ")"
+	                       + name.len.n_bytes))
 		return nullptr;
 
-	#undef nul_
-	#undef var_
-	#undef lit_
+	buf_append_literal(&loc, "$(value ");
+	buf_append(&loc, &name);
+	buf_append_literal(&loc, ")");
+	buf_terminate(&loc);
 
-	#define lit_(x) buf_append_literal(&loc.b, x);
-	#define var_(x) buf_append(&loc.b, &x);
-	#define nul_()  buf_terminate(&loc.b)
+	char *text = deem_expand(loc.str.mut);
+	if (text) {
+		(void)tmpl_define(&name, text);
+		gmk_free(text);
+	}
 
-	XLIBRARY(name, src, lit_, var_, nul_);
+	return nullptr;
+}
 
-	#undef nul_
-	#undef var_
-	#undef lit_
+/**
+ * @brief Render a template and evaluate it: `$(render NAME,ARG...)`
+ *
+ * The arguments are trimmed but not expanded, like with `$(library)`.
+ */
+static char *
+render (useless char const  *f,
+        unsigned int         c,
+        char               **v)
+{
+	struct ref name = trim(v[0]);
+	if (!name.imm)
+		return nullptr;
 
-	#undef XLIBRARY
+	size_t n = c - 1U;
+	struct ref *arg = arena_alloc(&deem_arena, n * sizeof *arg);
+	if (!arg)
+		return nullptr;
 
-	deem_eval(loc.b.str.mut);
-	buf1024_fini(&loc);
+	for (size_t i = 0; i < n; ++i) {
+		arg[i] = trim(deem_arg(v[i + 1U]));
+		if (!arg[i].imm)
+			arg[i].imm = "";
+	}
 
+	render_(&name, arg, n);
 	return nullptr;
 }
 
-int
-deem_gmk_setup (useless gmk_floc const *floc)
+/**
+ * @brief Split a whitespace-separated list in place.
+ *
+ * @param s The list, or `nullptr`. Words are null-terminated in place.
+ * @param n Receives the number of words.
+ * @return Array of the words, or `nullptr` if there are none or memory
+ *         allocation fails. Release with `free()`.
+ */
+static char const **
+split_words (char *const   s,
+             size_t *const n)
 {
-	if (deem_debug()) {
-		puts("\e[0;36m┌───────╮\e[m\n"
-		     "\e[0;36m│"
-		     "\e[1;34md\e[m "
+	size_t cnt = 0U;
+	for (char const *p = s; p && *p;) {
+		while (is_space(*p))
+			++p;
+		if (!*p)
+			break;
+		++cnt;
+		while (*p && !is_space(*p))
+			++p;
+	}
+
+	*n = 0U;
+	if (!cnt)
+		return nullptr;
+
+	char const **ret = malloc(cnt * sizeof *ret);
+	if (!ret) {
+		perror("malloc");
+		return nullptr;
+	}
+
+	for (char *p = s; *p;) {
+		while (is_space(*p))
+			++p;
+		if (!*p)
+			break;
+		ret[(*n)++] = p;
+		while (*p && !is_space(*p))
+			++p;
+		if (*p)
+			*p++ = '\0';
+	}
+
+	return ret;
+}
+
+/** @brief Source in a unity build, see @ref unity_split()
+ */
+struct unity_src {
+	char const *path;
+	unsigned    batch; //< Batch number, 0 if compiled on its own
+};
+
+/**
+ * @brief Write a file unless it already has the given contents.
+ *
+ * Leaving an unchanged file alone keeps make from rebuilding what
+ * depends on it.
+ */
+static void
+unity_write (char const *const path,
+             char const *const text,
+             size_t const      n)
+{
+	FILE *f = fopen(path, "r");
+	if (f) {
+		char *old = malloc(n + 1U);
+		size_t const got = old ? fread(old, 1U, n + 1U, f) : 0U;
+		bool const same = old && got == n && !memcmp(old, text, n);
+		free(old);
+		(void)fclose(f);
+		if (same)
+			return;
+	}
+
+	f = fopen(path, "w");
+	if (!f || fwrite(text, 1U, n, f) != n) {
+		perror(path);
+		if (f)
+			(void)fclose(f);
+		return;
+	}
+	if (fclose(f))
+		perror(path);
+}
+
+/**
+ * @brief Group the sources of a library into unity batches.
+ *
+ * Each batch is a generated translation unit under `$O.deem-unity`
+ * which includes its members. Members are spread over the batches
+ * greedily, heaviest first, each to the batch with the least weight
+ * so far. The weight of a source is the recorded compile time of its
+ * object if every member has one, see @ref deem_ljf_mode, and its
+ * size otherwise.
+ *
+ * @param name The library name.
+ * @param src The source list. Modified in place.
+ * @param n_batch The number of batches.
+ * @param excl Sources to compile on their own, or `nullptr`. Modified
+ *             in place.
+ * @param out Receives the batches and the sources compiled on their
+ *            own.
+ * @return `true` on success, `false` otherwise.
+ */
+static bool
+unity_split (char const *const name,
+             char *const       src,
+             unsigned          n_batch,
+             char *const       excl,
+             struct buf *const out)
+{
+	size_t n, n_excl;
+	char const **const w = split_words(src, &n);
+	char const **const ex = split_words(excl, &n_excl);
+	struct unity_src *const u = w ? malloc(n * sizeof *u) : nullptr;
+	struct ljf_rank *const r = w ? malloc(n * sizeof *r) : nullptr;
+	char *const dir = deem_expand("$O");
+	bool ok = u && r && dir;
+
+	size_t n_mem = 0U;
+	bool timed = true;
+	for (size_t i = 0; ok && i < n; ++i) {
+		u[i] = (struct unity_src){.path = w[i], .batch = 1U};
+		for (size_t k = 0; k < n_excl; ++k) {
+			if (!strcmp(w[i], ex[k]))
+				u[i].batch = 0U;
+		}
+		if (!u[i].batch)
+			continue;
+
+		char obj[PATH_MAX];
+		(void)snprintf(obj, sizeof obj, "%s%s.o-fpic", dir, w[i]);
+		r[n_mem] = (struct ljf_rank){.t = ljf_time(&deem_ljf, obj), .i = i};
+		if (r[n_mem++].t == UINT64_MAX)
+			timed = false;
+	}
+
+	// Sizes are only comparable with sizes
+	for (size_t k = 0; ok && !timed && k < n_mem; ++k) {
+		struct stat st;
+		char path[PATH_MAX];
+		(void)snprintf(path, sizeof path, "%s%s", dir, w[r[k].i]);
+		r[k].t = stat(path, &st) ? 0U : (uint64_t)st.st_size;
+	}
+
+	if (n_batch > n_mem)
+		n_batch = (unsigned)n_mem;
+	uint64_t *const load = ok && n_batch ? calloc(n_batch, sizeof *load)
+	                                     : nullptr;
+	if (n_batch && !load)
+		ok = false;
+	if (ok && n_batch) {
+		qsort(r, n_mem, sizeof *r, ljf_rank_cmp);
+		for (size_t k = 0; k < n_mem; ++k) {
+			unsigned b = 0U;
+			for (unsigned j = 1U; j < n_batch; ++j) {
+				if (load[j] < load[b])
+					b = j;
+			}
+			load[b] += r[k].t;
+			u[r[k].i].batch = b + 1U;
+		}
+	}
+
+	char path[PATH_MAX];
+	(void)snprintf(path, sizeof path, "%s.deem-unity", dir ? dir : "");
+	if (ok && n_batch && mkdir(path, 0755) && errno != EEXIST) {
+		perror(path);
+		ok = false;
+	}
+
+	struct buf text = buf_arena(&deem_arena);
+	for (unsigned b = 1U; ok && b <= n_batch; ++b) {
+		text.str.len = (struct len){0U, 0U};
+		size_t size = sizeof "/* Generated by deem */\n";
+		for (size_t i = 0; i < n; ++i) {
+			if (u[i].batch == b)
+				size += sizeof "#include \"\"\n" + strlen(dir)
+				      + strlen(u[i].path);
+		}
+		if (!buf_reserve(&text, size)) {
+			ok = false;
+			break;
+		}
+
+		buf_append_literal(&text, "/* Generated by deem */\n");
+		for (size_t i = 0; i < n; ++i) {
+			if (u[i].batch != b)
+				continue;
+			struct ref d = ref(dir), p = ref(u[i].path);
+			buf_append_literal(&text, "#include \"");
+			buf_append(&text, &d);
+			buf_append(&text, &p);
+			buf_append_literal(&text, "\"\n");
+		}
+
+		(void)snprintf(path, sizeof path, "%s.deem-unity/%s-%u.c", dir,
+		               name, b);
+		unity_write(path, text.str.imm, text.str.len.n_bytes);
+
+		char word[PATH_MAX];
+		int const len = snprintf(word, sizeof word, " .deem-unity/%s-%u.c",
+		                         name, b);
+		struct ref wr = {.imm = word, .len = {(size_t)len, 0U}};
+		if (!buf_reserve(out, wr.len.n_bytes + 1U)) {
+			ok = false;
+			break;
+		}
+		buf_append(out, &wr);
+	}
+
+	for (size_t i = 0; ok && i < n; ++i) {
+		if (u[i].batch)
+			continue;
+		struct ref p = ref(u[i].path);
+		if (!buf_reserve(out, p.len.n_bytes + 2U)) {
+			ok = false;
+			break;
+		}
+		buf_append_literal(out, " ");
+		buf_append(out, &p);
+	}
+	if (ok)
+		buf_terminate(out);
+
+	if (dir)
+		gmk_free(dir);
+	free(load);
+	free(r);
+	free(u);
+	free(ex);
+	free(w);
+	return ok;
+}
+
+/** @brief Compiler behind `CC`, see @ref cc_probe()
+ */
+static struct {
+	char          *cc; //< Value of `CC` when it was probed
+	struct cc_info id; //< What it turned out to be
+} deem_cc;
+
+/**
+ * @brief Find out which compiler `CC` is.
+ *
+ * The compiler is only asked again when `CC` changes.
+ */
+static void
+cc_probe (void)
+{
+	char *const now = deem_expand("$(CC)");
+	if (!now)
+		return;
+
+	if (!deem_cc.cc || strcmp(deem_cc.cc, now)) {
+		free(deem_cc.cc);
+		deem_cc.cc = strdup(now);
+		char *const ver = deem_expand("$(shell $(CC) --version 2>/dev/null)");
+		deem_cc.id = cc_info(ver);
+		if (ver)
+			gmk_free(ver);
+	}
+
+	gmk_free(now);
+}
+
+/**
+ * @brief Copy rendered flags or a command into a make return value.
+ * @param buf The rendered text.
+ * @param n Return value of the renderer, see e.g. @ref cc_lto_flags().
+ * @param size Size of `buf`.
+ */
+static char *
+deem_ret (char const *const buf,
+          int const         n,
+          size_t const      size)
+{
+	if (n < 0 || (size_t)n >= size)
+		return nullptr;
+
+	char *const ret = gmk_alloc((size_t)n + 1U);
+	if (ret)
+		__builtin_memcpy(ret, buf, (size_t)n + 1U);
+	return ret;
+}
+
+/**
+ * @brief Precompiled header suffix of `CC`: `$(pch-ext)`
+ *
+ * See @ref cc_pch_ext().
+ */
+static char *
+pch_ext (useless char const    *f,
+         useless unsigned int   c,
+         useless char         **v)
+{
+	cc_probe();
+	char const *const ext = cc_pch_ext(deem_cc.id);
+	return deem_ret(ext, (int)strlen(ext), sizeof "gch");
+}
+
+/**
+ * @brief Size limit of an LTO cache in MiB from `DEEM_LTO_CACHE_SIZE`,
+ *        1024 by default.
+ */
+static unsigned long long
+lto_cache_mib (void)
+{
+	char *const size = deem_expand("$(strip $(DEEM_LTO_CACHE_SIZE))");
+	unsigned long long const mib = size && size[0]
+	                             ? strtoull(size, nullptr, 10) : 1024U;
+	if (size)
+		gmk_free(size);
+	return mib;
+}
+
+/**
+ * @brief Link-time optimization flags:
+ *        `$(lto-flags MODE,compile|link[,CACHE-DIR])`
+ *
+ * See @ref cc_lto_flags(). The cache of lld is limited to
+ * `DEEM_LTO_CACHE_SIZE` MiB.
+ */
+static char *
+lto_flags (useless char const  *f,
+           unsigned int         c,
+           char               **v)
+{
+	int const mode = cc_lto_find(v[0]);
+	if (mode < 0)
+		return nullptr;
+
+	struct ref const what = trim(v[1]);
+	bool const link = what.imm && what.len.n_bytes == 4U
+	               && !strncmp(what.imm, "link", 4U);
+	struct ref const dir = trim(c > 2U ? v[2] : "");
+	bool const cache = link && mode == CC_LTO_INCREMENTAL && dir.imm
+	                && dir.len.n_bytes;
+	cc_probe();
+
+	char buf[PATH_MAX + 256];
+	int const n = cc_lto_flags(buf, sizeof buf, deem_cc.id,
+	                           (enum cc_lto_mode)mode, link, dir,
+	                           cache && deem_cc.id.clang
+	                           ? lto_cache_mib() : 0U);
+	return deem_ret(buf, n, sizeof buf);
+}
+
+/**
+ * @brief Prune an LTO cache: `$(lto-prune MODE,CACHE-DIR)`
+ *
+ * For an incremental GCC link the cache is pruned to
+ * `DEEM_LTO_CACHE_SIZE` MiB, see @ref cc_lto_prune(). Meant for the
+ * link recipe, where it runs just before the link.
+ */
+static char *
+lto_prune (useless char const  *f,
+           useless unsigned int c,
+           char               **v)
+{
+	// Most links don't use the cache, so only they ask for the compiler
+	if (cc_lto_find(v[0]) != CC_LTO_INCREMENTAL)
+		return nullptr;
+	cc_probe();
+	if (deem_cc.id.clang)
+		return nullptr;
+
+	struct ref const d = trim(v[1]);
+	char path[PATH_MAX];
+	(void)snprintf(path, sizeof path, "%.*s", (int)d.len.n_bytes,
+	               d.imm ? d.imm : "");
+	cc_lto_prune(path, (uint64_t)lto_cache_mib() << 20U);
+	return nullptr;
+}
+
+/**
+ * @brief Profile-guided optimization flags:
+ *        `$(pgo-flags generate|use,PROFILE-DIR[,SRC])`
+ *
+ * See @ref cc_pgo_flags().
+ */
+static char *
+pgo_flags (useless char const  *f,
+           unsigned int         c,
+           char               **v)
+{
+	int const mode = cc_pgo_find(v[0]);
+	struct ref const dir = trim(v[1]);
+	struct ref const src = trim(c > 2U ? v[2] : "");
+	if (mode < 0 || !dir.imm || !dir.len.n_bytes)
+		return nullptr;
+	cc_probe();
+
+	char buf[2U * PATH_MAX + 256];
+	int const n = cc_pgo_flags(buf, sizeof buf, deem_cc.id,
+	                           (enum cc_pgo_mode)mode, dir, src);
+	return deem_ret(buf, n, sizeof buf);
+}
+
+/**
+ * @brief Command to finish a training run: `$(pgo-merge PROFILE-DIR)`
+ *
+ * Clang's profiles are merged with `$(LLVM_PROFDATA)`, by default
+ * `llvm-profdata`. See @ref cc_pgo_merge().
+ */
+static char *
+pgo_merge (useless char const  *f,
+           useless unsigned int c,
+           char               **v)
+{
+	struct ref const dir = trim(v[0]);
+	if (!dir.imm || !dir.len.n_bytes)
+		return nullptr;
+	cc_probe();
+
+	char *const tool = deem_cc.id.clang
+	                 ? deem_expand("$(or $(strip $(LLVM_PROFDATA)),llvm-profdata)")
+	                 : nullptr;
+	char buf[4U * PATH_MAX + 256];
+	int const n = cc_pgo_merge(buf, sizeof buf, dir, tool);
+	if (tool)
+		gmk_free(tool);
+	return deem_ret(buf, n, sizeof buf);
+}
+
+/**
+ * @brief Define a variable of a library: `override VAR_NAME:=VALUE`
+ *
+ * VALUE has already been expanded, so each `$` in it is doubled. The
+ * definition is queued with the rule text of the library, so that in
+ * deferred mode it is evaluated in order, see @ref deem_defer().
+ */
+static void
+library_var (struct ref const *const lib,
+             char const *const       var,
+             char const *const       val)
+{
+	struct ref v = ref(var), x = trim(val);
+	if (!x.imm)
+		return;
+
+	size_t n = x.len.n_bytes;
+	for (size_t i = 0; i < x.len.n_bytes; ++i)
+		n += x.imm[i] == '$';
+
+	struct buf def = buf_arena(&deem_arena);
+	if (!buf_reserve(&def, sizeof "override :=" + v.len.n_bytes
+	                       + lib->len.n_bytes + n))
+		return;
+
+	buf_append_literal(&def, "override ");
+	buf_append(&def, &v);
+	buf_append(&def, lib);
+	buf_append_literal(&def, ":=");
+	for (size_t i = 0; i < x.len.n_bytes; ++i) {
+		if (x.imm[i] == '$')
+			def.str.mut[def.str.len.n_bytes++] = '$';
+		def.str.mut[def.str.len.n_bytes++] = x.imm[i];
+	}
+	buf_terminate(&def);
+	deem_defer(&def);
+}
+
+/**
+ * @brief Declare a shared library: `$(library NAME,SRC[,OPTION...])`
+ *
+ * Renders the `library` template. NAME is expanded first, so that it
+ * can come from e.g. a `$(foreach)` variable which no longer has its
+ * value when the recipes run. The options are:
+ *
+ * - `unity=N` compiles the sources as N unity batches rather than one
+ *   by one, see @ref unity_split(). Sources with flags of their own
+ *   belong in the exclude list.
+ * - `unity-exclude=SRC` lists sources to compile on their own anyway.
+ * - `pch=HEADER` precompiles HEADER for the sources, see
+ *   @ref library_tmpl.
+ * - `lto=full|thin|incremental` enables link-time optimization, see
+ *   @ref lto_flags().
+ * - `pgo=COMMAND` builds the library with profile-guided optimization.
+ *   COMMAND is run by `train-NAME` against an instrumented build of the
+ *   library, whose path is in the environment as `DEEM_PGO_LIB`, see
+ *   @ref library_tmpl. Write `$$` for a `$` which is meant for the
+ *   shell.
+ */
+static char *
+library (useless char const    *f,
+         unsigned int           c,
+         char                 **v)
+{
+	if (c < 2U || !v[0] || !v[1])
+		return nullptr;
+
+	// The recipes look up variables by name long after loop variables
+	// and the like in NAME have changed, so it's expanded in any mode
+	struct ref arg[2] = {trim(deem_arg_now(v[0])), trim(deem_arg(v[1]))};
+	if (!arg[0].imm || !arg[1].imm)
+		return nullptr;
+
+	unsigned long unity = 0U;
+	char *excl = nullptr, *pch = nullptr, *lto = nullptr, *pgo = nullptr;
+	for (unsigned i = 2U; i < c; ++i) {
+		char *const opt = deem_expand(v[i]);
+		if (!opt)
+			continue;
+
+		char const *val = opt;
+		while (is_space(*val))
+			++val;
+		if (!strncmp(val, "unity=", 6U)) {
+			unity = strtoul(&val[6], nullptr, 10);
+		} else if (!strncmp(val, "unity-exclude=", 14U)) {
+			free(excl);
+			excl = strdup(&val[14]);
+		} else if (!strncmp(val, "pch=", 4U)) {
+			free(pch);
+			pch = strdup(&val[4]);
+		} else if (!strncmp(val, "lto=", 4U)) {
+			free(lto);
+			lto = strdup(&val[4]);
+		} else if (!strncmp(val, "pgo=", 4U)) {
+			free(pgo);
+			pgo = strdup(&val[4]);
+		} else if (*val) {
+			(void)fprintf(stderr, "library: unknown option: %s\n", val);
+		}
+		gmk_free(opt);
+	}
+
+	if (pch)
+		library_var(&arg[0], "PCH_", pch);
+	if (lto && cc_lto_find(lto) >= 0)
+		library_var(&arg[0], "LTO_", lto);
+	if (pgo)
+		library_var(&arg[0], "PGO_", pgo);
+
+	struct buf src = buf_arena(&deem_arena);
+	// File names need the name as expanded, not as rendered
+	char *const exp = unity ? deem_expand(v[0]) : nullptr;
+	struct ref const id = trim(exp ? exp : "");
+	char *const name = exp && id.imm ? strndup(id.imm, id.len.n_bytes)
+	                                 : nullptr;
+	if (exp)
+		gmk_free(exp);
+	char *const list = name ? deem_expand(v[1]) : nullptr;
+	if (list && unity_split(name, list, unity > UINT_MAX ? UINT_MAX
+	                                                    : (unsigned)unity,
+	                        excl, &src))
+		arg[1] = trim(src.str.imm);
+
+	render_(&library_name, arg, 2U);
+
+	if (list)
+		gmk_free(list);
+	free(name);
+	free(pgo);
+	free(lto);
+	free(pch);
+	free(excl);
+	return nullptr;
+}
+
+/** @brief Memoized expansions of `$(memo)` and `$(memo-call)`
+ */
+static struct memo deem_memo;
+
+/** @brief Scratch memory for memoization keys
+ */
+static struct arena deem_memo_scratch;
+
+/** @brief Arguments of the `$(memo-call)` or `$(cached-shell)` being
+ *         expanded, see @ref memo_arg()
+ */
+static struct {
+	char   **v;
+	unsigned c;
+} deem_memo_args;
+
+/**
+ * @brief Look up a memoization key, or expand and store on a miss.
+ *
+ * @param key The key, built in @ref deem_memo_scratch.
+ * @param expr The expression to expand on a miss. Must not live in
+ *             @ref deem_memo_scratch, as the expansion may reuse it.
+ * @return The expansion, allocated with `gmk_alloc()`.
+ */
+static char *
+deem_memo_get (struct buf const *const key,
+               char const *const       expr)
+{
+	char const *const kp = key->str.imm;
+	size_t const kn = key->str.len.n_bytes;
+	uint64_t const h = memo_hash(kp, kn);
+
+	struct memo_ent const *const e = memo_find(&deem_memo, kp, kn, h);
+	if (e) {
+		char *r = gmk_alloc(e->vlen + 1U);
+		if (r)
+			__builtin_memcpy(r, e->val, e->vlen + 1U);
+		return r;
+	}
+
+	char const *const k = memo_key(&deem_memo, kp, kn);
+	char *const val = deem_expand(expr);
+	if (k && val)
+		(void)memo_insert(&deem_memo, k, kn, h, val, strlen(val));
+
+	return val;
+}
+
+/** @brief Memoize an expansion: `$(memo EXPR)`
+ *
+ * The key is the unexpanded text, so `EXPR` is assumed to always
+ * expand to the same value.
+ */
+static char *
+memo (useless char const    *f,
+      useless unsigned int   c,
+      char                 **v)
+{
+	arena_reset(&deem_memo_scratch);
+	struct ref expr = {
+		.imm = v[0],
+		.len = {strlen(v[0]), 0U}
+	};
+
+	struct buf key = buf_arena(&deem_memo_scratch);
+	if (!buf_reserve(&key, expr.len.n_bytes + 2U))
+		return nullptr;
+
+	buf_append_literal(&key, "e");
+	buf_append(&key, &expr);
+	buf_terminate(&key);
+
+	return deem_memo_get(&key, v[0]);
+}
+
+/** @brief Memoize a function call: `$(memo-call FN,ARG...)`
+ *
+ * Like `$(call)`, but the result is cached by the function name and
+ * the expanded arguments, so `FN` is assumed to be pure.
+ */
+static char *
+memo_call (useless char const  *f,
+           unsigned int         c,
+           char               **v)
+{
+	arena_reset(&deem_memo_scratch);
+	struct ref fn = trim(v[0]);
+	if (!fn.imm)
+		return nullptr;
+
+	size_t kn = sizeof "c" + fn.len.n_bytes;
+	size_t en = sizeof "$(call )" + fn.len.n_bytes;
+	for (unsigned i = 1U; i < c; ++i) {
+		kn += 1U + strlen(v[i]);
+		en += sizeof ",$(deem-memo-arg 4294967295)" - 1U;
+	}
+
+	struct buf key = buf_arena(&deem_memo_scratch);
+	if (!buf_reserve(&key, kn))
+		return nullptr;
+
+	buf_append_literal(&key, "c");
+	buf_append(&key, &fn);
+	for (unsigned i = 1U; i < c; ++i) {
+		struct ref arg = {
+			.imm = v[i],
+			.len = {strlen(v[i]), 0U}
+		};
+		buf_append_literal(&key, "\0");
+		buf_append(&key, &arg);
+	}
+	buf_terminate(&key);
+
+	// The expansion may reuse the scratch arena, so keep this apart
+	char *const expr = malloc(en);
+	if (!expr) {
+		perror("malloc");
+		return nullptr;
+	}
+
+	int n = sprintf(expr, "$(call %.*s", (int)fn.len.n_bytes, fn.imm);
+	for (unsigned i = 1U; i < c; ++i)
+		n += sprintf(&expr[n], ",$(deem-memo-arg %u)", i);
+	(void)sprintf(&expr[n], ")");
+
+	deem_memo_args.v = v;
+	deem_memo_args.c = c;
+	char *const ret = deem_memo_get(&key, expr);
+	free(expr);
+	return ret;
+}
+
+/** @brief Argument `N` of the current `$(memo-call)`
+ *
+ * Passes the already expanded arguments on to `$(call)` or `$(shell)`
+ * without expanding them a second time.
+ */
+static char *
+memo_arg (useless char const    *f,
+          useless unsigned int   c,
+          char                 **v)
+{
+	char *end;
+	unsigned long i = strtoul(v[0], &end, 10);
+	if (*end || !i || i >= deem_memo_args.c)
+		return nullptr;
+
+	char const *const a = deem_memo_args.v[i];
+	size_t const n = strlen(a) + 1U;
+	char *r = gmk_alloc(n);
+	if (r)
+		__builtin_memcpy(r, a, n);
+	return r;
+}
+
+/** @brief Results of `$(cached-shell)`, kept in `$O.deem-shell-cache`
+ */
+static struct kvdb deem_shell_db = {.fd = -1};
+
+/** @brief File identity for `$(cached-shell)` keys
+ */
+struct shell_key_file {
+	uint64_t dev;
+	uint64_t ino;
+	uint64_t size;
+	int64_t  sec;
+	int64_t  nsec;
+};
+
+/**
+ * @brief Run a shell command unless its output is cached:
+ *        `$(cached-shell KEY-FILES,COMMAND)`
+ *
+ * The output is cached across make invocations, keyed by the command
+ * and the device, inode, size and modification time of each of the
+ * key files. Only the output of commands which exit with status 0 is
+ * cached. `.SHELLSTATUS` is not updated on a cache hit.
+ */
+static char *
+cached_shell (useless char const  *f,
+              unsigned int         c,
+              char               **v)
+{
+	char *const cmd = c > 1U ? v[1] : v[0];
+	char *const files = c > 1U ? v[0] : nullptr;
+
+	if (deem_shell_db.fd < 0) {
+		static bool tried = false;
+		if (!tried) {
+			tried = true;
+			char *path = deem_expand("$O.deem-shell-cache");
+			if (path) {
+				(void)kvdb_open(&deem_shell_db, path);
+				gmk_free(path);
+			}
+		}
+	}
+
+	struct ref cmd_ref = {
+		.imm = cmd,
+		.len = {strlen(cmd), 0U}
+	};
+	struct buf key = buf_arena(&deem_arena);
+	if (!buf_reserve(&key, cmd_ref.len.n_bytes + 1U))
+		return nullptr;
+
+	buf_append(&key, &cmd_ref);
+	buf_append_literal(&key, "\0");
+
+	for (char *p = files; p;) {
+		while (is_space(*p))
+			++p;
+		if (!*p)
+			break;
+
+		char *e = p;
+		while (*e && !is_space(*e))
+			++e;
+
+		// Terminate the file name in place for stat()
+		char const end = *e;
+		*e = '\0';
+
+		struct stat st;
+		struct shell_key_file id = {0};
+		if (!stat(p, &st)) {
+			id.dev = (uint64_t)st.st_dev;
+			id.ino = (uint64_t)st.st_ino;
+			id.size = (uint64_t)st.st_size;
+			id.sec = (int64_t)st.st_mtim.tv_sec;
+			id.nsec = (int64_t)st.st_mtim.tv_nsec;
+		} else {
+			id.size = UINT64_MAX;
+		}
+
+		*e = end;
+		size_t n = (size_t)(e - p);
+		if (!buf_reserve(&key, n + 1U + sizeof id))
+			return nullptr;
+
+		buf_append_(&key, p, &(struct len){n, 0U});
+		buf_append_literal(&key, "\0");
+		buf_append_(&key, (char const *)&id,
+		            &(struct len){sizeof id, 0U});
+		p = e;
+	}
+
+	char const *val;
+	size_t vn;
+	if (kvdb_get(&deem_shell_db, key.str.imm, key.str.len.n_bytes,
+	             &val, &vn)) {
+		char *r = gmk_alloc(vn + 1U);
+		if (r)
+			__builtin_memcpy(r, val, vn + 1U);
+		return r;
+	}
+
+	deem_memo_args.v = (char *[]){nullptr, cmd};
+	deem_memo_args.c = 2U;
+	char *const ret = deem_expand("$(shell $(deem-memo-arg 1))");
+	if (!ret || deem_shell_db.fd < 0)
+		return ret;
+
+	char *status = deem_expand("$(.SHELLSTATUS)");
+	if (status) {
+		if (!strcmp(status, "0"))
+			(void)kvdb_put(&deem_shell_db, key.str.imm,
+			               key.str.len.n_bytes, ret, strlen(ret));
+		gmk_free(status);
+	}
+
+	return ret;
+}
+
+/**
+ * @brief Run shell commands concurrently:
+ *        `$(parallel-shell COMMAND[,COMMAND...])`
+ *
+ * Each command is run like `$(shell)` would, but up to as many at a
+ * time as make's jobserver allows, see @ref jobs_run(). The outputs
+ * are joined with spaces in argument order, with newlines converted
+ * like `$(shell)` does. `.SHELLSTATUS` is set to the last nonzero exit
+ * status in argument order, or 0.
+ */
+static char *
+parallel_shell (useless char const  *f,
+                unsigned int         c,
+                char               **v)
+{
+	struct job *const job = calloc(c, sizeof *job);
+	if (!job) {
+		perror("calloc");
+		return nullptr;
+	}
+
+	char *const shell = deem_expand("$(SHELL) $(.SHELLFLAGS)");
+	size_t n_sh = 0U;
+	char const **const sh = split_words(shell, &n_sh);
+	if (!sh) {
+		if (shell)
+			gmk_free(shell);
+		free(job);
+		return nullptr;
+	}
+
+	for (unsigned i = 0; i < c; ++i)
+		job[i].cmd = v[i];
+	(void)jobs_run(job, c, sh, n_sh);
+	free(sh);
+	gmk_free(shell);
+
+	size_t size = 1U;
+	int status = 0;
+	for (unsigned i = 0; i < c; ++i) {
+		size += job[i].n_out + 1U;
+		if (job[i].status)
+			status = job[i].status;
+	}
+
+	char *const ret = gmk_alloc(size);
+	if (ret) {
+		char *p = ret;
+		for (unsigned i = 0; i < c; ++i) {
+			size_t n = job[i].n_out;
+			while (n && job[i].out[n - 1U] == '\n')
+				--n;
+			if (!n)
+				continue;
+
+			if (p != ret)
+				*p++ = ' ';
+			for (size_t k = 0; k < n; ++k) {
+				char const b = job[i].out[k];
+				if (b == '\r' && k + 1U < n && job[i].out[k + 1U] == '\n')
+					continue;
+				*p++ = b == '\n' ? ' ' : b;
+			}
+		}
+		*p = '\0';
+	}
+
+	char def[sizeof "override .SHELLSTATUS:=-2147483648"];
+	(void)sprintf(def, "override .SHELLSTATUS:=%d", status);
+	deem_gmk_eval(def);
+
+	for (unsigned i = 0; i < c; ++i)
+		free(job[i].out);
+	free(job);
+	return ret;
+}
+
+/**
+ * @brief Sort prerequisites slowest first: `$(ljf-sort TARGET,PREREQS)`
+ *
+ * Outside of longest-job-first mode PREREQS is returned in its
+ * original order. See @ref deem_ljf_mode.
+ */
+static char *
+ljf_sort (useless char const  *f,
+          useless unsigned int c,
+          char               **v)
+{
+	size_t n, n_name;
+	char const **const name = split_words(v[0], &n_name);
+	char const **const w = split_words(v[1], &n);
+	char const *const tgt = name ? name[0] : nullptr;
+	if (!w || (deem_ljf_mode && !ljf_order(&deem_ljf, tgt, w, n))) {
+		free(w);
+		free(name);
+		return nullptr;
+	}
+
+	size_t size = 1U;
+	for (size_t i = 0; i < n; ++i)
+		size += strlen(w[i]) + 1U;
+
+	char *const ret = gmk_alloc(size);
+	if (ret) {
+		char *p = ret;
+		for (size_t i = 0; i < n; ++i) {
+			if (i)
+				*p++ = ' ';
+			p = stpcpy(p, w[i]);
+		}
+		*p = '\0';
+	}
+
+	free(w);
+	free(name);
+	return ret;
+}
+
+/**
+ * @brief Add a goal to `all`: `$(ljf-goal NAME,TARGET)`
+ *
+ * Returns NAME, except in longest-job-first mode, where the goal is
+ * held back until `$(deem-flush)` orders the goals by the critical
+ * path of TARGET, and `.deem-ljf` is returned instead, see
+ * @ref ljf_check(). See @ref deem_ljf_mode.
+ */
+static char *
+ljf_goal (useless char const  *f,
+          useless unsigned int c,
+          char               **v)
+{
+	size_t n, n_tgt;
+	char const **const name = split_words(v[0], &n);
+	char const **const tgt = split_words(v[1], &n_tgt);
+	char *ret = nullptr;
+
+	if (!deem_ljf_mode) {
+		size_t const size = n ? strlen(name[0]) + 1U : 0U;
+		ret = size ? gmk_alloc(size) : nullptr;
+		if (ret)
+			__builtin_memcpy(ret, name[0], size);
+	} else if (n && n_tgt) {
+		ret = gmk_alloc(sizeof ".deem-ljf");
+		if (ret)
+			__builtin_memcpy(ret, ".deem-ljf", sizeof ".deem-ljf");
+		(void)ljf_hold(&deem_ljf, name[0], tgt[0]);
+	}
+
+	free(tgt);
+	free(name);
+	return ret;
+}
+
+/**
+ * @brief Recursive wildcard: `$(rwildcard ROOTS,PATTERNS,EXCLUDES)`
+ *
+ * Returns the files under each of ROOTS which match any of PATTERNS,
+ * or all files if there are no PATTERNS. Files and directories which
+ * match any of EXCLUDES are skipped. The results of each root are
+ * sorted. See @ref walk().
+ */
+static char *
+rwildcard (useless char const  *f,
+           unsigned int         c,
+           char               **v)
+{
+	size_t n_root, n_pat, n_excl;
+	char const **root = split_words(v[0], &n_root);
+	char const **pat = split_words(c > 1U ? v[1] : nullptr, &n_pat);
+	char const **excl = split_words(c > 2U ? v[2] : nullptr, &n_excl);
+
+	struct buf out = buf_arena(&deem_arena);
+	for (size_t i = 0; i < n_root; ++i) {
+		struct walk_out res;
+		bool ok = walk(&(struct walk_spec){
+			.root   = root[i],
+			.pat    = pat,
+			.n_pat  = n_pat,
+			.excl   = excl,
+			.n_excl = n_excl
+		}, &res);
+
+		if (ok && res.n && buf_reserve(&out, res.bytes + res.n + 1U)) {
+			for (size_t k = 0; k < res.n; ++k) {
+				if (out.str.len.n_bytes)
+					buf_append_literal(&out, " ");
+				buf_append_(&out, res.path[k],
+				            &(struct len){strlen(res.path[k]), 0U});
+			}
+		}
+		walk_out_fini(&res);
+	}
+
+	free(excl);
+	free(pat);
+	free(root);
+
+	char *r = gmk_alloc(out.str.len.n_bytes + 1U);
+	if (r) {
+		if (out.str.len.n_bytes)
+			__builtin_memcpy(r, out.str.imm, out.str.len.n_bytes);
+		r[out.str.len.n_bytes] = '\0';
+	}
+	return r;
+}
+
+/** @brief Dependency log mode, enabled by setting `DEEM_DEPS_DB=1`
+ *         before loading deem.so
+ *
+ * Compilers write their dependency files to the `$O.deem-deps.d/`
+ * spool directory, see `$(deps-flags)`. The first `$(load-deps)`
+ * folds them into the `$O.deem-deps` log and deletes them, and
+ * dependencies are then loaded from the log.
+ */
+static bool deem_deps_mode;
+
+/** @brief The dependency log
+ */
+static struct depsdb deem_deps_db = {.fd = -1};
+
+/** @brief Path of the spool directory, with a trailing slash
+ */
+static char *deem_deps_spool;
+
+static char const *
+deem_deps_spool_dir (void)
+{
+	if (!deem_deps_spool) {
+		char *dir = deem_expand("$O.deem-deps.d/");
+		if (!dir)
+			return nullptr;
+		deem_deps_spool = strdup(dir);
+		gmk_free(dir);
+		if (deem_deps_spool && mkdir(deem_deps_spool, 0755) &&
+		    errno != EEXIST)
+			perror(deem_deps_spool);
+	}
+
+	return deem_deps_spool;
+}
+
+/** @brief Fold the spooled dependency files into the log.
+ *
+ * The files are only removed once their records are in the log.
+ */
+static void
+deem_deps_fold (char const *const dir)
+{
+	DIR *d = opendir(dir);
+	if (!d)
+		return;
+
+	size_t const n = strlen(dir);
+	struct buf path = buf_arena(&deem_arena);
+	struct buf done = buf_arena(&deem_arena);
+	for (struct dirent *e; (e = readdir(d));) {
+		size_t const len = strlen(e->d_name);
+		if (len < 3U || strcmp(&e->d_name[len - 2U], ".d"))
+			continue;
+
+		path.str.len = (struct len){0U, 0U};
+		if (!buf_reserve(&path, n + len + 1U))
+			break;
+		buf_append_(&path, dir, &(struct len){n, 0U});
+		buf_append_(&path, e->d_name, &(struct len){len, 0U});
+		buf_terminate(&path);
+
+		enum deps_res r = deps_parse_file(path.str.imm, depsdb_rule,
+		                                  &deem_deps_db);
+		if (r == deps_done) {
+			// Null-separated list of files to remove
+			if (!buf_reserve(&done, path.str.len.n_bytes + 1U))
+				break;
+			buf_append_(&done, path.str.imm,
+			            &(struct len){path.str.len.n_bytes + 1U, 0U});
+		} else if (r == deps_foreign) {
+			(void)fprintf(stderr, "%s: not a plain dependency file, "
+			              "left in place\n", path.str.imm);
+		} else if (r == deps_failed) {
+			break;
+		}
+	}
+
+	(void)closedir(d);
+	if (!depsdb_sync(&deem_deps_db))
+		return;
+
+	for (size_t off = 0; off < done.str.len.n_bytes;) {
+		char const *const f = &done.str.imm[off];
+		(void)unlink(f);
+		off += strlen(f) + 1U;
+	}
+}
+
+/** @brief Open the dependency log and fold the spool into it once.
+ */
+static bool
+deem_deps_open (void)
+{
+	static bool tried = false;
+	if (!tried) {
+		tried = true;
+		char const *dir = deem_deps_spool_dir();
+		char *path = deem_expand("$O.deem-deps");
+		if (dir && path && depsdb_open(&deem_deps_db, path))
+			deem_deps_fold(dir);
+		if (path)
+			gmk_free(path);
+	}
+
+	return deem_deps_db.fd >= 0;
+}
+
+/**
+ * @brief Compiler flags for the dependency file of a target:
+ *        `$(deps-flags TARGET)`
+ *
+ * Expands to nothing unless the dependency log is enabled, in which
+ * case it names a file in the spool directory with `-MF`.
+ */
+static char *
+deps_flags (useless char const  *f,
+            useless unsigned int c,
+            char               **v)
+{
+	char const *dir = deem_deps_mode ? deem_deps_spool_dir() : nullptr;
+	if (!dir)
+		return nullptr;
+
+	size_t const n = strlen(dir);
+	size_t const len = strlen(v[0]);
+	char *r = gmk_alloc(sizeof "-MF " + n + len + sizeof ".d");
+	if (r) {
+		char *p = r;
+		__builtin_memcpy(p, "-MF ", sizeof "-MF " - 1U);
+		p += sizeof "-MF " - 1U;
+		__builtin_memcpy(p, dir, n);
+		p += n;
+		for (char const *s = v[0]; *s; ++s)
+			*p++ = *s == '/' ? '%' : *s;
+		__builtin_memcpy(p, ".d", sizeof ".d");
+	}
+	return r;
+}
+
+/** @brief Content digest mode, enabled by setting `DEEM_DIGEST=1`
+ *         before loading deem.so
+ *
+ * A target which is older than its prerequisites, but whose
+ * prerequisite contents and command are the same as when it was last
+ * seen up to date, has its timestamp refreshed so that make doesn't
+ * rebuild it. Digests are kept in `$O.deem-digest`.
+ */
+static bool deem_digest_mode;
+
+/** @brief Target digests
+ */
+static struct kvdb deem_digest_db = {.fd = -1};
+
+/** @brief Content digest statistics for `DEBUG_MK`
+ */
+static struct {
+	size_t checked; //< Targets checked
+	size_t hashed;  //< Files hashed
+	size_t saved;   //< Rebuilds avoided
+	size_t forced;  //< Rebuilds forced
+} deem_digest_stats;
+
+/** @brief Stored digest of a target
+ */
+struct digest_rec {
+	uint64_t sig;   //< Command, and paths and stat data of prerequisites
+	uint64_t sum;   //< Command and prerequisite contents
+	uint64_t mtime; //< Modification time of the target in nanoseconds
+};
+
+/** @brief Target whose prerequisites need to be hashed
+ */
+struct digest_check {
+	char const       *target; //< Target path
+	char const       *cmd;    //< Expanded command
+	size_t           *file;   //< Prerequisites by index in the batch
+	size_t            n_file;
+	struct digest_rec rec;    //< New record, `sum` still to be done
+	struct digest_rec old;    //< Stored record
+	bool              have;   //< Whether `old` is valid
+	bool              stale;  //< A prerequisite is newer than the target
+};
+
+/** @brief Up-to-date checks whose files are hashed together
+ */
+struct digest_batch {
+	struct digest_check *chk;
+	size_t               n_chk;
+	size_t               cap_chk;
+	struct digest_file  *file;
+	size_t               n_file;
+	size_t               cap_file;
+	struct memo          seen; //< File path to index in `file`
+	struct arena         mem;
+	char const          *cmd;  //< Command with `%` for the target name
+};
+
+/** @brief Copy a word from a makefile, without make's escapes.
+ */
+static char *
+digest_path (struct arena *const     mem,
+             struct ref const *const word)
+{
+	char *const ret = arena_alloc(mem, word->len.n_bytes + 1U);
+	if (!ret)
+		return nullptr;
+
+	char *q = ret;
+	for (size_t i = 0; i < word->len.n_bytes; ++i) {
+		char c = word->imm[i];
+		if (i + 1U < word->len.n_bytes) {
+			char const d = word->imm[i + 1U];
+			if ((c == '\\' && (d == ' ' || d == '#' || d == ':')) ||
+			    (c == '$' && d == '$'))
+				c = word->imm[++i];
+		}
+		*q++ = c;
+	}
+
+	*q = '\0';
+	return ret;
+}
+
+/** @brief Expand the command of a batch for a target.
+ */
+static char const *
+digest_cmd (struct digest_batch *const b,
+            char const *const          target)
+{
+	char const *name = strrchr(target, '/');
+	name = name ? name + 1 : target;
+
+	struct buf cmd = buf_arena(&deem_arena);
+	for (char const *p = b->cmd; *p; ++p) {
+		struct len const l = {*p == '%' ? strlen(name) : 1U, 0U};
+		if (!buf_reserve(&cmd, l.n_bytes + 1U))
+			return nullptr;
+		buf_append_(&cmd, *p == '%' ? name : p, &l);
+	}
+	if (!buf_reserve(&cmd, 1U))
+		return nullptr;
+	buf_terminate(&cmd);
+
+	char *exp = deem_expand(cmd.str.imm);
+	if (!exp)
+		return nullptr;
+
+	size_t const n = strlen(exp);
+	char *const ret = arena_alloc(&b->mem, n + 1U);
+	if (ret)
+		__builtin_memcpy(ret, exp, n + 1U);
+	gmk_free(exp);
+	return ret;
+}
+
+/** @brief Index of a file in a batch, adding it if necessary.
+ */
+static bool
+digest_file_idx (struct digest_batch *const b,
+                 char const *const          path,
+                 size_t *const              idx)
+{
+	size_t const n = strlen(path);
+	uint64_t const hash = memo_hash(path, n);
+	struct memo_ent const *const e = memo_find(&b->seen, path, n, hash);
+	if (e) {
+		__builtin_memcpy(idx, e->val, sizeof *idx);
+		return true;
+	}
+
+	if (b->n_file == b->cap_file) {
+		size_t cap = b->cap_file ? b->cap_file * 2U : 256U;
+		struct digest_file *f = realloc(b->file, cap * sizeof *f);
+		if (!f) {
+			perror("realloc");
+			return false;
+		}
+		b->file = f;
+		b->cap_file = cap;
+	}
+
+	*idx = b->n_file;
+	char const *const key = memo_key(&b->seen, path, n);
+	if (!key || !memo_insert(&b->seen, key, n, hash,
+	                         (char const *)idx, sizeof *idx))
+		return false;
+
+	b->file[b->n_file++] = (struct digest_file){.path = key};
+	return true;
+}
+
+static force_inline uint64_t
+digest_ns (struct timespec const t)
+{
+	return (uint64_t)t.tv_sec * 1000000000U + (uint64_t)t.tv_nsec;
+}
+
+static force_inline bool
+digest_newer (struct timespec const a,
+              struct timespec const b)
+{
+	return a.tv_sec > b.tv_sec ||
+	       (a.tv_sec == b.tv_sec && a.tv_nsec > b.tv_nsec);
+}
+
+/**
+ * @brief Queue an up-to-date check of a target.
+ *
+ * Nothing is queued if the target doesn't exist, a prerequisite is
+ * missing, or the prerequisites haven't changed on disk since the
+ * target's digest was recorded.
+ */
+static bool
+digest_add (struct digest_batch *const b,
+            struct ref const *const    target,
+            struct ref const *const    prereq,
+            size_t const               n)
+{
+	struct digest_check chk = {0};
+	struct stat st;
+
+	chk.target = digest_path(&b->mem, target);
+	if (!chk.target)
+		return false;
+	if (stat(chk.target, &st))
+		return true;
+
+	struct timespec const mtime = st.st_mtim;
+	char const **path = arena_alloc(&b->mem, (n ? n : 1U) * sizeof *path);
+	chk.cmd = digest_cmd(b, chk.target);
+	if (!path || !chk.cmd)
+		return false;
+
+	chk.rec.mtime = digest_ns(mtime);
+	chk.rec.sig = digest(chk.cmd, strlen(chk.cmd), 0U);
+	for (size_t i = 0; i < n; ++i) {
+		path[i] = digest_path(&b->mem, &prereq[i]);
+		if (!path[i])
+			return false;
+		if (stat(path[i], &st))
+			return true;
+
+		uint64_t const id[] = {
+			(uint64_t)st.st_dev, (uint64_t)st.st_ino,
+			(uint64_t)st.st_size, (uint64_t)st.st_mtim.tv_sec,
+			(uint64_t)st.st_mtim.tv_nsec
+		};
+		chk.rec.sig = digest(path[i], strlen(path[i]), chk.rec.sig);
+		chk.rec.sig = digest(id, sizeof id, chk.rec.sig);
+		chk.stale = chk.stale || digest_newer(st.st_mtim, mtime);
+	}
+
+	char const *val;
+	size_t vn;
+	if (kvdb_get(&deem_digest_db, chk.target, strlen(chk.target),
+	             &val, &vn) && vn == sizeof chk.old) {
+		__builtin_memcpy(&chk.old, val, sizeof chk.old);
+		if (chk.old.sig == chk.rec.sig && chk.old.mtime == chk.rec.mtime)
+			return true;
+		// An all-zero record means a rebuild was forced, and a record
+		// older than the target is from before it was last rebuilt
+		chk.have = (chk.old.sig || chk.old.sum)
+		        && chk.old.mtime == chk.rec.mtime;
+	}
+
+	chk.file = arena_alloc(&b->mem, (n ? n : 1U) * sizeof *chk.file);
+	if (!chk.file)
+		return false;
+
+	for (size_t i = 0; i < n; ++i)
+		if (!digest_file_idx(b, path[i], &chk.file[i]))
+			return false;
+	chk.n_file = n;
+
+	if (b->n_chk == b->cap_chk) {
+		size_t cap = b->cap_chk ? b->cap_chk * 2U : 64U;
+		struct digest_check *c = realloc(b->chk, cap * sizeof *c);
+		if (!c) {
+			perror("realloc");
+			return false;
+		}
+		b->chk = c;
+		b->cap_chk = cap;
+	}
+
+	b->chk[b->n_chk++] = chk;
+	return true;
+}
+
+/** @brief Queue checks for the rules of a dependency file.
+ */
+static bool
+digest_rule (void *const             ctx,
+             struct ref const *const word,
+             size_t const            n_targ,
+             size_t const            n)
+{
+	for (size_t i = 0; i < n_targ; ++i)
+		if (!digest_add(ctx, &word[i], &word[n_targ], n - n_targ))
+			return false;
+	return true;
+}
+
+/**
+ * @brief Hash the files of a batch and finish its checks.
+ *
+ * A target that is out of date, but whose digest is unchanged, is
+ * touched. A target that is up to date by timestamp, but whose digest
+ * has changed, is backdated so that make rebuilds it. The digest of
+ * a target that is rebuilt either way is cleared, because the
+ * prerequisites may be rebuilt too, and the next run records it
+ * afresh. The digest of an up-to-date target is recorded.
+ */
+static void
+digest_run (struct digest_batch *const b)
+{
+	digest_files(b->file, b->n_file);
+	deem_digest_stats.hashed += b->n_file;
+	deem_digest_stats.checked += b->n_chk;
+
+	for (size_t i = 0; i < b->n_chk; ++i) {
+		struct digest_check *const chk = &b->chk[i];
+		uint64_t sum = digest(chk->cmd, strlen(chk->cmd), 0U);
+		size_t k = 0U;
+		for (; k < chk->n_file; ++k) {
+			struct digest_file const *const f = &b->file[chk->file[k]];
+			if (!f->ok)
+				break;
+			sum = digest(&f->sum, sizeof f->sum, sum);
+		}
+		if (k < chk->n_file)
+			continue;
+
+		chk->rec.sum = sum;
+		if (chk->stale && (!chk->have || chk->old.sum != sum)) {
+			// Make rebuilds it; the next run records the new digest
+			if (!chk->have)
+				continue;
+			chk->rec = (struct digest_rec){0U, 0U, 0U};
+		} else if (chk->stale) {
+			struct stat st;
+			if (utimensat(AT_FDCWD, chk->target, nullptr, 0) ||
+			    stat(chk->target, &st)) {
+				perror(chk->target);
+				continue;
+			}
+			chk->rec.mtime = digest_ns(st.st_mtim);
+			++deem_digest_stats.saved;
+		} else if (chk->have && chk->old.sum != sum) {
+			static struct timespec const epoch[2] = {{0, 0}, {0, 0}};
+			if (utimensat(AT_FDCWD, chk->target, epoch, 0)) {
+				perror(chk->target);
+				continue;
+			}
+			++deem_digest_stats.forced;
+			chk->rec = (struct digest_rec){0U, 0U, 0U};
+		}
+
+		(void)kvdb_put(&deem_digest_db, chk->target, strlen(chk->target),
+		               &chk->rec, sizeof chk->rec);
+	}
+}
+
+static bool
+digest_init (struct digest_batch *const b,
+             char const *const          cmd)
+{
+	static bool tried = false;
+	if (!tried) {
+		tried = true;
+		char *path = deem_expand("$O.deem-digest");
+		if (path) {
+			(void)kvdb_open(&deem_digest_db, path);
+			gmk_free(path);
+		}
+	}
+
+	*b = (struct digest_batch){.cmd = cmd};
+	return deem_digest_db.fd >= 0;
+}
+
+static void
+digest_fini (struct digest_batch *const b)
+{
+	free(b->seen.tab);
+	arena_fini(&b->seen.mem);
+	arena_fini(&b->mem);
+	free(b->file);
+	free(b->chk);
+}
+
+/**
+ * @brief Content digest check: `$(digest-check TARGETS,PREREQS,COMMAND)`
+ *
+ * Does nothing unless content digest mode is enabled. Otherwise, each
+ * of TARGETS which is out of date only by timestamp is touched, and
+ * each whose inputs changed without its timestamp showing it is
+ * rebuilt, see @ref digest_run(). `%` in
+ * COMMAND is replaced by the file name of the target, and the result
+ * is expanded; it should be the part of the recipe which affects the
+ * output, so a change to it means a rebuild.
+ */
+static char *
+digest_check (useless char const  *f,
+              unsigned int         c,
+              char               **v)
+{
+	struct digest_batch b;
+	if (!deem_digest_mode || !digest_init(&b, c > 2U ? v[2] : ""))
+		return nullptr;
+
+	size_t n_targ, n_pre;
+	char const **targ = split_words(v[0], &n_targ);
+	char const **pre = split_words(c > 1U ? v[1] : nullptr, &n_pre);
+	struct ref *word = malloc((n_pre ? n_pre : 1U) * sizeof *word);
+
+	bool ok = word;
+	for (size_t i = 0; ok && i < n_pre; ++i)
+		word[i] = (struct ref){.imm = pre[i], .len = {strlen(pre[i]), 0U}};
+	for (size_t i = 0; ok && i < n_targ; ++i) {
+		struct ref const t = {
+			.imm = targ[i],
+			.len = {strlen(targ[i]), 0U}
+		};
+		ok = digest_add(&b, &t, word, n_pre);
+	}
+
+	if (ok)
+		digest_run(&b);
+
+	free(word);
+	free(pre);
+	free(targ);
+	digest_fini(&b);
+	return nullptr;
+}
+
+/** @brief Print content digest statistics for `DEBUG_MK`.
+ */
+static void
+digest_stats (void)
+{
+	(void)fprintf(stderr, "digest: %zu targets checked, %zu files hashed, "
+	              "%zu rebuilds avoided, %zu forced\n",
+	              deem_digest_stats.checked, deem_digest_stats.hashed,
+	              deem_digest_stats.saved, deem_digest_stats.forced);
+}
+
+/** @brief Compile cache mode, enabled by setting `DEEM_CACHE=1`
+ *         before loading deem.so
+ *
+ * `$(library)` object rules run their compiles through `deem-cc`,
+ * which is installed next to deem.so. The command prefix is kept in
+ * `DEEM_CC`. Objects are cached in `DEEM_CACHE_DIR`, by default
+ * `~/.cache/deem`, which is limited to `DEEM_CACHE_SIZE` MiB. Entries
+ * are compressed with the `DEEM_CACHE_COMPRESS` program if it is set,
+ * e.g. `zstd`, and hits are restored by hardlink if `DEEM_CACHE_LINK`
+ * is 1.
+ */
+static bool deem_cache_mode;
+
+/** @brief Path of the file which `deem-cc` appends hits and misses to
+ */
+static char *deem_cache_stats;
+
+/**
+ * @brief Print compile cache statistics at the end of the build.
+ *
+ * Each cached compile leaves a line in @ref deem_cache_stats: `m` for
+ * a miss, and `h` and the object size for a hit. Nothing is printed if
+ * there were no compiles.
+ */
+static void
+cache_stats (void)
+{
+	FILE *f = fopen(deem_cache_stats, "r");
+	if (!f)
+		return;
+
+	size_t hits = 0U, misses = 0U;
+	unsigned long long bytes = 0U, n;
+	char line[64];
+	while (fgets(line, sizeof line, f)) {
+		if (line[0] == 'h') {
+			++hits;
+			if (sscanf(&line[1], "%llu", &n) == 1)
+				bytes += n;
+		} else if (line[0] == 'm') {
+			++misses;
+		}
+	}
+
+	(void)fclose(f);
+	(void)unlink(deem_cache_stats);
+	if (hits || misses)
+		(void)fprintf(stderr, "cache: %zu hits, %zu misses, "
+		              "%llu bytes restored\n", hits, misses, bytes);
+}
+
+/** @brief Trace mode, enabled by setting `DEEM_TRACE=1` before loading
+ *         deem.so
+ *
+ * The compile and link commands of `$(library)` run through `deem-cc`,
+ * which appends the start time and duration of each one to
+ * `$O.deem-trace.log`. When the top-level make exits the log becomes
+ * the Chrome trace `$O.deem-trace.json`, which can be opened in
+ * Perfetto or `chrome://tracing`. The link command prefix is kept in
+ * `DEEM_LD`.
+ */
+static bool deem_trace_mode;
+
+/** @brief Path of the trace log
+ */
+static char *deem_trace_log;
+
+/** @brief Print the estimated critical path of each link target.
+ */
+static void
+ljf_print (void)
+{
+	ljf_report(&deem_ljf, stderr);
+}
+
+/**
+ * @brief Turn the trace log into a Chrome trace.
+ *
+ * In longest-job-first mode the durations are recorded, and the trace
+ * is only written if trace mode is also on. See @ref trace_read().
+ */
+static void
+trace_merge (void)
+{
+	struct trace t;
+	if (!trace_read(&t, deem_trace_log))
+		return;
+	(void)unlink(deem_trace_log);
+
+	for (size_t i = 0; deem_ljf_mode && i < t.n; ++i)
+		ljf_record(&deem_ljf, t.ev[i].name, t.ev[i].dur);
+
+	char *const path = deem_trace_mode && t.n
+	                 ? deem_expand("$O.deem-trace.json") : nullptr;
+	if (path && trace_write(&t, path))
+		(void)fprintf(stderr, "trace: %zu commands on %u slots in %s\n",
+		              t.n, t.n_slot, path);
+	else if (path)
+		perror(path);
+
+	if (path)
+		gmk_free(path);
+	trace_fini(&t);
+}
+
+/**
+ * @brief Expand a variable reference into a copy owned by deem.
+ * @return The copy, or `nullptr` on failure. Release with `free()`.
+ */
+static char *
+deem_expand_dup (char const *const ref)
+{
+	char *const str = deem_expand(ref);
+	if (!str)
+		return nullptr;
+
+	char *const ret = strdup(str);
+	gmk_free(str);
+	if (!ret)
+		perror("strdup");
+	return ret;
+}
+
+/**
+ * @brief Find `deem-cc`, which is installed next to deem.so.
+ * @return The path, or `nullptr` if the program can't be found.
+ *         Release with `free()`.
+ */
+static char *
+helper_path (void)
+{
+	Dl_info info;
+	if (!dladdr((void *)helper_path, &info) || !info.dli_fname)
+		return nullptr;
+
+	char const *const slash = strrchr(info.dli_fname, '/');
+	int const dir = slash ? (int)(slash + 1 - info.dli_fname) : 0;
+	size_t const size = (size_t)dir + sizeof "deem-cc";
+	char *const path = malloc(size);
+	if (!path) {
+		perror("malloc");
+		return nullptr;
+	}
+
+	(void)snprintf(path, size, "%.*sdeem-cc", dir, info.dli_fname);
+	if (access(path, X_OK)) {
+		(void)fprintf(stderr, "%s: %s, running commands "
+		              "without it\n", path, strerror(errno));
+		free(path);
+		return nullptr;
+	}
+
+	return path;
+}
+
+/**
+ * @brief Set up `deem-cc` for the compile cache, trace,
+ *        longest-job-first and output buffering modes.
+ *
+ * Defines `DEEM_CC` as the command prefix of compiles, and in the
+ * other modes `DEEM_LD` as that of links. Both are left undefined if the
+ * program can't be found. Statistics and the trace are reset and
+ * reported by the top-level make only, so that sub-makes add to them.
+ */
+static void
+helper_init (void)
+{
+	static char const cache_fmt[] =
+		" -d $(or $(DEEM_CACHE_DIR),$(HOME)/.cache/deem) -s %s"
+		"$(DEEM_CACHE_SIZE:%%= -m %%)$(DEEM_CACHE_COMPRESS:%%= -z %%)"
+		"$(if $(filter 1,$(strip $(DEEM_CACHE_LINK))), -l)";
+	static char const trace_fmt[] = " -t %s -n $@ -c %s";
+	static char const buffer_fmt[] = " -b $(msg-banner %s,$(@F))";
+
+	char *const exe = helper_path();
+	if (!exe)
+		return;
+
+	if (deem_cache_mode)
+		deem_cache_stats = deem_expand_dup("$O.deem-cache-stats");
+	if (deem_trace_mode || deem_ljf_mode)
+		deem_trace_log = deem_expand_dup("$O.deem-trace.log");
+
+	char const *const stats = deem_cache_stats ? deem_cache_stats : "";
+	char const *const log = deem_trace_log ? deem_trace_log : "";
+	size_t const size = 2U * strlen(exe) + sizeof cache_fmt + strlen(stats)
+	                  + 2U * (sizeof trace_fmt + strlen(log))
+	                  + 2U * sizeof buffer_fmt
+	                  + sizeof "override DEEM_CC=-- CC\n"
+	                  + sizeof "override DEEM_LD=-- LINK";
+	char *const def = malloc(size);
+	if (!def) {
+		perror("malloc");
+		free(exe);
+		return;
+	}
+
+	int n = snprintf(def, size, "override DEEM_CC=%s", exe);
+	if (deem_cache_stats)
+		n += snprintf(&def[n], size - (size_t)n, cache_fmt, stats);
+	if (deem_trace_log)
+		n += snprintf(&def[n], size - (size_t)n, trace_fmt, log, "CC");
+	if (deem_buffer_mode)
+		n += snprintf(&def[n], size - (size_t)n, buffer_fmt, "CC");
+	n += snprintf(&def[n], size - (size_t)n, " --");
+	if (deem_trace_log || deem_buffer_mode) {
+		n += snprintf(&def[n], size - (size_t)n, "\noverride DEEM_LD=%s", exe);
+		if (deem_trace_log)
+			n += snprintf(&def[n], size - (size_t)n, trace_fmt, log, "LINK");
+		if (deem_buffer_mode)
+			n += snprintf(&def[n], size - (size_t)n, buffer_fmt, "LINK");
+		(void)snprintf(&def[n], size - (size_t)n, " --");
+	}
+
+	deem_eval(def);
+	deem_buffer_on = deem_buffer_mode;
+	free(def);
+	free(exe);
+
+	char *const level = deem_expand("$(MAKELEVEL)");
+	bool const top = !level || !level[0] || !strcmp(level, "0");
+	if (level)
+		gmk_free(level);
+	if (!top)
+		return;
+
+	if (deem_cache_stats) {
+		(void)unlink(deem_cache_stats);
+		(void)atexit(cache_stats);
+	}
+	// The report comes after the durations of this build are recorded
+	if (deem_ljf_report)
+		(void)atexit(ljf_print);
+	if (deem_trace_log) {
+		(void)unlink(deem_trace_log);
+		(void)atexit(trace_merge);
+	}
+}
+
+/**
+ * @brief Load dependency files:
+ *        `$(load-deps FILES[,TARGETS[,COMMAND]])`
+ *
+ * A replacement for `-include FILES` when the files are `-MMD` output.
+ * The rules of all files are collected with a dedicated scanner and
+ * evaluated at once, see @ref deps_load(). If the dependency log is
+ * enabled the dependencies of TARGETS are loaded from it instead. In
+ * content digest mode the targets of the rules are checked as with
+ * `$(digest-check)`, using COMMAND.
+ */
+static char *
+load_deps (useless char const  *f,
+           unsigned int         c,
+           char               **v)
+{
+	bool const db = c > 1U && deem_deps_mode && deem_deps_open();
+	size_t n;
+	char const **word = split_words(db ? v[1] : v[0], &n);
+
+	struct deps d;
+	deps_init(&d);
+
+	struct digest_batch b;
+	bool const dg = deem_digest_mode && digest_init(&b, c > 2U ? v[2] : "");
+	if (dg) {
+		d.hook = digest_rule;
+		d.hook_ctx = &b;
+	}
+
+	bool ok = true;
+	for (size_t i = 0; ok && i < n; ++i) {
+		if (db) {
+			struct ref const t = {
+				.imm = word[i],
+				.len = {strlen(word[i]), 0U}
+			};
+			ok = depsdb_load(&deem_deps_db, &d, &t);
+		} else {
+			ok = deps_load(&d, word[i]);
+		}
+	}
+
+	if (dg) {
+		if (ok)
+			digest_run(&b);
+		digest_fini(&b);
+	}
+
+	char const *text = ok ? deps_text(&d) : nullptr;
+	if (text) {
+		if (*text)
+			deem_eval(text);
+		if (deem_debug())
+			(void)fprintf(stderr, "load-deps: %zu files, %zu rules, "
+			              "%zu left to make\n",
+			              d.n_file, d.n_rule, d.n_foreign);
+	} else {
+		(void)fputs("load-deps: out of memory\n", stderr);
+	}
+
+	deps_fini(&d);
+	free(word);
+	return nullptr;
+}
+
+/** @brief Upper limit of registered functions
+ */
+#define DEEM_FN_MAX 64U
+
+/** @brief Registered function and its profile
+ */
+struct deem_fn {
+	struct prof_site site;
+	char const      *key;  //< Name pointer make passes, once seen
+	gmk_func_ptr     func;
+};
+
+/** @brief Registered functions
+ */
+static struct {
+	struct deem_fn fn[DEEM_FN_MAX];
+	unsigned       n;
+	bool           json; //< Whether the report is JSON
+} deem_prof;
+
+/**
+ * @brief Call a registered function, and record its profile if
+ *        `DEEM_PROFILE` is set.
+ *
+ * Registered in place of each function. The function is found by the
+ * name make passes in. @ref deem_arena is reset when the outermost
+ * call returns, so that memory a function keeps in the arena while
+ * it expands its arguments isn't released by a nested call.
+ */
+static char *
+deem_call (char const  *f,
+           unsigned int c,
+           char       **v)
+{
+	struct deem_fn *fn = nullptr;
+	for (unsigned i = 0; i < deem_prof.n && !fn; ++i)
+		if (deem_prof.fn[i].key == f)
+			fn = &deem_prof.fn[i];
+
+	for (unsigned i = 0; i < deem_prof.n && !fn; ++i) {
+		if (!strcmp(deem_prof.fn[i].site.name, f)) {
+			fn = &deem_prof.fn[i];
+			fn->key = f;
+		}
+	}
+
+	if (!fn)
+		return nullptr;
+
+	++deem_depth;
+	char *ret;
+	if (prof_on) {
+		size_t in = 0U;
+		for (unsigned i = 0; i < c; ++i)
+			in += strlen(v[i]);
+
+		uint64_t const t0 = prof_now();
+		ret = fn->func(f, c, v);
+		prof_add(&fn->site, t0, in, ret ? strlen(ret) : 0U);
+	} else {
+		ret = fn->func(f, c, v);
+	}
+
+	if (!--deem_depth)
+		arena_reset(&deem_arena);
+	return ret;
+}
+
+/**
+ * @brief Register a make function through @ref deem_call().
+ */
+static void
+deem_add_function (char const *const  name,
+                   gmk_func_ptr const func,
+                   unsigned const     min,
+                   unsigned const     max,
+                   unsigned const     flags)
+{
+	if (deem_prof.n < DEEM_FN_MAX) {
+		deem_prof.fn[deem_prof.n++] = (struct deem_fn){
+			.site = {.name = name},
+			.key  = nullptr,
+			.func = func
+		};
+		gmk_add_function(name, deem_call, min, max, flags);
+	} else {
+		(void)fprintf(stderr, "deem: %s: too many functions\n", name);
+	}
+}
+
+/** @brief Print the `DEEM_PROFILE` report.
+ */
+static void
+deem_prof_report (void)
+{
+	struct prof_site const *site[DEEM_FN_MAX + 2U];
+	size_t n = 0U;
+	for (unsigned i = 0; i < deem_prof.n; ++i)
+		site[n++] = &deem_prof.fn[i].site;
+	site[n++] = &deem_prof_expand;
+	site[n++] = &deem_prof_eval;
+
+	prof_report(stderr, site, n, deem_prof.json);
+}
+
+/**
+ * @brief Enable profiling if `DEEM_PROFILE` is set.
+ *
+ * `DEEM_PROFILE=1` prints a text report when make exits, and
+ * `DEEM_PROFILE=json` prints it as JSON. Function times include the
+ * time spent in nested calls.
+ */
+static void
+deem_prof_init (void)
+{
+	char *const mode = deem_expand("$(strip $(DEEM_PROFILE))");
+	if (!mode)
+		return;
+
+	if (!strcmp(mode, "1") || !strcmp(mode, "json")) {
+		prof_on = true;
+		deem_prof.json = mode[0] == 'j';
+		(void)atexit(deem_prof_report);
+	}
+
+	gmk_free(mode);
+}
+
+/** @brief Read `DEEM_LJF`, see @ref deem_ljf_mode.
+ */
+static void
+ljf_init (void)
+{
+	char *const mode = deem_expand("$(strip $(DEEM_LJF))");
+	if (!mode)
+		return;
+
+	if (!strcmp(mode, "1") || !strcmp(mode, "report")) {
+		deem_ljf_mode = true;
+		deem_ljf_report = mode[0] == 'r';
+		deem_eval(".PHONY: .deem-ljf\n"
+		          ".deem-ljf:;$(ljf-check )");
+
+		char *const path = deem_expand("$O.deem-times");
+		if (path) {
+			(void)kvdb_open(&deem_ljf.db, path);
+			gmk_free(path);
+		}
+	}
+
+	gmk_free(mode);
+}
+
+/** @brief Print memoization statistics for `DEBUG_MK`.
+ */
+static void
+memo_stats (void)
+{
+	(void)fprintf(stderr, "memo: %zu hits, %zu misses, %zu entries\n",
+	              deem_memo.hits, deem_memo.misses, deem_memo.cnt);
+}
+
+int
+deem_gmk_setup (useless gmk_floc const *floc)
+{
+	if (deem_debug()) {
+		puts("\e[0;36m┌───────╮\e[m\n"
+		     "\e[0;36m│"
+		     "\e[1;34md\e[m "
 		     "\e[1;36me\e[m "
 		     "\e[1;32me\e[m "
 		     "\e[1;33mm"
@@ -624,24 +3164,55 @@ deem_gmk_setup (useless gmk_floc const *floc)
 		     "\e[0;36m╰───────┘\e[m");
 	}
 
-	struct buf256 loc = buf256(&loc);
-	lazy_(&loc.b, "THIS_DIR",
+	deem_prof_init();
+
+	struct buf loc = buf_arena(&deem_arena);
+	lazy_(&loc, "THIS_DIR",
 	      "$(dir $(realpath $(lastword $(MAKEFILE_LIST))))");
 	deem_eval("override O=$(eval override O:=$(THIS_DIR))$(O)");
-	buf256_fini(&loc);
 
 	deem_eval(".PHONY: all clean install\n"
 	          "all:; @:\n"
 	          "clean:; @:\n"
 	          "install:; @:\n");
 
-	gmk_add_function("library", library, 2, 0, GMK_FUNC_NOEXPAND);
-	gmk_add_function("lazy", lazy, 2, 2, GMK_FUNC_NOEXPAND);
-	gmk_add_function("SGR", sgr, 2, 2, GMK_FUNC_NOEXPAND);
-	gmk_add_function("msg", msg, 2, 2, GMK_FUNC_DEFAULT);
-	gmk_add_function("register-msg", register_msg, 2, 2, GMK_FUNC_DEFAULT);
-	gmk_add_function("pfx-if", pfx_if, 2, 2, GMK_FUNC_NOEXPAND);
-	gmk_add_function("sfx-if", sfx_if, 2, 2, GMK_FUNC_NOEXPAND);
+	(void)tmpl_define(&library_name, library_tmpl);
+
+	deem_add_function("library", library, 2, 0, GMK_FUNC_NOEXPAND);
+	deem_add_function("define-template", define_template, 1, 2, GMK_FUNC_NOEXPAND);
+	deem_add_function("render", render, 1, 0, GMK_FUNC_NOEXPAND);
+	deem_add_function("lazy", lazy, 2, 2, GMK_FUNC_NOEXPAND);
+	deem_add_function("SGR", sgr, 2, 2, GMK_FUNC_NOEXPAND);
+	deem_add_function("msg", msg, 2, 2, GMK_FUNC_DEFAULT);
+	deem_add_function("register-msg", register_msg, 2, 2, GMK_FUNC_DEFAULT);
+	deem_add_function("job-msg", job_msg, 2, 2, GMK_FUNC_DEFAULT);
+	deem_add_function("msg-banner", msg_banner, 2, 2, GMK_FUNC_DEFAULT);
+	deem_add_function("pfx-if", pfx_if, 2, 2, GMK_FUNC_NOEXPAND);
+	deem_add_function("sfx-if", sfx_if, 2, 2, GMK_FUNC_NOEXPAND);
+	deem_add_function("deem-flush", deem_flush, 0, 0, GMK_FUNC_DEFAULT);
+	deem_add_function("pch-ext", pch_ext, 0, 0, GMK_FUNC_DEFAULT);
+	deem_add_function("lto-flags", lto_flags, 2, 3, GMK_FUNC_DEFAULT);
+	deem_add_function("lto-prune", lto_prune, 2, 2, GMK_FUNC_DEFAULT);
+	deem_add_function("pgo-flags", pgo_flags, 2, 3, GMK_FUNC_DEFAULT);
+	deem_add_function("pgo-merge", pgo_merge, 1, 1, GMK_FUNC_DEFAULT);
+	deem_add_function("memo", memo, 1, 1, GMK_FUNC_NOEXPAND);
+	deem_add_function("memo-call", memo_call, 1, 0, GMK_FUNC_DEFAULT);
+	deem_add_function("deem-memo-arg", memo_arg, 1, 1, GMK_FUNC_DEFAULT);
+	deem_add_function("cached-shell", cached_shell, 1, 2, GMK_FUNC_DEFAULT);
+	deem_add_function("rwildcard", rwildcard, 1, 3, GMK_FUNC_DEFAULT);
+	deem_add_function("parallel-shell", parallel_shell, 1, 0, GMK_FUNC_DEFAULT);
+	deem_add_function("load-deps", load_deps, 1, 3, GMK_FUNC_DEFAULT);
+	deem_add_function("digest-check", digest_check, 1, 3, GMK_FUNC_DEFAULT);
+	deem_add_function("deps-flags", deps_flags, 1, 1, GMK_FUNC_DEFAULT);
+	deem_add_function("ljf-sort", ljf_sort, 2, 2, GMK_FUNC_DEFAULT);
+	deem_add_function("ljf-goal", ljf_goal, 2, 2, GMK_FUNC_DEFAULT);
+	deem_add_function("ljf-check", ljf_check, 0, 0, GMK_FUNC_DEFAULT);
+	if (deem_debug())
+		(void)atexit(memo_stats);
+
+	// Without arguments make would see a variable reference
+	deem_eval("override deem-flush=$(deem-flush )\n"
+	          "override pch-ext=$(pch-ext )");
 
 	register_msg(nullptr, 2U, (char *[]){"CC      ", "0;36"});
 	register_msg(nullptr, 2U, (char *[]){"CLEAN   ", "0;35"});
@@ -651,75 +3222,37 @@ deem_gmk_setup (useless gmk_floc const *floc)
 	register_msg(nullptr, 2U, (char *[]){"LINK    ", "1;34"});
 	register_msg(nullptr, 2U, (char *[]){"STRIP   ", "0;33"});
 	register_msg(nullptr, 2U, (char *[]){"SYMLINK ", "0;32"});
+	register_msg(nullptr, 2U, (char *[]){"TRAIN   ", "1;33"});
+
+	// The declarations above are needed right away
+	int batch = 0;
+	deem_batch_mode = deem_flag("$(DEEM_BATCH)", &batch);
+	if (deem_batch_mode) {
+		deem_batch = buf_arena(&deem_batch_arena);
+		(void)atexit(deem_batch_check);
+	}
 
-	return 1;
-}
-
-static struct ref
-trim (char const *str)
-{
-	struct ref ret = {
-		.imm = nullptr,
-		.len = {0U, 0U}
-	};
-
-	while (*str >= '\t' && (*str <= '\r' || *str == ' '))
-		++str;
-	if (!*str)
-		goto end;
-
-	struct utf8 u8p = utf8();
-
-	for (uint8_t const *p = (uint8_t const *)str;;) {
-		p = utf8_parse_next_code_point(&u8p, p);
-		if (u8p.error) {
-			(void)fprintf(stderr, "UTF-8 error: %s\n",
-			              strerror(u8p.error));
-			goto end;
-		}
-		ret.len.n_bytes += utf8_size(&u8p);
-		ret.len.n_chars++;
-
-		size_t ws_count = 0;
-		for (; *p >= (uint8_t)'\t' && (*p <= (uint8_t)'\r' ||
-		                               *p == (uint8_t)' ')
-		     ; ++p)
-			++ws_count;
+	int deps_db = 0;
+	deem_deps_mode = deem_flag("$(DEEM_DEPS_DB)", &deps_db);
 
-		if (!*p)
-			break;
+	int digest_mode = 0;
+	deem_digest_mode = deem_flag("$(DEEM_DIGEST)", &digest_mode);
+	if (deem_digest_mode && deem_debug())
+		(void)atexit(digest_stats);
 
-		ret.len.n_bytes += ws_count;
-		ret.len.n_chars += ws_count;
-	}
+	int cache = 0;
+	deem_cache_mode = deem_flag("$(DEEM_CACHE)", &cache);
 
-	if (ret.len.n_bytes)
-		ret.imm = str;
-end:
-	return ret;
-}
+	int trace = 0;
+	deem_trace_mode = deem_flag("$(DEEM_TRACE)", &trace);
+	ljf_init();
+	int buffer = 0;
+	deem_buffer_mode = deem_flag("$(DEEM_BUFFER_OUTPUT)", &buffer);
+	if (deem_cache_mode || deem_trace_mode || deem_ljf_mode
+	    || deem_buffer_mode)
+		helper_init();
 
-static struct len
-len (char const *const str)
-{
-	if (str) {
-		struct len r = {0, 0};
-		struct utf8 u8p = utf8();
-		uint8_t const *p = (uint8_t const *)str;
-		for (uint8_t const *q = p; *q; q = p) {
-			p = utf8_parse_next_code_point(&u8p, q);
-			if (u8p.error) {
-				(void)fprintf(stderr, "UTF-8 error: %s\n",
-				              strerror(u8p.error));
-				goto fail;
-			}
-			r.n_bytes += utf8_size(&u8p);
-			r.n_chars++;
-		}
-		return r;
-	}
-fail:
-	return (struct len){0, 0};
+	return 1;
 }
 
 static char *
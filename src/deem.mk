@@ -1,26 +1,55 @@
 # Prevent tab-completion and direct build of sub-targets.
-ifneq (,$(filter clean-deem.so deem.so,$(MAKECMDGOALS)))
+ifneq (,$(filter clean-deem.so deem.so deem-cc clean-deem-cc bench clean-bench,$(MAKECMDGOALS)))
 
 override THIS_DIR := $(dir $(realpath $(lastword $(MAKEFILE_LIST))))
 
-override SRC_deem.so := deem.c utf8.c
+override SRC_deem.so := cc.c deem.c deps.c depsdb.c digest.c jobs.c kvdb.c ljf.c memo.c prof.c str.c tmpl.c trace.c utf8.c walk.c
 override OBJ_deem.so := $(SRC_deem.so:%=%.o-fpic)
 override DEP_deem.so := $(SRC_deem.so:%=%.d)
 
-override CFLAGS_deem.so := -std=gnu23 -flto=auto -fPIC
+override SRC_deem-cc := deem-cc.c digest.c
+override OBJ_deem-cc := $(SRC_deem-cc:%=%.o-fpic)
+override DEP_deem-cc := $(SRC_deem-cc:%=%.d)
 
-deem.so: $(THIS_DIR)deem.so
+override SRC_bench := bench.c str.c utf8.c
+override OBJ_bench := $(SRC_bench:%=%.o-fpic)
+override DEP_bench := $(SRC_bench:%=%.d)
+
+override CFLAGS_deem.so := -std=gnu23 -flto=auto -fPIC -pthread
+
+# UTF8_ENGINE=dfa selects the shift-based DFA decoder engine
+ifeq (dfa,$(UTF8_ENGINE))
+override CFLAGS_deem.so += -DUTF8_ENGINE_DFA
+else ifneq (,$(filter-out fsm,$(UTF8_ENGINE)))
+$(error UTF8_ENGINE must be fsm or dfa)
+endif
+
+deem.so: $(THIS_DIR)deem.so $(THIS_DIR)deem-cc
 
 $(THIS_DIR)deem.so: $(OBJ_deem.so:%=$(THIS_DIR)%)
 	@+$(CC) $(CFLAGS) $(CFLAGS_deem.so) -shared -o $@ -MMD $^
 
+# Compile cache helper, used when deem.so is loaded with DEEM_CACHE=1
+deem-cc: $(THIS_DIR)deem-cc
+
+$(THIS_DIR)deem-cc: $(OBJ_deem-cc:%=$(THIS_DIR)%)
+	@+$(CC) $(CFLAGS) $(CFLAGS_deem.so) -o $@ -MMD $^
+
+# BENCH_FLAGS is passed to the benchmark, e.g. BENCH_FLAGS='-k cjk -n 1000'
+bench: $(THIS_DIR)bench
+	@$< $(BENCH_FLAGS)
+
+$(THIS_DIR)bench: $(OBJ_bench:%=$(THIS_DIR)%)
+	@+$(CC) $(CFLAGS) $(CFLAGS_deem.so) -o $@ -MMD $^
+
 %.c.o-fpic: %.c
 	@+$(CC) $(CFLAGS) $(CFLAGS_deem.so) -o $@ -c -MMD $<
 
-clean-deem.so:
+clean-deem.so clean-deem-cc clean-bench:
 	@$(RM) $(@:clean-%=$(THIS_DIR)%) $(OBJ_$(@:clean-%=%):%=$(THIS_DIR)%)
 
-.PHONY: deem.so clean-deem.so
+.PHONY: deem.so clean-deem.so deem-cc clean-deem-cc bench clean-bench
 
--include $(DEP_deem.so:%=$(THIS_DIR)%)
+-include $(DEP_deem.so:%=$(THIS_DIR)%) $(DEP_deem-cc:%=$(THIS_DIR)%) \
+         $(DEP_bench:%=$(THIS_DIR)%)
 endif
@@ -0,0 +1,326 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/** @file deps.c
+ *
+ * @author Juuso Alasuutari
+ */
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "deps.h"
+
+/** @brief Token kinds of the dependency file scanner
+ */
+enum deps_tok {
+	deps_tok_end,   //< End of file
+	deps_tok_eol,   //< End of a logical line
+	deps_tok_colon, //< Separator of targets and prerequisites
+	deps_tok_word,  //< File name
+	deps_tok_other  //< Anything else make would have to deal with
+};
+
+/** @brief Dependency file scanner
+ */
+struct deps_scan {
+	char const *p;   //< File contents
+	size_t      n;   //< File size in bytes
+	size_t      i;   //< Current offset
+	char const *tok; //< Last word
+	size_t      len; //< Length of the last word
+};
+
+/** @brief Check for a backslash-newline continuation at offset `i`.
+ *  @return The length of the continuation, or 0 if there is none.
+ */
+static force_inline size_t
+deps_cont (struct deps_scan const *const s,
+           size_t const                  i)
+{
+	if (s->p[i] != '\\' || i + 1U >= s->n)
+		return 0U;
+	if (s->p[i + 1U] == '\n')
+		return 2U;
+	if (s->p[i + 1U] == '\r' && i + 2U < s->n && s->p[i + 2U] == '\n')
+		return 3U;
+	return 0U;
+}
+
+static force_inline bool
+deps_sep (struct deps_scan const *const s,
+          size_t const                  i)
+{
+	return i >= s->n || s->p[i] == ' ' || s->p[i] == '\t'
+	    || s->p[i] == '\r' || s->p[i] == '\n' || deps_cont(s, i);
+}
+
+static enum deps_tok
+deps_next (struct deps_scan *const s)
+{
+	for (;;) {
+		while (s->i < s->n) {
+			char const c = s->p[s->i];
+			if (c == ' ' || c == '\t' || c == '\r')
+				++s->i;
+			else if (c == '\\' && deps_cont(s, s->i))
+				s->i += deps_cont(s, s->i);
+			else
+				break;
+		}
+
+		if (s->i >= s->n)
+			return deps_tok_end;
+
+		char const c = s->p[s->i];
+		if (c != '#')
+			break;
+
+		while (s->i < s->n && s->p[s->i] != '\n')
+			++s->i;
+	}
+
+	switch (s->p[s->i]) {
+	case '\n':
+		++s->i;
+		return deps_tok_eol;
+	case ':':
+		++s->i;
+		return deps_sep(s, s->i) ? deps_tok_colon : deps_tok_other;
+	case ';': case '|': case '=':
+		return deps_tok_other;
+	default:
+		break;
+	}
+
+	s->tok = &s->p[s->i];
+	while (!deps_sep(s, s->i)) {
+		char const c = s->p[s->i];
+		if (c == ':' && deps_sep(s, s->i + 1U))
+			break;
+		if (c == ';' || c == '=')
+			return deps_tok_other;
+		s->i += c == '\\' && s->i + 1U < s->n ? 2U : 1U;
+	}
+
+	s->len = (size_t)(&s->p[s->i] - s->tok);
+	return deps_tok_word;
+}
+
+static bool
+deps_word (struct buf *const       buf,
+           struct ref const *const word,
+           char const              sep)
+{
+	if (!buf_reserve(buf, word->len.n_bytes + 2U))
+		return false;
+	if (sep && buf->str.len.n_bytes)
+		buf_append_(buf, &sep, &(struct len){1U, 1U});
+	buf_append(buf, word);
+	return true;
+}
+
+bool
+deps_phony (struct deps *const      d,
+            struct ref const *const word)
+{
+	size_t const n = word->len.n_bytes;
+	uint64_t const hash = memo_hash(word->imm, n);
+	if (memo_find(&d->seen, word->imm, n, hash))
+		return true;
+
+	char const *const key = memo_key(&d->seen, word->imm, n);
+	return key && memo_insert(&d->seen, key, n, hash, "", 0U)
+	    && deps_word(&d->phony, word, ' ');
+}
+
+bool
+deps_rule (void *const             ctx,
+           struct ref const *const word,
+           size_t const            n_targ,
+           size_t const            n)
+{
+	struct deps *const d = ctx;
+	++d->n_rule;
+
+	// Targets without prerequisites go to the deduplicated list
+	if (n_targ == n) {
+		for (size_t i = 0; i < n; ++i)
+			if (!deps_phony(d, &word[i]))
+				return false;
+		return true;
+	}
+
+	if (d->hook && !d->hook(d->hook_ctx, word, n_targ, n))
+		return false;
+
+	for (size_t i = 0; i < n; ++i) {
+		if (!deps_word(&d->rule, &word[i], i ? ' ' : '\0'))
+			return false;
+		if (i + 1U == n_targ) {
+			if (!buf_reserve(&d->rule, 1U))
+				return false;
+			buf_append_literal(&d->rule, ":");
+		}
+	}
+
+	if (!buf_reserve(&d->rule, 1U))
+		return false;
+	buf_append_literal(&d->rule, "\n");
+	return true;
+}
+
+static enum deps_res
+deps_parse (char const *const  p,
+            size_t const       n,
+            deps_rule_fn *const fn,
+            void *const        ctx)
+{
+	struct deps_scan s = {.p = p, .n = n};
+	struct ref *word = nullptr;
+	size_t cap = 0U;
+	enum deps_res ret = deps_done;
+
+	for (;;) {
+		size_t cnt = 0U, n_targ = 0U;
+		bool colon = false;
+		enum deps_tok t;
+
+		while ((t = deps_next(&s)) == deps_tok_word ||
+		       (t == deps_tok_colon && cnt && !colon)) {
+			if (t == deps_tok_colon) {
+				colon = true;
+				n_targ = cnt;
+				continue;
+			}
+
+			if (cnt == cap) {
+				size_t c = cap ? cap * 2U : 64U;
+				struct ref *w = realloc(word, c * sizeof *w);
+				if (!w) {
+					perror("realloc");
+					ret = deps_failed;
+					goto out;
+				}
+				word = w;
+				cap = c;
+			}
+
+			word[cnt++] = (struct ref){
+				.imm = s.tok,
+				.len = {s.len, 0U}
+			};
+		}
+
+		if (!cnt && t == deps_tok_eol)
+			continue;
+		if (!cnt && t == deps_tok_end)
+			break;
+
+		if (!colon || (t != deps_tok_eol && t != deps_tok_end)) {
+			ret = deps_foreign;
+			break;
+		}
+
+		if (!fn(ctx, word, n_targ, cnt)) {
+			ret = deps_failed;
+			break;
+		}
+
+		if (t == deps_tok_end)
+			break;
+	}
+
+out:
+	free(word);
+	return ret;
+}
+
+enum deps_res
+deps_parse_file (char const *const   path,
+                 deps_rule_fn *const fn,
+                 void *const         ctx)
+{
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return deps_missing;
+
+	struct stat st;
+	void *map = MAP_FAILED;
+	if (!fstat(fd, &st) && st.st_size > 0)
+		map = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE,
+		           fd, 0);
+	(void)close(fd);
+	if (map == MAP_FAILED)
+		return deps_missing;
+
+	enum deps_res ret = deps_parse(map, (size_t)st.st_size, fn, ctx);
+	(void)munmap(map, (size_t)st.st_size);
+	return ret;
+}
+
+void
+deps_init (struct deps *const d)
+{
+	*d = (struct deps){0};
+	d->rule = buf_arena(&d->rule_mem);
+	d->phony = buf_arena(&d->phony_mem);
+}
+
+bool
+deps_load (struct deps *const d,
+           char const *const  path)
+{
+	struct len const mark = d->rule.str.len;
+	switch (deps_parse_file(path, deps_rule, d)) {
+	case deps_missing:
+		return true;
+	case deps_failed:
+		return false;
+	case deps_done:
+		++d->n_file;
+		return true;
+	case deps_foreign:
+		break;
+	}
+
+	size_t const n = strlen(path);
+	++d->n_file;
+	++d->n_foreign;
+	d->rule.str.len = mark;
+	if (!buf_reserve(&d->rule, n + sizeof "-include \n"))
+		return false;
+
+	buf_append_literal(&d->rule, "-include ");
+	buf_append_(&d->rule, path, &(struct len){n, 0U});
+	buf_append_literal(&d->rule, "\n");
+	return true;
+}
+
+char const *
+deps_text (struct deps *const d)
+{
+	size_t const n = d->phony.str.len.n_bytes;
+	if (!buf_reserve(&d->rule, n + sizeof ":\n"))
+		return nullptr;
+
+	if (n) {
+		buf_append(&d->rule, &d->phony.str);
+		buf_append_literal(&d->rule, ":\n");
+	}
+
+	buf_terminate(&d->rule);
+	return d->rule.str.imm;
+}
+
+void
+deps_fini (struct deps *const d)
+{
+	free(d->seen.tab);
+	arena_fini(&d->seen.mem);
+	arena_fini(&d->phony_mem);
+	arena_fini(&d->rule_mem);
+	*d = (struct deps){0};
+}
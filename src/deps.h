@@ -0,0 +1,138 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/** @file deps.h
+ * @brief Loader for compiler-generated dependency files
+ * @author Juuso Alasuutari
+ */
+#ifndef DEEM_SRC_DEPS_H_
+#define DEEM_SRC_DEPS_H_
+
+#include <stddef.h>
+
+#include "compat.h"
+#include "memo.h"
+#include "str.h"
+#include "util.h"
+
+/** @brief Result of parsing a dependency file
+ */
+enum deps_res {
+	deps_done,    //< All rules were read
+	deps_missing, //< The file is missing or empty
+	deps_foreign, //< The file needs make's own parser
+	deps_failed   //< Memory allocation or the callback failed
+};
+
+/**
+ * @brief Callback for each rule of a dependency file.
+ *
+ * @param ctx Caller context.
+ * @param word The targets followed by the prerequisites, exactly as
+ *             written in the file, including escapes.
+ * @param n_targ The number of targets.
+ * @param n The total number of words.
+ * @return `true` to continue, `false` to stop with @ref deps_failed.
+ */
+typedef bool deps_rule_fn (void             *ctx,
+                           struct ref const *word,
+                           size_t            n_targ,
+                           size_t            n);
+
+/**
+ * @brief Parse a dependency file.
+ *
+ * The file is mapped and scanned for rules of the form
+ * `targets: prerequisites`, with backslash-newline continuations.
+ *
+ * @param path The file path.
+ * @param fn Called for each rule.
+ * @param ctx Passed to `fn`.
+ * @return The result.
+ */
+extern enum deps_res
+deps_parse_file (char const   *path,
+                 deps_rule_fn *fn,
+                 void         *ctx) nonnull_in(1, 2);
+
+/** @brief Dependency loader state
+ *
+ * Rules read from `-MMD` output are collected into one makefile text
+ * which make can evaluate in a single pass. Targets without any
+ * prerequisites, such as the header rules written by `-MP`, appear in
+ * many files but are only emitted once.
+ */
+struct deps {
+	struct buf    rule;      //< Rules with prerequisites
+	struct buf    phony;     //< Targets without prerequisites
+	struct memo   seen;      //< Targets already in `phony`
+	struct arena  rule_mem;  //< Backing memory of `rule`
+	struct arena  phony_mem; //< Backing memory of `phony`
+	size_t        n_file;    //< Files read
+	size_t        n_rule;    //< Rules read
+	size_t        n_foreign; //< Files left to make's own parser
+	deps_rule_fn *hook;      //< Also called for rules with prerequisites
+	void         *hook_ctx;  //< Passed to `hook`
+};
+
+/**
+ * @brief Initialize a dependency loader.
+ * @param d The loader.
+ */
+extern void
+deps_init (struct deps *d) nonnull_in();
+
+/**
+ * @brief Add a rule, see @ref deps_rule_fn.
+ *
+ * A rule without prerequisites is added to the deduplicated list.
+ */
+extern bool
+deps_rule (void             *ctx,
+           struct ref const *word,
+           size_t            n_targ,
+           size_t            n) nonnull_in();
+
+/**
+ * @brief Add a target without prerequisites unless already added.
+ *
+ * @param d The loader.
+ * @param word The target.
+ * @return `true` on success, `false` if memory allocation fails.
+ */
+extern bool
+deps_phony (struct deps      *d,
+            struct ref const *word) nonnull_in();
+
+/**
+ * @brief Read a dependency file.
+ *
+ * A file that uses any make syntax besides plain rules is left to make
+ * by emitting an `-include` for it instead. Missing files are ignored.
+ *
+ * @param d The loader.
+ * @param path The file path.
+ * @return `true` on success, `false` if memory allocation fails.
+ */
+extern bool
+deps_load (struct deps *d,
+           char const  *path) nonnull_in();
+
+/**
+ * @brief Finish loading and get the makefile text.
+ *
+ * Call this once, after the last @ref deps_load().
+ *
+ * @param d The loader.
+ * @return The null-terminated text, or `nullptr` if memory allocation
+ *         fails. It is valid until @ref deps_fini().
+ */
+extern char const *
+deps_text (struct deps *d) nonnull_in();
+
+/**
+ * @brief Release a dependency loader.
+ * @param d The loader.
+ */
+extern void
+deps_fini (struct deps *d) nonnull_in();
+
+#endif /* DEEM_SRC_DEPS_H_ */
@@ -0,0 +1,613 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/** @file depsdb.c
+ *
+ * @author Juuso Alasuutari
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "depsdb.h"
+#include "memo.h"
+
+/** @brief File signature, also the format version
+ */
+static char const depsdb_magic[8] = "deemdp1\n";
+
+/** @brief Record types
+ *
+ * A record is a type and a count followed by the payload, padded to
+ * the next multiple of 8 bytes. A path record holds `count` bytes of
+ * path, and gets the next free index. A dependency record holds
+ * `count` path indices: the target, then its prerequisites.
+ */
+enum depsdb_rec {
+	depsdb_rec_path = 1U,
+	depsdb_rec_deps = 2U
+};
+
+/** @brief Minimum number of dependency records before compaction
+ */
+#define DEPSDB_COMPACT 1000U
+
+static const_inline size_t
+depsdb_rec_size (uint32_t const type,
+                 uint32_t const n)
+{
+	size_t const body = type == depsdb_rec_path ? n : n * sizeof(uint32_t);
+	return (2U * sizeof(uint32_t) + body + 7U) & ~(size_t)7U;
+}
+
+/** @brief Find the hash table slot of a path, or the empty slot where
+ *         it goes.
+ */
+static uint32_t *
+depsdb_slot (struct depsdb const *const db,
+             char const *const          str,
+             size_t const               len,
+             uint64_t const             hash)
+{
+	size_t const mask = db->n_slot - 1U;
+	for (size_t i = hash & mask;; i = (i + 1U) & mask) {
+		uint32_t *const s = &db->slot[i];
+		if (!*s)
+			return s;
+		struct ref const *const p = &db->path[*s - 1U];
+		if (p->len.n_bytes == len && !memcmp(p->imm, str, len))
+			return s;
+	}
+}
+
+static bool
+depsdb_grow (struct depsdb *const db)
+{
+	if (db->n_path == db->cap) {
+		uint32_t cap = db->cap ? db->cap * 2U : 1024U;
+		struct ref *path = realloc(db->path, cap * sizeof *path);
+		if (path)
+			db->path = path;
+		uint32_t const **dep = realloc(db->dep, cap * sizeof *dep);
+		if (dep)
+			db->dep = dep;
+		if (!path || !dep) {
+			perror("realloc");
+			return false;
+		}
+		db->cap = cap;
+	}
+
+	if ((db->n_path + 1U) * 2U > db->n_slot) {
+		size_t n = db->n_slot ? db->n_slot * 2U : 2048U;
+		uint32_t *slot = calloc(n, sizeof *slot);
+		if (!slot) {
+			perror("calloc");
+			return false;
+		}
+
+		free(db->slot);
+		db->slot = slot;
+		db->n_slot = n;
+		for (uint32_t i = 0; i < db->n_path; ++i) {
+			struct ref const *const p = &db->path[i];
+			uint32_t *const s = depsdb_slot(db, p->imm, p->len.n_bytes,
+			                                memo_hash(p->imm,
+			                                          p->len.n_bytes));
+			if (!*s)
+				*s = i + 1U;
+		}
+	}
+
+	return true;
+}
+
+/**
+ * @brief Add a path at the next index.
+ *
+ * The path must stay valid as long as the log is open. A duplicate
+ * still takes up an index, but lookups find the first one.
+ */
+static bool
+depsdb_add (struct depsdb *const db,
+            char const *const    str,
+            size_t const         len)
+{
+	if (!depsdb_grow(db))
+		return false;
+
+	uint32_t const id = db->n_path++;
+	db->path[id] = (struct ref){.imm = str, .len = {len, 0U}};
+	db->dep[id] = nullptr;
+
+	uint32_t *const s = depsdb_slot(db, str, len, memo_hash(str, len));
+	if (!*s)
+		*s = id + 1U;
+	return true;
+}
+
+static force_inline uint32_t
+depsdb_find (struct depsdb const *const db,
+             char const *const          str,
+             size_t const               len)
+{
+	return db->n_slot ? *depsdb_slot(db, str, len, memo_hash(str, len))
+	                  : 0U;
+}
+
+/** @brief Append a record to a buffer.
+ */
+static bool
+depsdb_put (struct buf *const buf,
+            uint32_t const    type,
+            uint32_t const    n,
+            void const *const payload)
+{
+	size_t const size = depsdb_rec_size(type, n);
+	if (!buf_reserve(buf, size))
+		return false;
+
+	size_t const body = type == depsdb_rec_path ? n : n * sizeof(uint32_t);
+	uint32_t const hdr[2] = {type, n};
+	buf_append_(buf, (char const *)hdr, &(struct len){sizeof hdr, 0U});
+	buf_append_(buf, payload, &(struct len){body, 0U});
+	(void)memset(&buf->str.mut[buf->str.len.n_bytes], 0,
+	             size - sizeof hdr - body);
+	buf->str.len.n_bytes += size - sizeof hdr - body;
+	return true;
+}
+
+/**
+ * @brief Get the index of a path, adding it if necessary.
+ *
+ * The path must stay valid as long as the log is open.
+ */
+static bool
+depsdb_intern (struct depsdb *const    db,
+               struct ref const *const word,
+               uint32_t *const         id)
+{
+	size_t const len = word->len.n_bytes;
+	uint32_t const s = depsdb_find(db, word->imm, len);
+	if (s) {
+		*id = s - 1U;
+		return true;
+	}
+
+	if (len > UINT32_MAX || db->n_path == UINT32_MAX)
+		return false;
+
+	*id = db->n_path;
+	return depsdb_add(db, word->imm, len)
+	    && depsdb_put(&db->out, depsdb_rec_path, (uint32_t)len, word->imm);
+}
+
+/** @brief Copy a path for a pending record.
+ */
+static bool
+depsdb_keep (struct depsdb *const    db,
+             struct ref *const       dst,
+             struct ref const *const src)
+{
+	size_t const len = src->len.n_bytes;
+	char *const str = arena_alloc(&db->mem, len ? len : 1U);
+	if (!str)
+		return false;
+
+	__builtin_memcpy(str, src->imm, len);
+	*dst = (struct ref){.imm = str, .len = {len, 0U}};
+	return true;
+}
+
+bool
+depsdb_rule (void *const             ctx,
+             struct ref const *const word,
+             size_t const            n_targ,
+             size_t const            n)
+{
+	struct depsdb *const db = ctx;
+	if (n == n_targ)
+		return true;
+
+	size_t const cnt = n - n_targ + 1U;
+	if (cnt > UINT32_MAX - 1U)
+		return false;
+
+	// The target goes in front of the prerequisites
+	struct ref *const pre = arena_alloc(&db->mem, cnt * sizeof *pre);
+	if (!pre)
+		return false;
+	for (size_t i = n_targ; i < n; ++i)
+		if (!depsdb_keep(db, &pre[i - n_targ + 1U], &word[i]))
+			return false;
+
+	for (size_t i = 0; i < n_targ; ++i) {
+		struct ref *r = pre;
+		if (i) {
+			r = arena_alloc(&db->mem, cnt * sizeof *r);
+			if (!r)
+				return false;
+			__builtin_memcpy(r, pre, cnt * sizeof *r);
+		}
+		if (!depsdb_keep(db, &r[0], &word[i]))
+			return false;
+
+		if (db->n_pend == db->cap_pend) {
+			size_t cap = db->cap_pend ? db->cap_pend * 2U : 64U;
+			struct depsdb_pend *p = realloc(db->pend, cap * sizeof *p);
+			if (!p) {
+				perror("realloc");
+				return false;
+			}
+			db->pend = p;
+			db->cap_pend = cap;
+		}
+
+		db->pend[db->n_pend++] = (struct depsdb_pend){r, (uint32_t)cnt};
+	}
+
+	return true;
+}
+
+/** @brief Intern the paths of a pending record and buffer it.
+ */
+static bool
+depsdb_apply (struct depsdb *const            db,
+              struct depsdb_pend const *const p)
+{
+	// Slot 0 is the count, slot 1 the target
+	uint32_t *const rec = arena_alloc(&db->mem, (p->n + 1U) * sizeof *rec);
+	if (!rec)
+		return false;
+
+	rec[0] = p->n;
+	for (uint32_t i = 0; i < p->n; ++i)
+		if (!depsdb_intern(db, &p->word[i], &rec[i + 1U]))
+			return false;
+
+	if (!depsdb_put(&db->out, depsdb_rec_deps, p->n, &rec[1]))
+		return false;
+
+	db->dep[rec[1]] = rec;
+	++db->n_rec;
+	return true;
+}
+
+/** @brief Read the records of the mapping.
+ *  @return The offset after the last complete and valid record.
+ */
+static size_t
+depsdb_scan (struct depsdb *const db)
+{
+	size_t off = sizeof depsdb_magic;
+
+	while (db->size - off >= 2U * sizeof(uint32_t)) {
+		uint32_t hdr[2];
+		__builtin_memcpy(hdr, &db->map[off], sizeof hdr);
+
+		if (hdr[0] != depsdb_rec_path && hdr[0] != depsdb_rec_deps)
+			break;
+
+		size_t const size = depsdb_rec_size(hdr[0], hdr[1]);
+		if (size > db->size - off)
+			break;
+
+		unsigned char const *const body = &db->map[off + sizeof hdr];
+		if (hdr[0] == depsdb_rec_path) {
+			if (!depsdb_add(db, (char const *)body, hdr[1]))
+				return 0U;
+		} else {
+			uint32_t const *const rec = (uint32_t const *)body - 1;
+			uint32_t i = 0;
+			while (i < hdr[1] && rec[i + 1U] < db->n_path)
+				++i;
+			if (!i || i < hdr[1])
+				break;
+			db->dep[rec[1]] = rec;
+			++db->n_rec;
+		}
+
+		off += size;
+	}
+
+	return off;
+}
+
+/** @brief Rewrite the log with only the latest record of each target.
+ */
+static bool
+depsdb_compact (struct depsdb const *const db,
+                char const *const          path)
+{
+	size_t const n = strlen(path);
+	char *const tmp = malloc(n + sizeof ".tmp");
+	uint32_t *const map = malloc((db->n_path + 1U) * sizeof *map);
+	struct arena mem = {0};
+	struct buf out = buf_arena(&mem);
+	bool ok = tmp && map && buf_reserve(&out, sizeof depsdb_magic);
+
+	if (ok) {
+		__builtin_memcpy(tmp, path, n);
+		__builtin_memcpy(&tmp[n], ".tmp", sizeof ".tmp");
+		(void)memset(map, 0xff, db->n_path * sizeof *map);
+		buf_append_(&out, depsdb_magic,
+		            &(struct len){sizeof depsdb_magic, 0U});
+	}
+
+	uint32_t next = 0U;
+	uint32_t *r = nullptr;
+	for (uint32_t t = 0, cap = 0U; ok && t < db->n_path; ++t) {
+		uint32_t const *const rec = db->dep[t];
+		if (!rec)
+			continue;
+
+		if (rec[0] > cap) {
+			uint32_t *const p = realloc(r, rec[0] * sizeof *p);
+			if (!p) {
+				perror("realloc");
+				ok = false;
+				break;
+			}
+			r = p;
+			cap = rec[0];
+		}
+
+		for (uint32_t i = 0; ok && i < rec[0]; ++i) {
+			uint32_t const id = rec[i + 1U];
+			if (map[id] == UINT32_MAX) {
+				struct ref const *const p = &db->path[id];
+				map[id] = next++;
+				ok = depsdb_put(&out, depsdb_rec_path,
+				                (uint32_t)p->len.n_bytes, p->imm);
+			}
+			r[i] = map[id];
+		}
+
+		ok = ok && depsdb_put(&out, depsdb_rec_deps, rec[0], r);
+	}
+
+	if (ok) {
+		int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+		ok = fd >= 0
+		  && write(fd, out.str.imm, out.str.len.n_bytes)
+		     == (ssize_t)out.str.len.n_bytes;
+		if (fd >= 0 && close(fd))
+			ok = false;
+		if (ok && rename(tmp, path))
+			ok = false;
+		if (!ok) {
+			(void)fprintf(stderr, "%s: %s\n", tmp, strerror(errno));
+			(void)unlink(tmp);
+		}
+	}
+
+	arena_fini(&mem);
+	free(r);
+	free(map);
+	free(tmp);
+	return ok;
+}
+
+/**
+ * @brief Start a file over if it isn't a dependency log.
+ *
+ * Only called with the log locked.
+ */
+static bool
+depsdb_init (int const         fd,
+             char const *const path,
+             struct stat *const st)
+{
+	char magic[sizeof depsdb_magic];
+	if ((size_t)st->st_size >= sizeof magic &&
+	    pread(fd, magic, sizeof magic, 0) == (ssize_t)sizeof magic &&
+	    !memcmp(magic, depsdb_magic, sizeof magic))
+		return true;
+
+	if (ftruncate(fd, 0) ||
+	    write(fd, depsdb_magic, sizeof depsdb_magic)
+	    != (ssize_t)sizeof depsdb_magic) {
+		(void)fprintf(stderr, "%s: %s\n", path, strerror(errno));
+		return false;
+	}
+
+	st->st_size = sizeof depsdb_magic;
+	return true;
+}
+
+/**
+ * @brief Bring the index up to date with the file.
+ *
+ * Only called with the log locked. If the file was replaced by a
+ * compaction, the new one is opened and locked instead. If anything
+ * was appended since the index was built, e.g. by another make, the
+ * index is built again from the start, since path indices are given
+ * by the order of the records in the file.
+ */
+static bool
+depsdb_refresh (struct depsdb *const db)
+{
+	struct stat st;
+	if (fstat(db->fd, &st)) {
+		perror("fstat");
+		return false;
+	}
+
+	if (!st.st_nlink) {
+		int fd = open(db->file, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+		if (fd < 0 || flock(fd, LOCK_EX) || fstat(fd, &st)) {
+			(void)fprintf(stderr, "%s: %s\n", db->file, strerror(errno));
+			if (fd >= 0)
+				(void)close(fd);
+			return false;
+		}
+		(void)close(db->fd);
+		db->fd = fd;
+		db->end = SIZE_MAX;
+	}
+
+	if (!depsdb_init(db->fd, db->file, &st))
+		return false;
+	if ((size_t)st.st_size == db->end)
+		return true;
+
+	if (db->map)
+		(void)munmap((void *)db->map, db->size);
+	db->map = nullptr;
+	db->size = 0U;
+	db->n_path = 0U;
+	db->n_rec = 0U;
+	if (db->slot)
+		(void)memset(db->slot, 0, db->n_slot * sizeof *db->slot);
+	db->end = sizeof depsdb_magic;
+	if ((size_t)st.st_size == sizeof depsdb_magic)
+		return true;
+
+	void *map = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_SHARED,
+	                 db->fd, 0);
+	if (map == MAP_FAILED) {
+		perror("mmap");
+		db->end = SIZE_MAX;
+		return false;
+	}
+
+	db->map = map;
+	db->size = (size_t)st.st_size;
+
+	size_t const end = depsdb_scan(db);
+	if (!end) {
+		db->end = SIZE_MAX;
+		return false;
+	}
+
+	// Drop a partial record left by an interrupted write
+	if (end < db->size && ftruncate(db->fd, (off_t)end))
+		perror("ftruncate");
+	db->end = end;
+	return true;
+}
+
+bool
+depsdb_open (struct depsdb *const db,
+             char const *const    path)
+{
+	*db = (struct depsdb){.fd = -1};
+	db->out = buf_arena(&db->out_mem);
+	db->end = SIZE_MAX;
+
+	db->file = strdup(path);
+	if (!db->file) {
+		perror("strdup");
+		return false;
+	}
+
+	db->fd = open(path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+	if (db->fd < 0 || flock(db->fd, LOCK_EX)) {
+		(void)fprintf(stderr, "%s: %s\n", path, strerror(errno));
+		depsdb_close(db);
+		return false;
+	}
+
+	if (!depsdb_refresh(db)) {
+		depsdb_close(db);
+		return false;
+	}
+
+	size_t live = 0U;
+	for (uint32_t i = 0; i < db->n_path; ++i)
+		live += db->dep[i] != nullptr;
+
+	// The lock is held until the compacted log is in place
+	if (db->n_rec > DEPSDB_COMPACT && db->n_rec > live * 3U &&
+	    depsdb_compact(db, path)) {
+		depsdb_close(db);
+		return depsdb_open(db, path);
+	}
+
+	(void)flock(db->fd, LOCK_UN);
+	return true;
+}
+
+bool
+depsdb_sync (struct depsdb *const db)
+{
+	if (!db->n_pend || db->fd < 0)
+		return true;
+
+	// Indices are only valid for the file as it is while locked
+	if (flock(db->fd, LOCK_EX)) {
+		perror("flock");
+		return false;
+	}
+
+	bool ok = depsdb_refresh(db);
+	for (size_t i = 0; ok && i < db->n_pend; ++i)
+		ok = depsdb_apply(db, &db->pend[i]);
+	db->n_pend = 0U;
+
+	size_t const n = db->out.str.len.n_bytes;
+	if (ok && n) {
+		ssize_t const w = write(db->fd, db->out.str.imm, n);
+		ok = w == (ssize_t)n;
+		if (!ok)
+			perror("write");
+	}
+
+	// Whatever was buffered is now either in the file or in doubt
+	db->end = ok ? db->end + n : SIZE_MAX;
+	(void)flock(db->fd, LOCK_UN);
+	arena_reset(&db->out_mem);
+	db->out = buf_arena(&db->out_mem);
+	return ok;
+}
+
+void
+depsdb_close (struct depsdb *const db)
+{
+	(void)depsdb_sync(db);
+
+	if (db->map)
+		(void)munmap((void *)db->map, db->size);
+	if (db->fd >= 0)
+		(void)close(db->fd);
+
+	free(db->slot);
+	free(db->dep);
+	free(db->path);
+	free(db->pend);
+	free(db->file);
+	arena_fini(&db->out_mem);
+	arena_fini(&db->mem);
+	*db = (struct depsdb){.fd = -1};
+}
+
+bool
+depsdb_load (struct depsdb *const    db,
+             struct deps *const      d,
+             struct ref const *const target)
+{
+	uint32_t const s = depsdb_find(db, target->imm, target->len.n_bytes);
+	uint32_t const *const rec = s ? db->dep[s - 1U] : nullptr;
+	if (!rec)
+		return true;
+
+	struct ref *const word = malloc(rec[0] * sizeof *word);
+	if (!word) {
+		perror("malloc");
+		return false;
+	}
+
+	for (uint32_t i = 0; i < rec[0]; ++i)
+		word[i] = db->path[rec[i + 1U]];
+
+	bool ok = deps_rule(d, word, 1U, rec[0]);
+	for (uint32_t i = 2U; ok && i < rec[0]; ++i)
+		ok = deps_phony(d, &word[i]);
+
+	free(word);
+	return ok;
+}
@@ -0,0 +1,119 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/** @file depsdb.h
+ * @brief Binary dependency log
+ * @author Juuso Alasuutari
+ */
+#ifndef DEEM_SRC_DEPSDB_H_
+#define DEEM_SRC_DEPSDB_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "compat.h"
+#include "deps.h"
+#include "str.h"
+#include "util.h"
+
+/** @brief Dependency record waiting to be written
+ */
+struct depsdb_pend {
+	struct ref *word; //< The target, then its prerequisites
+	uint32_t    n;
+};
+
+/** @brief Dependency log file
+ *
+ * Replaces a directory full of `.d` files with a single append-only
+ * file. Paths are interned, so each is stored once and referred to by
+ * index, and each dependency record lists the target followed by its
+ * prerequisites. A later record for a target overrides an earlier
+ * one. The file is compacted when it is opened if most of its records
+ * have been overridden.
+ *
+ * The index of a path is given by the order of the path records, so
+ * the file is locked while records are appended, and the paths are
+ * interned only then, against the file as it is at that moment.
+ */
+struct depsdb {
+	int                  fd;    //< File descriptor, -1 if not open
+	char                *file;  //< Path of the log
+	unsigned char const *map;   //< File contents, or `nullptr`
+	size_t               size;  //< Size of the mapping in bytes
+	size_t               end;   //< File size the index matches
+	struct ref          *path;  //< Interned paths by index
+	uint32_t const     **dep;   //< Latest record by target index
+	uint32_t             n_path;
+	uint32_t             cap;   //< Capacity of `path` and `dep`
+	uint32_t            *slot;  //< Hash table of path index + 1
+	size_t               n_slot;
+	size_t               n_rec; //< Dependency records read or added
+	struct depsdb_pend  *pend;  //< Records waiting to be written
+	size_t               n_pend;
+	size_t               cap_pend;
+	struct buf           out;   //< Records being written
+	struct arena         mem;   //< Paths and records added since open
+	struct arena         out_mem; //< Backing memory of `out`
+};
+
+/**
+ * @brief Open or create a dependency log.
+ *
+ * A partial record at the end, e.g. from an interrupted write, is
+ * truncated away.
+ *
+ * @param db The log object.
+ * @param path The file path.
+ * @return `true` on success, `false` otherwise.
+ */
+extern bool
+depsdb_open (struct depsdb *db,
+             char const    *path) nonnull_in();
+
+/**
+ * @brief Write pending records and close a dependency log.
+ * @param db The log object.
+ */
+extern void
+depsdb_close (struct depsdb *db) nonnull_in();
+
+/**
+ * @brief Record the rules of a dependency file, see @ref deps_rule_fn.
+ *
+ * `ctx` is the log object. Records are buffered until the next
+ * @ref depsdb_sync(), and only seen by @ref depsdb_load() after it.
+ */
+extern bool
+depsdb_rule (void             *ctx,
+             struct ref const *word,
+             size_t            n_targ,
+             size_t            n) nonnull_in();
+
+/**
+ * @brief Append buffered records to the file.
+ *
+ * The file is locked, and the index is first brought up to date with
+ * anything other processes have appended.
+ *
+ * @param db The log object.
+ * @return `true` on success, `false` otherwise.
+ */
+extern bool
+depsdb_sync (struct depsdb *db) nonnull_in();
+
+/**
+ * @brief Add the dependencies of a target to a loader.
+ *
+ * Like `-MP`, every prerequisite except the first is also added as a
+ * target without prerequisites.
+ *
+ * @param db The log object.
+ * @param d The loader.
+ * @param target The target.
+ * @return `true` on success, `false` if memory allocation fails.
+ */
+extern bool
+depsdb_load (struct depsdb    *db,
+             struct deps      *d,
+             struct ref const *target) nonnull_in();
+
+#endif /* DEEM_SRC_DEPSDB_H_ */
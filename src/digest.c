@@ -0,0 +1,169 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/** @file digest.c
+ *
+ * @author Juuso Alasuutari
+ */
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "digest.h"
+
+#define P1 UINT64_C(0x9e3779b185ebca87)
+#define P2 UINT64_C(0xc2b2ae3d27d4eb4f)
+#define P3 UINT64_C(0x165667b19e3779f9)
+#define P4 UINT64_C(0x85ebca77c2b2ae63)
+#define P5 UINT64_C(0x27d4eb2f165667c5)
+
+static const_inline uint64_t
+digest_rotl (uint64_t const x,
+             unsigned const r)
+{
+	return (x << r) | (x >> (64U - r));
+}
+
+static force_inline uint64_t
+digest_u64 (unsigned char const *const p)
+{
+	uint64_t v;
+	__builtin_memcpy(&v, p, sizeof v);
+	return v;
+}
+
+static force_inline uint32_t
+digest_u32 (unsigned char const *const p)
+{
+	uint32_t v;
+	__builtin_memcpy(&v, p, sizeof v);
+	return v;
+}
+
+static const_inline uint64_t
+digest_round (uint64_t const acc,
+              uint64_t const in)
+{
+	return digest_rotl(acc + in * P2, 31U) * P1;
+}
+
+static const_inline uint64_t
+digest_merge (uint64_t const acc,
+              uint64_t const v)
+{
+	return (acc ^ digest_round(0U, v)) * P1 + P4;
+}
+
+uint64_t
+digest (void const *const ptr,
+        size_t const      n,
+        uint64_t const    seed)
+{
+	unsigned char const *p = ptr;
+	unsigned char const *const end = &p[n];
+	uint64_t h;
+
+	if (n >= 32U) {
+		// Four independent lanes keep the multipliers busy
+		uint64_t v[4] = {seed + P1 + P2, seed + P2, seed, seed - P1};
+		for (unsigned char const *const lim = end - 32; p <= lim; p += 32) {
+			v[0] = digest_round(v[0], digest_u64(&p[0]));
+			v[1] = digest_round(v[1], digest_u64(&p[8]));
+			v[2] = digest_round(v[2], digest_u64(&p[16]));
+			v[3] = digest_round(v[3], digest_u64(&p[24]));
+		}
+		h = digest_rotl(v[0], 1U) + digest_rotl(v[1], 7U)
+		  + digest_rotl(v[2], 12U) + digest_rotl(v[3], 18U);
+		for (unsigned i = 0; i < 4U; ++i)
+			h = digest_merge(h, v[i]);
+	} else {
+		h = seed + P5;
+	}
+
+	h += n;
+	for (; end - p >= 8; p += 8)
+		h = digest_rotl(h ^ digest_round(0U, digest_u64(p)), 27U) * P1 + P4;
+	if (end - p >= 4) {
+		h = digest_rotl(h ^ (uint64_t)digest_u32(p) * P1, 23U) * P2 + P3;
+		p += 4;
+	}
+	for (; p < end; ++p)
+		h = digest_rotl(h ^ *p * P5, 11U) * P1;
+
+	h ^= h >> 33U;
+	h *= P2;
+	h ^= h >> 29U;
+	h *= P3;
+	return h ^ (h >> 32U);
+}
+
+static void
+digest_file (struct digest_file *const f)
+{
+	f->ok = false;
+	f->sum = 0U;
+
+	int fd = open(f->path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return;
+
+	struct stat st;
+	if (!fstat(fd, &st)) {
+		size_t const n = (size_t)st.st_size;
+		void *map = n ? mmap(nullptr, n, PROT_READ, MAP_PRIVATE, fd, 0)
+		              : nullptr;
+		if (map != MAP_FAILED) {
+			f->sum = digest(map, n, 0U);
+			f->ok = true;
+			if (map)
+				(void)munmap(map, n);
+		}
+	}
+
+	(void)close(fd);
+}
+
+struct digest_pool {
+	struct digest_file *f;
+	size_t              n;
+	size_t              next; //< Next file to claim
+};
+
+static void *
+digest_worker (void *const arg)
+{
+	struct digest_pool *const pool = arg;
+	for (;;) {
+		size_t const i = __atomic_fetch_add(&pool->next, 1U,
+		                                    __ATOMIC_RELAXED);
+		if (i >= pool->n)
+			return nullptr;
+		digest_file(&pool->f[i]);
+	}
+}
+
+void
+digest_files (struct digest_file *const f,
+              size_t const              n)
+{
+	struct digest_pool pool = {.f = f, .n = n, .next = 0U};
+
+	long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+	size_t n_thr = ncpu < 1 ? 1U : (size_t)ncpu;
+	if (n_thr > DIGEST_THREADS_MAX)
+		n_thr = DIGEST_THREADS_MAX;
+	if (n_thr > n)
+		n_thr = n;
+
+	// The calling thread is one of the workers
+	pthread_t tid[DIGEST_THREADS_MAX];
+	size_t started = 1U;
+	for (; started < n_thr; ++started)
+		if (pthread_create(&tid[started], nullptr, digest_worker, &pool))
+			break;
+
+	(void)digest_worker(&pool);
+	for (size_t i = 1U; i < started; ++i)
+		(void)pthread_join(tid[i], nullptr);
+}
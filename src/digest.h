@@ -0,0 +1,53 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/** @file digest.h
+ * @brief Content digests for up-to-date checks
+ * @author Juuso Alasuutari
+ */
+#ifndef DEEM_SRC_DIGEST_H_
+#define DEEM_SRC_DIGEST_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "compat.h"
+#include "util.h"
+
+/** @brief Upper limit of worker threads for @ref digest_files()
+ */
+#define DIGEST_THREADS_MAX 8U
+
+/** @brief A file to digest
+ */
+struct digest_file {
+	char const *path; //< File path
+	uint64_t    sum;  //< Digest of the contents
+	bool        ok;   //< Whether the file could be read
+};
+
+/**
+ * @brief Compute the XXH64 digest of a byte string.
+ *
+ * @param ptr The bytes.
+ * @param n The number of bytes.
+ * @param seed Seed value, e.g. a previous digest to chain.
+ * @return The digest.
+ */
+extern uint64_t
+digest (void const *ptr,
+        size_t      n,
+        uint64_t    seed);
+
+/**
+ * @brief Digest the contents of files in parallel.
+ *
+ * The files are mapped and hashed by a small pool of threads. An empty
+ * file is `ok` with the digest of an empty string.
+ *
+ * @param f The files.
+ * @param n The number of files.
+ */
+extern void
+digest_files (struct digest_file *f,
+              size_t              n);
+
+#endif /* DEEM_SRC_DIGEST_H_ */
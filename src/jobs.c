@@ -0,0 +1,425 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/** @file jobs.c
+ *
+ * @author Juuso Alasuutari
+ */
+#ifndef _GNU_SOURCE
+# define _GNU_SOURCE
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "jobs.h"
+
+extern char **environ;
+
+/** @brief Job slots of this process
+ *
+ * The read end of the jobserver is opened anew rather than duplicated
+ * so that it can be non-blocking without affecting other processes.
+ */
+static struct {
+	int      rfd;   //< Jobserver read end, or -1 if there's none
+	int      wfd;   //< Jobserver write end, or -1 if there's none
+	unsigned slots; //< Number of slots without a jobserver
+	bool     init;
+} jobs_srv = {.rfd = -1, .wfd = -1, .slots = 1U};
+
+/** @brief Running command
+ */
+struct jobs_proc {
+	pid_t  pid;
+	int    fd;  //< Read end of the output pipe
+	size_t i;   //< Index of the job
+	size_t cap; //< Size of the output buffer
+};
+
+/**
+ * @brief Get the slot count of a `-j` option.
+ * @param s The text after `-j` or `--jobs=`.
+ * @return The count; the number of CPUs if it's missing.
+ */
+static unsigned
+jobs_count (char const *const s)
+{
+	char *end;
+	unsigned long n = strtoul(s, &end, 10);
+	if (end != s && n)
+		return n > JOBS_MAX ? JOBS_MAX : (unsigned)n;
+
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	return cpus < 1 ? 1U : cpus > JOBS_MAX ? JOBS_MAX : (unsigned)cpus;
+}
+
+/**
+ * @brief Connect to the jobserver.
+ * @param auth The value of `--jobserver-auth`, either `R,W` or
+ *             `fifo:PATH`.
+ * @param n Length of `auth` in bytes.
+ */
+static void
+jobs_open (char const *const auth,
+           size_t const      n)
+{
+	char path[PATH_MAX];
+	if (n >= sizeof path)
+		return;
+
+	if (n > 5U && !strncmp(auth, "fifo:", 5U)) {
+		(void)snprintf(path, sizeof path, "%.*s", (int)n - 5, &auth[5]);
+		jobs_srv.rfd = open(path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+		if (jobs_srv.rfd >= 0)
+			jobs_srv.wfd = open(path, O_WRONLY | O_CLOEXEC);
+	} else {
+		int r, w;
+		if (sscanf(auth, "%d,%d", &r, &w) != 2 || r < 0 || w < 0)
+			return;
+
+		// Make closes the descriptors for commands it doesn't trust
+		if (fcntl(r, F_GETFD) < 0 || fcntl(w, F_GETFD) < 0)
+			return;
+
+		(void)snprintf(path, sizeof path, "/proc/self/fd/%d", r);
+		jobs_srv.rfd = open(path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+		if (jobs_srv.rfd >= 0)
+			jobs_srv.wfd = fcntl(w, F_DUPFD_CLOEXEC, 3);
+	}
+
+	if (jobs_srv.wfd < 0 && jobs_srv.rfd >= 0) {
+		(void)close(jobs_srv.rfd);
+		jobs_srv.rfd = -1;
+	}
+}
+
+/**
+ * @brief Find the jobserver or `-j` option in `MAKEFLAGS`.
+ * @return `true` if either was found, `false` otherwise.
+ */
+static bool
+jobs_makeflags (void)
+{
+	static char const *const auth[] = {
+		"--jobserver-auth=", "--jobserver-fds="
+	};
+
+	char const *p = getenv("MAKEFLAGS");
+	bool found = false, srv = false;
+
+	for (; p && *p;) {
+		while (*p == ' ')
+			++p;
+		char const *const w = p;
+		while (*p && *p != ' ')
+			++p;
+
+		for (size_t k = 0; k < array_size(auth); ++k) {
+			size_t const len = strlen(auth[k]);
+			if ((size_t)(p - w) > len && !strncmp(w, auth[k], len)) {
+				jobs_open(&w[len], (size_t)(p - w) - len);
+				srv = true;
+			}
+		}
+
+		if (p - w >= 2 && !strncmp(w, "-j", 2U)) {
+			jobs_srv.slots = jobs_count(&w[2]);
+			found = true;
+		}
+	}
+
+	// Without access to the jobserver, this make only has its own slot
+	if (srv && jobs_srv.rfd < 0)
+		jobs_srv.slots = 1U;
+
+	return found || srv;
+}
+
+/**
+ * @brief Find the `-j` option on the command line of make.
+ *
+ * The top-level make only exports it in `MAKEFLAGS` after all of the
+ * makefiles have been read.
+ */
+static void
+jobs_cmdline (void)
+{
+	char buf[65536];
+	int fd = open("/proc/self/cmdline", O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return;
+
+	ssize_t n = read(fd, buf, sizeof buf - 1U);
+	(void)close(fd);
+	if (n <= 0)
+		return;
+	buf[n] = '\0';
+
+	char const *const end = &buf[n];
+	for (char const *a = buf + strlen(buf) + 1; a < end; a += strlen(a) + 1) {
+		char const *const next = a + strlen(a) + 1;
+		char const *arg = nullptr;
+
+		if (!strcmp(a, "--")) {
+			break;
+		} else if (!strncmp(a, "--jobs", 6U) && (!a[6] || a[6] == '=')) {
+			arg = a[6] ? &a[7] : "";
+		} else if (a[0] == '-' && a[1] != '-') {
+			for (char const *c = &a[1]; *c; ++c) {
+				if (*c == 'j') {
+					arg = &c[1];
+					break;
+				}
+				// The rest is the argument of another option
+				if (strchr("CEIOWfilo", *c))
+					break;
+			}
+		}
+
+		if (arg) {
+			if (!*arg && next < end && *next >= '0' && *next <= '9')
+				arg = next;
+			jobs_srv.slots = jobs_count(arg);
+		}
+	}
+}
+
+static void
+jobs_init (void)
+{
+	if (!jobs_srv.init) {
+		jobs_srv.init = true;
+		if (!jobs_makeflags())
+			jobs_cmdline();
+	}
+}
+
+unsigned
+jobs_limit (void)
+{
+	jobs_init();
+	return jobs_srv.slots;
+}
+
+/**
+ * @brief Check if there's a free slot, taking a jobserver token if
+ *        needed.
+ *
+ * @param live Number of running commands.
+ * @param tok Tokens held, to be written back when they're released.
+ * @param held Number of tokens held.
+ * @return `true` if another command can be started.
+ */
+static bool
+jobs_slot (size_t const    live,
+           char *const     tok,
+           unsigned *const held)
+{
+	if (jobs_srv.rfd < 0)
+		return live < jobs_srv.slots;
+
+	// The make process has a slot of its own
+	if (live < 1U + *held)
+		return true;
+
+	if (*held < JOBS_MAX && read(jobs_srv.rfd, &tok[*held], 1U) == 1) {
+		++*held;
+		return true;
+	}
+
+	return false;
+}
+
+static void
+jobs_release (char const *const tok,
+              unsigned *const   held,
+              unsigned const    keep)
+{
+	while (*held > keep) {
+		ssize_t w = write(jobs_srv.wfd, &tok[*held - 1U], 1U);
+		if (w < 0 && errno == EINTR)
+			continue;
+		if (w < 0)
+			perror("jobserver");
+		--*held;
+	}
+}
+
+static bool
+jobs_start (struct jobs_proc *const p,
+            struct job *const       job,
+            char const **const      argv,
+            size_t const            n_sh)
+{
+	int fd[2];
+	if (pipe2(fd, O_CLOEXEC)) {
+		perror("pipe2");
+		return false;
+	}
+
+	posix_spawn_file_actions_t fa;
+	int e = posix_spawn_file_actions_init(&fa);
+	if (!e) {
+		e = posix_spawn_file_actions_adddup2(&fa, fd[1], STDOUT_FILENO);
+		argv[n_sh] = job->cmd;
+		if (!e)
+			e = posix_spawnp(&p->pid, argv[0], &fa, nullptr,
+			                 (char *const *)argv, environ);
+		(void)posix_spawn_file_actions_destroy(&fa);
+	}
+
+	(void)close(fd[1]);
+	if (e) {
+		(void)fprintf(stderr, "%s: %s\n", argv[0], strerror(e));
+		(void)close(fd[0]);
+		return false;
+	}
+
+	p->fd = fd[0];
+	p->cap = 0U;
+	return true;
+}
+
+/**
+ * @brief Read available output of a command.
+ * @return `false` at the end of the output, `true` otherwise.
+ */
+static bool
+jobs_read (struct jobs_proc *const p,
+           struct job *const       job)
+{
+	if (job->n_out + 1U >= p->cap) {
+		size_t cap = p->cap ? p->cap * 2U : 256U;
+		char *const out = realloc(job->out, cap);
+		if (!out) {
+			perror("realloc");
+			return false;
+		}
+		job->out = out;
+		p->cap = cap;
+	}
+
+	ssize_t n = read(p->fd, &job->out[job->n_out], p->cap - job->n_out - 1U);
+	if (n < 0)
+		return errno == EINTR || errno == EAGAIN;
+	if (!n)
+		return false;
+
+	job->n_out += (size_t)n;
+	return true;
+}
+
+static void
+jobs_reap (struct jobs_proc *const p,
+           struct job *const       job)
+{
+	(void)close(p->fd);
+	if (job->out)
+		job->out[job->n_out] = '\0';
+
+	int st;
+	while (waitpid(p->pid, &st, 0) < 0) {
+		if (errno != EINTR) {
+			perror("waitpid");
+			return;
+		}
+	}
+
+	job->status = WIFEXITED(st) ? WEXITSTATUS(st) : 128 + WTERMSIG(st);
+}
+
+bool
+jobs_run (struct job *const        job,
+          size_t const             n,
+          char const *const *const sh,
+          size_t const             n_sh)
+{
+	jobs_init();
+
+	size_t const cap = n < JOBS_MAX ? n : JOBS_MAX;
+	char const **const argv = malloc((n_sh + 2U) * sizeof *argv);
+	struct jobs_proc *const proc = malloc(cap * sizeof *proc);
+	struct pollfd *const pfd = malloc((cap + 1U) * sizeof *pfd);
+	if (!argv || !proc || !pfd) {
+		perror("malloc");
+		free(pfd);
+		free(proc);
+		free(argv);
+		return false;
+	}
+
+	__builtin_memcpy(argv, sh, n_sh * sizeof *argv);
+	argv[n_sh + 1U] = nullptr;
+
+	for (size_t i = 0; i < n; ++i) {
+		job[i].out = nullptr;
+		job[i].n_out = 0U;
+		job[i].status = 127;
+	}
+
+	char tok[JOBS_MAX];
+	unsigned held = 0U;
+	size_t next = 0U, live = 0U;
+	bool ok = true;
+
+	for (;;) {
+		while (next < n && live < cap && jobs_slot(live, tok, &held)) {
+			proc[live].i = next;
+			if (jobs_start(&proc[live], &job[next], argv, n_sh))
+				++live;
+			else
+				ok = false;
+			++next;
+		}
+
+		// Tokens which won't be used go back right away
+		if (next == n)
+			jobs_release(tok, &held, live ? (unsigned)live - 1U : 0U);
+
+		if (!live)
+			break;
+
+		size_t n_pfd = 0U;
+		for (; n_pfd < live; ++n_pfd)
+			pfd[n_pfd] = (struct pollfd){.fd = proc[n_pfd].fd, .events = POLLIN};
+		if (next < n && live < cap && jobs_srv.rfd >= 0)
+			pfd[n_pfd++] = (struct pollfd){.fd = jobs_srv.rfd, .events = POLLIN};
+
+		if (poll(pfd, n_pfd, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("poll");
+			ok = false;
+			break;
+		}
+
+		for (size_t k = live; k--; ) {
+			if (!pfd[k].revents)
+				continue;
+
+			struct jobs_proc *const p = &proc[k];
+			if (jobs_read(p, &job[p->i]))
+				continue;
+
+			jobs_reap(p, &job[p->i]);
+			*p = proc[--live];
+		}
+	}
+
+	// Only reached early if poll() failed
+	for (size_t k = 0; k < live; ++k)
+		jobs_reap(&proc[k], &job[proc[k].i]);
+	jobs_release(tok, &held, 0U);
+
+	free(pfd);
+	free(proc);
+	free(argv);
+	return ok;
+}
@@ -0,0 +1,57 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/** @file jobs.h
+ * @brief Concurrent shell commands within make's job limit
+ * @author Juuso Alasuutari
+ */
+#ifndef DEEM_SRC_JOBS_H_
+#define DEEM_SRC_JOBS_H_
+
+#include <stddef.h>
+
+#include "compat.h"
+#include "util.h"
+
+/** @brief Upper limit of commands running at once
+ */
+#define JOBS_MAX 64U
+
+/** @brief A shell command and its results
+ */
+struct job {
+	char const *cmd;    //< Command line
+	char       *out;    //< Standard output, released with `free()`
+	size_t      n_out;  //< Length of the output in bytes
+	int         status; //< Exit status, or 127 if it didn't run
+};
+
+/**
+ * @brief Get the job limit of make.
+ * @return The `-j` count, or 1 if there's none. Without a count it's
+ *         the number of CPUs, at most @ref JOBS_MAX.
+ */
+extern unsigned
+jobs_limit (void);
+
+/**
+ * @brief Run shell commands concurrently.
+ *
+ * Besides the slot of the make process itself, each running command
+ * takes a token from make's jobserver. If there is no jobserver, as
+ * while the top-level make parses its makefiles, the number of slots
+ * comes from the `-j` option. Tokens are returned as soon as they're
+ * not needed.
+ *
+ * @param job The commands. Each gets its own output and status.
+ * @param n Number of commands.
+ * @param sh The shell and its flags, e.g. `{"/bin/sh", "-c"}`. The
+ *           command line is passed as the last argument.
+ * @param n_sh Number of elements in `sh`.
+ * @return `true` if all of the commands were run, `false` otherwise.
+ */
+extern bool
+jobs_run (struct job        *job,
+          size_t             n,
+          char const *const *sh,
+          size_t             n_sh) nonnull_in();
+
+#endif /* DEEM_SRC_JOBS_H_ */
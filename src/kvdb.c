@@ -0,0 +1,314 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/** @file kvdb.c
+ *
+ * @author Juuso Alasuutari
+ */
+#ifndef _GNU_SOURCE
+# define _GNU_SOURCE
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "kvdb.h"
+#include "memo.h"
+
+/** @brief File signature, also the format version
+ */
+static char const kvdb_magic[8] = "deemkv1\n";
+
+/** @brief Record header
+ *
+ * Followed by the key, the value, a null byte, and padding up to the
+ * next multiple of 8 bytes.
+ */
+struct kvdb_rec {
+	uint64_t hash;
+	uint32_t klen;
+	uint32_t vlen;
+};
+
+static const_inline size_t
+kvdb_rec_size (size_t const klen,
+               size_t const vlen)
+{
+	return (sizeof(struct kvdb_rec) + klen + vlen + 1U + 7U) & ~(size_t)7U;
+}
+
+static force_inline struct kvdb_rec
+kvdb_rec_at (struct kvdb const *const db,
+             size_t const             off)
+{
+	struct kvdb_rec rec;
+	__builtin_memcpy(&rec, &db->map[off], sizeof rec);
+	return rec;
+}
+
+/** @brief Find the index slot of a key, or the empty slot where it goes.
+ */
+static size_t *
+kvdb_slot (struct kvdb const *const db,
+           void const *const        key,
+           size_t const             n,
+           uint64_t const           hash)
+{
+	size_t const mask = db->n_slot - 1U;
+	for (size_t i = hash & mask;; i = (i + 1U) & mask) {
+		size_t *const s = &db->slot[i];
+		if (!*s)
+			return s;
+
+		struct kvdb_rec const rec = kvdb_rec_at(db, *s);
+		if (rec.hash == hash && rec.klen == n &&
+		    !memcmp(&db->map[*s + sizeof rec], key, n))
+			return s;
+	}
+}
+
+static bool
+kvdb_grow (struct kvdb *const db)
+{
+	size_t const n = db->n_slot ? db->n_slot * 2U : 256U;
+	size_t *const slot = calloc(n, sizeof *slot);
+	if (!slot) {
+		perror("calloc");
+		return false;
+	}
+
+	size_t *const old = db->slot;
+	size_t const n_old = db->n_slot;
+	db->slot = slot;
+	db->n_slot = n;
+
+	for (size_t i = 0; i < n_old; ++i) {
+		if (old[i]) {
+			struct kvdb_rec const rec = kvdb_rec_at(db, old[i]);
+			*kvdb_slot(db, &db->map[old[i] + sizeof rec], rec.klen,
+			           rec.hash) = old[i];
+		}
+	}
+
+	free(old);
+	return true;
+}
+
+static void
+kvdb_unindex (struct kvdb *const db)
+{
+	if (db->slot)
+		(void)memset(db->slot, 0, db->n_slot * sizeof *db->slot);
+	db->cnt = 0U;
+	db->end = 0U;
+}
+
+/** @brief Add the records after the indexed ones to the index.
+ *
+ * Stop at the first record which doesn't fit, e.g. a partial record
+ * left by an interrupted write.
+ */
+static bool
+kvdb_index (struct kvdb *const db)
+{
+	// Start over if the file was cleared by someone else
+	if (db->end > db->size)
+		kvdb_unindex(db);
+
+	size_t off = db->end ? db->end : sizeof kvdb_magic;
+	while (db->size - off >= sizeof(struct kvdb_rec)) {
+		struct kvdb_rec const rec = kvdb_rec_at(db, off);
+		size_t const size = kvdb_rec_size(rec.klen, rec.vlen);
+		if (size > db->size - off)
+			break;
+
+		if ((db->cnt + 1U) * 2U > db->n_slot && !kvdb_grow(db))
+			return false;
+
+		size_t *const s = kvdb_slot(db, &db->map[off + sizeof rec],
+		                            rec.klen, rec.hash);
+		db->cnt += !*s;
+		*s = off;
+		off += size;
+	}
+
+	db->end = off;
+	return true;
+}
+
+static bool
+kvdb_map (struct kvdb *const db)
+{
+	if (db->map) {
+		(void)munmap((void *)db->map, db->size);
+		db->map = nullptr;
+		db->size = 0U;
+	}
+
+	struct stat st;
+	if (fstat(db->fd, &st)) {
+		perror("fstat");
+		return false;
+	}
+
+	if ((size_t)st.st_size <= sizeof kvdb_magic) {
+		kvdb_unindex(db);
+		return true;
+	}
+
+	void *map = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_SHARED,
+	                 db->fd, 0);
+	if (map == MAP_FAILED) {
+		perror("mmap");
+		return false;
+	}
+
+	db->map = map;
+	db->size = (size_t)st.st_size;
+	return kvdb_index(db);
+}
+
+/**
+ * @brief Replace a log with an empty one.
+ *
+ * The new log is written to a temporary file and renamed into place.
+ * Other processes may have the old file mapped, and truncating it
+ * would make their next lookup fault. They keep the old file until
+ * they open the log again.
+ *
+ * @return The descriptor of the new log, or -1 on failure.
+ */
+static int
+kvdb_reset (char const *const path)
+{
+	char tmp[PATH_MAX];
+	if ((size_t)snprintf(tmp, sizeof tmp, "%s.XXXXXX", path) >= sizeof tmp) {
+		(void)fprintf(stderr, "%s: %s\n", path, strerror(ENAMETOOLONG));
+		return -1;
+	}
+
+	int fd = mkostemp(tmp, O_APPEND | O_CLOEXEC);
+	if (fd < 0) {
+		(void)fprintf(stderr, "%s: %s\n", tmp, strerror(errno));
+		return -1;
+	}
+
+	if (fchmod(fd, 0644) ||
+	    write(fd, kvdb_magic, sizeof kvdb_magic) != (ssize_t)sizeof kvdb_magic ||
+	    rename(tmp, path)) {
+		(void)fprintf(stderr, "%s: %s\n", path, strerror(errno));
+		(void)unlink(tmp);
+		(void)close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+bool
+kvdb_open (struct kvdb *const db,
+           char const *const  path)
+{
+	*db = (struct kvdb){.fd = -1, .map = nullptr, .size = 0U};
+
+	int fd = open(path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+	if (fd < 0) {
+		(void)fprintf(stderr, "%s: %s\n", path, strerror(errno));
+		return false;
+	}
+
+	struct stat st;
+	char magic[sizeof kvdb_magic];
+	if (fstat(fd, &st) ||
+	    (size_t)st.st_size < sizeof magic ||
+	    (size_t)st.st_size > KVDB_MAX ||
+	    pread(fd, magic, sizeof magic, 0) != (ssize_t)sizeof magic ||
+	    memcmp(magic, kvdb_magic, sizeof magic)) {
+		(void)close(fd);
+		fd = kvdb_reset(path);
+		if (fd < 0)
+			return false;
+	}
+
+	db->fd = fd;
+	if (!kvdb_map(db)) {
+		kvdb_close(db);
+		return false;
+	}
+
+	return true;
+}
+
+void
+kvdb_close (struct kvdb *const db)
+{
+	if (db->map)
+		(void)munmap((void *)db->map, db->size);
+	if (db->fd >= 0)
+		(void)close(db->fd);
+
+	free(db->slot);
+	*db = (struct kvdb){.fd = -1, .map = nullptr, .size = 0U};
+}
+
+bool
+kvdb_get (struct kvdb const *const db,
+          void const *const        key,
+          size_t const             n,
+          char const **const       val,
+          size_t *const            vn)
+{
+	if (!db->cnt)
+		return false;
+
+	size_t const off = *kvdb_slot(db, key, n, memo_hash(key, n));
+	if (!off)
+		return false;
+
+	struct kvdb_rec const rec = kvdb_rec_at(db, off);
+	*val = (char const *)&db->map[off + sizeof rec + n];
+	*vn = rec.vlen;
+	return true;
+}
+
+bool
+kvdb_put (struct kvdb *const db,
+          void const *const  key,
+          size_t const       n,
+          void const *const  val,
+          size_t const       vn)
+{
+	if (db->fd < 0 || n > UINT32_MAX || vn > UINT32_MAX)
+		return false;
+
+	size_t const size = kvdb_rec_size(n, vn);
+	unsigned char *const rec = calloc(1U, size);
+	if (!rec) {
+		perror("calloc");
+		return false;
+	}
+
+	struct kvdb_rec const hdr = {
+		.hash = memo_hash(key, n),
+		.klen = (uint32_t)n,
+		.vlen = (uint32_t)vn
+	};
+	__builtin_memcpy(rec, &hdr, sizeof hdr);
+	__builtin_memcpy(&rec[sizeof hdr], key, n);
+	__builtin_memcpy(&rec[sizeof hdr + n], val, vn);
+
+	// A single write so that concurrent appenders don't interleave
+	ssize_t w = write(db->fd, rec, size);
+	free(rec);
+	if (w != (ssize_t)size) {
+		perror("write");
+		return false;
+	}
+
+	return kvdb_map(db);
+}
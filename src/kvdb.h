@@ -0,0 +1,91 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/** @file kvdb.h
+ * @brief Persistent memory-mapped key-value log
+ * @author Juuso Alasuutari
+ */
+#ifndef DEEM_SRC_KVDB_H_
+#define DEEM_SRC_KVDB_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "compat.h"
+#include "util.h"
+
+/** @brief Key-value log file
+ *
+ * Records are only ever appended, and a later record overrides an
+ * earlier one with the same key. Lookups read the file through a
+ * read-only mapping which is refreshed after each append, and find
+ * the latest record of a key through an in-memory index. A file
+ * which has grown past @ref KVDB_MAX when it is opened is replaced
+ * with an empty one to drop stale records.
+ */
+struct kvdb {
+	int                  fd;   //< File descriptor, -1 if not open
+	unsigned char const *map;  //< File contents, or `nullptr`
+	size_t               size; //< Size of the mapping in bytes
+	size_t              *slot; //< Hash index of record offsets, 0 if empty
+	size_t               n_slot;
+	size_t               cnt;  //< Number of keys in the index
+	size_t               end;  //< End of the indexed records
+};
+
+/** @brief File size above which the log is cleared when opened
+ */
+#define KVDB_MAX (4U << 20U)
+
+/**
+ * @brief Open or create a key-value log.
+ *
+ * @param db The log object.
+ * @param path The file path.
+ * @return `true` on success, `false` otherwise.
+ */
+extern bool
+kvdb_open (struct kvdb *db,
+           char const  *path) nonnull_in();
+
+/**
+ * @brief Close a key-value log.
+ * @param db The log object.
+ */
+extern void
+kvdb_close (struct kvdb *db) nonnull_in();
+
+/**
+ * @brief Look up the most recent value for a key.
+ *
+ * @param db The log object.
+ * @param key The key bytes.
+ * @param n The key length in bytes.
+ * @param val Receives the null-terminated value. It points into the
+ *            mapping, and is only valid until the next @ref kvdb_put().
+ * @param vn Receives the value length in bytes.
+ * @return `true` if the key was found, `false` otherwise.
+ */
+extern bool
+kvdb_get (struct kvdb const *db,
+          void const        *key,
+          size_t             n,
+          char const       **val,
+          size_t            *vn) nonnull_in(1, 4, 5);
+
+/**
+ * @brief Append a record.
+ *
+ * @param db The log object.
+ * @param key The key bytes.
+ * @param n The key length in bytes.
+ * @param val The value bytes.
+ * @param vn The value length in bytes.
+ * @return `true` on success, `false` otherwise.
+ */
+extern bool
+kvdb_put (struct kvdb *db,
+          void const  *key,
+          size_t       n,
+          void const  *val,
+          size_t       vn) nonnull_in(1);
+
+#endif /* DEEM_SRC_KVDB_H_ */
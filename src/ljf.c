@@ -0,0 +1,286 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/** @file ljf.c
+ *
+ * @author Juuso Alasuutari
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "ljf.h"
+
+int
+ljf_rank_cmp (void const *const a,
+              void const *const b)
+{
+	struct ljf_rank const *const x = a, *const y = b;
+	if (x->t != y->t)
+		return x->t < y->t ? 1 : -1;
+	return (x->i > y->i) - (x->i < y->i);
+}
+
+uint64_t
+ljf_time (struct ljf const *const l,
+          char const *const       name)
+{
+	char const *val;
+	size_t vn;
+	uint64_t t;
+	if (l->db.fd < 0
+	    || !kvdb_get(&l->db, name, strlen(name), &val, &vn)
+	    || vn != sizeof t)
+		return UINT64_MAX;
+
+	__builtin_memcpy(&t, val, sizeof t);
+	return t;
+}
+
+static struct ljf_target const *
+ljf_find (struct ljf const *const l,
+          char const *const       name)
+{
+	for (size_t i = l->n_tgt; i--; ) {
+		if (!strcmp(l->tgt[i].name, name))
+			return &l->tgt[i];
+	}
+	return nullptr;
+}
+
+/**
+ * @brief Estimate the critical path of a link target.
+ *
+ * @param l The durations.
+ * @param t The target, or `nullptr`.
+ * @param name Name of the target.
+ * @param slow Receives the slowest object, or `nullptr`.
+ * @return The estimate in microseconds, `UINT64_MAX` if nothing on
+ *         the path has a recorded duration.
+ */
+static uint64_t
+ljf_path (struct ljf const *const        l,
+          struct ljf_target const *const t,
+          char const *const              name,
+          char const **const             slow)
+{
+	uint64_t max = 0U, link = ljf_time(l, name);
+	bool known = link != UINT64_MAX;
+	*slow = nullptr;
+
+	for (size_t i = 0; t && i < t->n_pre; ++i) {
+		uint64_t const d = ljf_time(l, t->pre[i]);
+		if (d == UINT64_MAX)
+			continue;
+		known = true;
+		if (!*slow || d > max) {
+			max = d;
+			*slow = t->pre[i];
+		}
+	}
+
+	if (!known)
+		return UINT64_MAX;
+	return max + (link == UINT64_MAX ? 0U : link);
+}
+
+static char const *
+ljf_dup (struct ljf *const l,
+         char const *const s)
+{
+	size_t const size = strlen(s) + 1U;
+	char *const ret = arena_alloc(&l->mem, size);
+	if (ret)
+		__builtin_memcpy(ret, s, size);
+	else
+		perror("arena_alloc");
+	return ret;
+}
+
+/** @brief Remember the sorted prerequisites of a target.
+ */
+static bool
+ljf_keep (struct ljf *const        l,
+          char const *const        name,
+          char const *const *const w,
+          size_t const             n)
+{
+	struct ljf_target *const tgt = realloc(l->tgt, (l->n_tgt + 1U)
+	                                       * sizeof *tgt);
+	if (!tgt) {
+		perror("realloc");
+		return false;
+	}
+	l->tgt = tgt;
+
+	char const **const pre = arena_alloc(&l->mem, n * sizeof *pre);
+	char const *const dup = ljf_dup(l, name);
+	if (!pre || !dup)
+		return false;
+
+	for (size_t i = 0; i < n; ++i) {
+		pre[i] = ljf_dup(l, w[i]);
+		if (!pre[i])
+			return false;
+	}
+
+	tgt[l->n_tgt++] = (struct ljf_target){
+		.name  = dup,
+		.pre   = pre,
+		.n_pre = n
+	};
+	return true;
+}
+
+bool
+ljf_order (struct ljf *const  l,
+           char const *const  name,
+           char const **const w,
+           size_t const       n)
+{
+	if (n < 2U)
+		return !name || ljf_keep(l, name, w, n);
+
+	struct ljf_rank *const r = malloc(n * sizeof *r);
+	char const **const tmp = r ? malloc(n * sizeof *tmp) : nullptr;
+	if (!tmp) {
+		perror("malloc");
+		free(r);
+		return false;
+	}
+
+	for (size_t i = 0; i < n; ++i)
+		r[i] = (struct ljf_rank){ljf_time(l, w[i]), i};
+	qsort(r, n, sizeof *r, ljf_rank_cmp);
+
+	for (size_t i = 0; i < n; ++i)
+		tmp[i] = w[r[i].i];
+	__builtin_memcpy(w, tmp, n * sizeof *w);
+	free(tmp);
+	free(r);
+
+	return !name || ljf_keep(l, name, w, n);
+}
+
+bool
+ljf_hold (struct ljf *const l,
+          char const *const name,
+          char const *const target)
+{
+	struct ljf_goal *const g = realloc(l->goal, (l->n_goal + 1U)
+	                                   * sizeof *g);
+	if (!g) {
+		perror("realloc");
+		return false;
+	}
+	l->goal = g;
+
+	g[l->n_goal] = (struct ljf_goal){
+		.name   = ljf_dup(l, name),
+		.target = ljf_dup(l, target)
+	};
+	if (!g[l->n_goal].name || !g[l->n_goal].target)
+		return false;
+
+	++l->n_goal;
+	return true;
+}
+
+char *
+ljf_goals (struct ljf *const l,
+           char const *const pfx)
+{
+	size_t const n = l->n_goal;
+	if (!n)
+		return nullptr;
+	l->n_goal = 0U;
+
+	struct ljf_rank *const r = malloc(n * sizeof *r);
+	size_t size = strlen(pfx) + 1U;
+	for (size_t i = 0; r && i < n; ++i) {
+		struct ljf_goal const *const g = &l->goal[i];
+		char const *slow;
+		r[i] = (struct ljf_rank){
+			.t = ljf_path(l, ljf_find(l, g->target), g->target, &slow),
+			.i = i
+		};
+		size += strlen(g->name) + 1U;
+	}
+
+	char *const ret = r ? malloc(size) : nullptr;
+	if (!ret) {
+		perror("malloc");
+		free(r);
+		return nullptr;
+	}
+
+	qsort(r, n, sizeof *r, ljf_rank_cmp);
+	char *p = stpcpy(ret, pfx);
+	for (size_t i = 0; i < n; ++i) {
+		*p++ = ' ';
+		p = stpcpy(p, l->goal[r[i].i].name);
+	}
+
+	free(r);
+	return ret;
+}
+
+void
+ljf_record (struct ljf *const l,
+            char const *const name,
+            uint64_t const    dur)
+{
+	if (l->db.fd < 0)
+		return;
+
+	uint64_t t = ljf_time(l, name);
+	t = t == UINT64_MAX ? dur : t / 2U + dur / 2U;
+	(void)kvdb_put(&l->db, name, strlen(name), &t, sizeof t);
+}
+
+void
+ljf_report (struct ljf const *const l,
+            FILE *const             f)
+{
+	struct ljf_rank *const r = malloc((l->n_tgt + 1U) * sizeof *r);
+	if (!r) {
+		perror("malloc");
+		return;
+	}
+
+	size_t n = 0U;
+	for (size_t i = 0; i < l->n_tgt; ++i) {
+		struct ljf_target const *const t = &l->tgt[i];
+		char const *slow;
+		if (ljf_find(l, t->name) == t)
+			r[n++] = (struct ljf_rank){ljf_path(l, t, t->name, &slow), i};
+	}
+	qsort(r, n, sizeof *r, ljf_rank_cmp);
+
+	for (size_t k = 0; k < n; ++k) {
+		struct ljf_target const *const t = &l->tgt[r[k].i];
+		if (r[k].t == UINT64_MAX) {
+			(void)fprintf(f, "ljf: %s: no recorded durations\n", t->name);
+			continue;
+		}
+
+		char const *slow;
+		uint64_t const path = ljf_path(l, t, t->name, &slow);
+		uint64_t const link = ljf_time(l, t->name);
+		uint64_t work = link == UINT64_MAX ? 0U : link;
+		for (size_t i = 0; i < t->n_pre; ++i) {
+			uint64_t const d = ljf_time(l, t->pre[i]);
+			work += d == UINT64_MAX ? 0U : d;
+		}
+
+		(void)fprintf(f, "ljf: %s: critical path %.3f s", t->name,
+		              (double)path / 1e6);
+		if (slow)
+			(void)fprintf(f, " = %s %.3f s", slow,
+			              (double)ljf_time(l, slow) / 1e6);
+		if (link != UINT64_MAX)
+			(void)fprintf(f, "%s link %.3f s", slow ? " +" : " =",
+			              (double)link / 1e6);
+		(void)fprintf(f, ", %zu objects, %.3f s of work\n",
+		              t->n_pre, (double)work / 1e6);
+	}
+
+	free(r);
+}
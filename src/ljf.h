@@ -0,0 +1,150 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/** @file ljf.h
+ * @brief Longest-job-first ordering from recorded job durations
+ * @author Juuso Alasuutari
+ */
+#ifndef DEEM_SRC_LJF_H_
+#define DEEM_SRC_LJF_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "compat.h"
+#include "kvdb.h"
+#include "str.h"
+#include "util.h"
+
+/** @brief Link target and its objects, see @ref ljf_order()
+ */
+struct ljf_target {
+	char const        *name;
+	char const *const *pre;   //< Prerequisites, slowest first
+	size_t             n_pre;
+};
+
+/** @brief Goal held back by @ref ljf_hold()
+ */
+struct ljf_goal {
+	char const *name;
+	char const *target; //< The link target the goal depends on
+};
+
+/** @brief Sort key of a prerequisite or goal
+ */
+struct ljf_rank {
+	uint64_t t; //< Duration, `UINT64_MAX` if unknown
+	size_t   i; //< Original position
+};
+
+/**
+ * @brief Compare sort keys, slowest first.
+ *
+ * Ties keep their original order, so `qsort()` with this is stable.
+ */
+extern int
+ljf_rank_cmp (void const *a,
+              void const *b) nonnull_in();
+
+/** @brief Recorded durations and the targets and goals to order
+ *
+ * Initialize with `{.db = {.fd = -1}}` and open the durations with
+ * @ref kvdb_open(). Without them every target is assumed to be slow.
+ */
+struct ljf {
+	struct kvdb        db;     //< Durations of targets in microseconds
+	struct arena       mem;    //< Storage of the names
+	struct ljf_target *tgt;
+	size_t             n_tgt;
+	struct ljf_goal   *goal;
+	size_t             n_goal;
+};
+
+/**
+ * @brief Look up the recorded duration of a target.
+ *
+ * @param l The durations.
+ * @param name Name of the target.
+ * @return The duration in microseconds, `UINT64_MAX` if unknown.
+ */
+extern uint64_t
+ljf_time (struct ljf const *l,
+          char const       *name) nonnull_in();
+
+/**
+ * @brief Sort the prerequisites of a target slowest first.
+ *
+ * The sort is stable, and prerequisites without a recorded duration
+ * come first. The order is remembered for @ref ljf_goals() and
+ * @ref ljf_report().
+ *
+ * @param l The durations.
+ * @param name Name of the target, or `nullptr` to only sort.
+ * @param w The prerequisites, sorted in place.
+ * @param n Number of prerequisites.
+ * @return `true` on success, `false` if memory allocation fails.
+ */
+extern bool
+ljf_order (struct ljf   *l,
+           char const   *name,
+           char const  **w,
+           size_t        n) nonnull_in(1);
+
+/**
+ * @brief Hold back a goal until @ref ljf_goals().
+ *
+ * @param l The durations.
+ * @param name The goal.
+ * @param target The link target the goal depends on.
+ * @return `true` on success, `false` if memory allocation fails.
+ */
+extern bool
+ljf_hold (struct ljf *l,
+          char const *name,
+          char const *target) nonnull_in();
+
+/**
+ * @brief Take the held back goals in order of critical path.
+ *
+ * The critical path of a target is estimated as its slowest object
+ * plus the link, since the objects are built in parallel and the link
+ * after all of them. Goals whose path has no recorded durations come
+ * first.
+ *
+ * @param l The durations.
+ * @param pfx Text in front of the goals.
+ * @return `pfx` followed by the goals, each after a space, or `nullptr`
+ *         if there are none or memory allocation fails. Release with
+ *         `free()`.
+ */
+extern char *
+ljf_goals (struct ljf *l,
+           char const *pfx) nonnull_in();
+
+/**
+ * @brief Record the duration of a target.
+ *
+ * A target which already has a duration gets the mean of the old and
+ * the new one, which smooths out the odd slow or cached run.
+ *
+ * @param l The durations.
+ * @param name Name of the target.
+ * @param dur The duration in microseconds.
+ */
+extern void
+ljf_record (struct ljf *l,
+            char const *name,
+            uint64_t    dur) nonnull_in();
+
+/**
+ * @brief Print the estimated critical path of each sorted target,
+ *        longest first.
+ *
+ * @param l The durations.
+ * @param f The output stream.
+ */
+extern void
+ljf_report (struct ljf const *l,
+            FILE             *f) nonnull_in();
+
+#endif /* DEEM_SRC_LJF_H_ */
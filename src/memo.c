@@ -0,0 +1,156 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/** @file memo.c
+ *
+ * @author Juuso Alasuutari
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "memo.h"
+
+/** @brief Initial number of slots
+ */
+#define MEMO_MIN 256U
+
+static const_inline uint64_t
+memo_mix (uint64_t h)
+{
+	h ^= h >> 30U;
+	h *= UINT64_C(0xbf58476d1ce4e5b9);
+	h ^= h >> 27U;
+	h *= UINT64_C(0x94d049bb133111eb);
+	return h ^ (h >> 31U);
+}
+
+uint64_t
+memo_hash (void const *const ptr,
+           size_t              n)
+{
+	unsigned char const *p = ptr;
+	uint64_t h = UINT64_C(0x9e3779b97f4a7c15) ^ n;
+	uint64_t w;
+
+	for (; n >= sizeof w; n -= sizeof w, p += sizeof w) {
+		__builtin_memcpy(&w, p, sizeof w);
+		h = (h ^ w) * UINT64_C(0xff51afd7ed558ccd);
+		h ^= h >> 32U;
+	}
+
+	w = 0U;
+	__builtin_memcpy(&w, p, n);
+	return memo_mix(h ^ w);
+}
+
+static force_inline bool
+memo_eq (struct memo_ent const *const e,
+         char const *const            key,
+         size_t const                 n,
+         uint64_t const               hash)
+{
+	return e->hash == hash && e->klen == n && !memcmp(e->key, key, n);
+}
+
+/** @brief Find the slot of a key, or the empty slot where it goes.
+ */
+static struct memo_ent *
+memo_slot (struct memo_ent *const tab,
+           size_t const           cap,
+           char const *const      key,
+           size_t const           n,
+           uint64_t const         hash)
+{
+	size_t mask = cap - 1U;
+	for (size_t i = hash & mask;; i = (i + 1U) & mask) {
+		struct memo_ent *const e = &tab[i];
+		if (!e->key || memo_eq(e, key, n, hash))
+			return e;
+	}
+}
+
+struct memo_ent const *
+memo_find (struct memo *const m,
+           char const *const  key,
+           size_t const       n,
+           uint64_t const     hash)
+{
+	if (m->cnt) {
+		struct memo_ent const *const e =
+			memo_slot(m->tab, m->cap, key, n, hash);
+		if (e->key) {
+			++m->hits;
+			return e;
+		}
+	}
+
+	++m->misses;
+	return nullptr;
+}
+
+static bool
+memo_grow (struct memo *const m)
+{
+	size_t cap = m->cap ? m->cap * 2U : MEMO_MIN;
+	struct memo_ent *const tab = calloc(cap, sizeof *tab);
+	if (!tab) {
+		perror("calloc");
+		return false;
+	}
+
+	for (size_t i = 0; i < m->cap; ++i) {
+		struct memo_ent const *const e = &m->tab[i];
+		if (e->key)
+			*memo_slot(tab, cap, e->key, e->klen, e->hash) = *e;
+	}
+
+	free(m->tab);
+	m->tab = tab;
+	m->cap = cap;
+	return true;
+}
+
+char const *
+memo_key (struct memo *const m,
+          char const *const  key,
+          size_t const       n)
+{
+	char *const ret = arena_alloc(&m->mem, n + 1U);
+	if (ret) {
+		__builtin_memcpy(ret, key, n);
+		ret[n] = '\0';
+	}
+	return ret;
+}
+
+bool
+memo_insert (struct memo *const m,
+             char const *const  key,
+             size_t const       klen,
+             uint64_t const     hash,
+             char const *const  val,
+             size_t const       vlen)
+{
+	if ((m->cnt + 1U) * 4U > m->cap * 3U && !memo_grow(m))
+		return false;
+
+	struct memo_ent *const e = memo_slot(m->tab, m->cap, key, klen, hash);
+	if (e->key)
+		return true;
+
+	char *const v = arena_alloc(&m->mem, vlen + 1U);
+	if (!v)
+		return false;
+
+	__builtin_memcpy(v, val, vlen);
+	v[vlen] = '\0';
+
+	*e = (struct memo_ent){
+		.hash = hash,
+		.key  = key,
+		.klen = klen,
+		.val  = v,
+		.vlen = vlen
+	};
+	++m->cnt;
+	return true;
+}
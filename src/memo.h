@@ -0,0 +1,106 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/** @file memo.h
+ * @brief Open-addressing hash table for memoized expansions
+ * @author Juuso Alasuutari
+ */
+#ifndef DEEM_SRC_MEMO_H_
+#define DEEM_SRC_MEMO_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "compat.h"
+#include "str.h"
+#include "util.h"
+
+/** @brief Hash table entry
+ *
+ * An entry is empty if `key` is null.
+ */
+struct memo_ent {
+	uint64_t    hash; //< Hash of the key
+	char const *key;  //< Key bytes
+	size_t      klen; //< Key length in bytes
+	char const *val;  //< Null-terminated value
+	size_t      vlen; //< Value length in bytes
+};
+
+/** @brief Memoization table
+ *
+ * Keys and values are copied into `mem` and live as long as the
+ * table. Collisions are resolved by linear probing, and the table
+ * doubles in size when it is three quarters full.
+ */
+struct memo {
+	struct memo_ent *tab;    //< Slots
+	size_t           cap;    //< Number of slots, a power of 2
+	size_t           cnt;    //< Number of entries
+	size_t           hits;   //< Successful lookups
+	size_t           misses; //< Failed lookups
+	struct arena     mem;    //< Key and value storage
+};
+
+/**
+ * @brief Hash a byte string.
+ * @param ptr The bytes to hash.
+ * @param n The number of bytes.
+ * @return A 64-bit hash.
+ */
+extern uint64_t
+memo_hash (void const *ptr,
+           size_t      n);
+
+/**
+ * @brief Look up a key and update the hit and miss counters.
+ *
+ * @param m The table.
+ * @param key The key bytes.
+ * @param n The key length in bytes.
+ * @param hash The hash of the key from @ref memo_hash().
+ * @return The entry, or `nullptr` if the key isn't in the table.
+ */
+extern struct memo_ent const *
+memo_find (struct memo *m,
+           char const  *key,
+           size_t       n,
+           uint64_t     hash) nonnull_in(1);
+
+/**
+ * @brief Copy a key into table storage.
+ *
+ * This makes it possible to hold on to a key while the table is used
+ * recursively, for example while the value is being expanded.
+ *
+ * @param m The table.
+ * @param key The key bytes.
+ * @param n The key length in bytes.
+ * @return The null-terminated copy, or `nullptr` on failure.
+ */
+extern char const *
+memo_key (struct memo *m,
+          char const  *key,
+          size_t       n) nonnull_in(1);
+
+/**
+ * @brief Add an entry.
+ *
+ * The key must already be in table storage, see @ref memo_key(). The
+ * value is copied. If the key is already present its value is kept.
+ *
+ * @param m The table.
+ * @param key The key from @ref memo_key().
+ * @param klen The key length in bytes.
+ * @param hash The hash of the key.
+ * @param val The value.
+ * @param vlen The value length in bytes.
+ * @return `true` on success, `false` if memory allocation failed.
+ */
+extern bool
+memo_insert (struct memo *m,
+             char const  *key,
+             size_t       klen,
+             uint64_t     hash,
+             char const  *val,
+             size_t       vlen) nonnull_in(1, 2);
+
+#endif /* DEEM_SRC_MEMO_H_ */
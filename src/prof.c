@@ -0,0 +1,136 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/** @file prof.c
+ *
+ * @author Juuso Alasuutari
+ */
+#include <inttypes.h>
+
+#include "prof.h"
+#include "str.h"
+
+bool prof_on;
+
+static const_inline unsigned
+prof_bin (uint64_t const ns)
+{
+	if (ns < (1U << PROF_SUB_BITS))
+		return (unsigned)ns;
+
+	unsigned const e = 63U - (unsigned)__builtin_clzll(ns);
+	unsigned const m = (unsigned)(ns >> (e - PROF_SUB_BITS))
+	                 & ((1U << PROF_SUB_BITS) - 1U);
+	return ((e - PROF_SUB_BITS + 1U) << PROF_SUB_BITS) | m;
+}
+
+/** @brief Get the smallest latency which falls into a bucket.
+ */
+static const_inline uint64_t
+prof_bin_min (unsigned const bin)
+{
+	if (bin < (1U << PROF_SUB_BITS))
+		return bin;
+
+	unsigned const e = (bin >> PROF_SUB_BITS) + PROF_SUB_BITS - 1U;
+	uint64_t const m = bin & ((1U << PROF_SUB_BITS) - 1U);
+	return ((UINT64_C(1) << PROF_SUB_BITS) | m) << (e - PROF_SUB_BITS);
+}
+
+void
+prof_add (struct prof_site *const s,
+          uint64_t const          t0,
+          size_t const            in,
+          size_t const            out)
+{
+	uint64_t const ns = prof_now() - t0;
+	++s->calls;
+	s->in += in;
+	s->out += out;
+	s->ns += ns;
+	if (ns > s->max)
+		s->max = ns;
+	++s->bin[prof_bin(ns)];
+}
+
+/**
+ * @brief Find a percentile in a histogram.
+ * @param s The call site.
+ * @param pct The percentile.
+ * @return The lower bound of the bucket in nanoseconds.
+ */
+static uint64_t
+prof_pct (struct prof_site const *const s,
+          unsigned const                pct)
+{
+	uint64_t const rank = (s->calls * pct + 99U) / 100U;
+	uint64_t sum = 0U;
+	for (unsigned i = 0; i < PROF_BINS; ++i) {
+		sum += s->bin[i];
+		if (sum >= rank && sum)
+			return prof_bin_min(i);
+	}
+
+	return s->max;
+}
+
+void
+prof_report (FILE *const                          f,
+             struct prof_site const *const *const site,
+             size_t const                         n,
+             bool const                           json)
+{
+	static unsigned const pct[] = {50U, 90U, 99U};
+	bool first = true;
+
+	if (json)
+		(void)fputs("{\"functions\": [", f);
+	else
+		(void)fprintf(f, "%-16s %9s %12s %12s %10s %9s %9s %9s %9s\n",
+		              "prof", "calls", "bytes in", "bytes out",
+		              "total ms", "p50 us", "p90 us", "p99 us",
+		              "max us");
+
+	for (size_t i = 0; i < n; ++i) {
+		struct prof_site const *const s = site[i];
+		if (!s->calls)
+			continue;
+
+		uint64_t p[array_size(pct)];
+		for (size_t k = 0; k < array_size(pct); ++k)
+			p[k] = prof_pct(s, pct[k]);
+
+		if (json) {
+			(void)fprintf(f, "%s\n  {\"name\": \"%s\", \"calls\": %" PRIu64
+			              ", \"bytes_in\": %" PRIu64 ", \"bytes_out\": %"
+			              PRIu64 ", \"ns\": {\"total\": %" PRIu64
+			              ", \"p50\": %" PRIu64 ", \"p90\": %" PRIu64
+			              ", \"p99\": %" PRIu64 ", \"max\": %" PRIu64 "}}",
+			              first ? "" : ",", s->name, s->calls, s->in,
+			              s->out, s->ns, p[0], p[1], p[2], s->max);
+		} else {
+			(void)fprintf(f, "%-16s %9" PRIu64 " %12" PRIu64 " %12" PRIu64
+			              " %10.3f %9.1f %9.1f %9.1f %9.1f\n",
+			              s->name, s->calls, s->in, s->out,
+			              (double)s->ns / 1e6, (double)p[0] / 1e3,
+			              (double)p[1] / 1e3, (double)p[2] / 1e3,
+			              (double)s->max / 1e3);
+		}
+		first = false;
+	}
+
+	struct str_stats const m = {
+		.blocks = __atomic_load_n(&str_stats.blocks, __ATOMIC_RELAXED),
+		.block_bytes = __atomic_load_n(&str_stats.block_bytes, __ATOMIC_RELAXED),
+		.grows = __atomic_load_n(&str_stats.grows, __ATOMIC_RELAXED),
+		.moves = __atomic_load_n(&str_stats.moves, __ATOMIC_RELAXED)
+	};
+
+	if (json)
+		(void)fprintf(f, "\n], \"memory\": {\"arena_blocks\": %zu, "
+		              "\"arena_bytes\": %zu, \"buf_grows\": %zu, "
+		              "\"buf_moves\": %zu}}\n", m.blocks, m.block_bytes,
+		              m.grows, m.moves);
+	else
+		(void)fprintf(f, "memory: %zu arena blocks (%zu bytes) from the "
+		              "heap, %zu buffer grows, %zu moved\n", m.blocks,
+		              m.block_bytes, m.grows, m.moves);
+}
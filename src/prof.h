@@ -0,0 +1,87 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/** @file prof.h
+ * @brief Call counters and latency histograms
+ * @author Juuso Alasuutari
+ */
+#ifndef DEEM_SRC_PROF_H_
+#define DEEM_SRC_PROF_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "compat.h"
+#include "util.h"
+
+/** @brief Sub-buckets per power of two, as a power of two
+ *
+ * Each recorded latency is within 12.5% of its bucket's lower bound.
+ */
+#define PROF_SUB_BITS 3U
+
+/** @brief Number of histogram buckets
+ */
+#define PROF_BINS ((64U - PROF_SUB_BITS + 1U) << PROF_SUB_BITS)
+
+/** @brief Statistics of one instrumented call site
+ */
+struct prof_site {
+	char const *name;           //< Name in the report
+	uint64_t    calls;          //< Number of calls
+	uint64_t    in;             //< Bytes passed in
+	uint64_t    out;            //< Bytes returned
+	uint64_t    ns;             //< Total time, including nested calls
+	uint64_t    max;            //< Longest call in nanoseconds
+	uint32_t    bin[PROF_BINS]; //< Log-linear latency histogram
+};
+
+/** @brief Whether profiling is enabled
+ */
+extern bool prof_on;
+
+/**
+ * @brief Read the monotonic clock.
+ * @return Nanoseconds since an arbitrary point.
+ */
+static force_inline uint64_t
+prof_now (void)
+{
+	struct timespec ts;
+	(void)clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * UINT64_C(1000000000)
+	     + (uint64_t)ts.tv_nsec;
+}
+
+/**
+ * @brief Record a call.
+ *
+ * @param s The call site.
+ * @param t0 Start time from @ref prof_now().
+ * @param in Bytes passed in.
+ * @param out Bytes returned.
+ */
+extern void
+prof_add (struct prof_site *s,
+          uint64_t          t0,
+          size_t            in,
+          size_t            out) nonnull_in();
+
+/**
+ * @brief Write a report of the call sites and of the memory counters
+ *        in @ref str_stats.
+ *
+ * Sites without calls are left out.
+ *
+ * @param f The output stream.
+ * @param site The call sites.
+ * @param n Number of call sites.
+ * @param json Whether to write JSON rather than a text table.
+ */
+extern void
+prof_report (FILE                          *f,
+             struct prof_site const *const *site,
+             size_t                         n,
+             bool                           json) nonnull_in(1);
+
+#endif /* DEEM_SRC_PROF_H_ */
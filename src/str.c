@@ -0,0 +1,204 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/** @file str.c
+ *
+ * @author Juuso Alasuutari
+ */
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "str.h"
+#include "utf8.h"
+
+/** @brief Smallest arena block size in bytes
+ */
+#define ARENA_MIN 4096U
+
+#define ARENA_ALIGN _Alignof(max_align_t)
+
+struct str_stats str_stats;
+
+static struct arena_blk *
+arena_blk (struct arena_blk *const prev,
+           size_t const            cap)
+{
+	size_t size;
+	if (__builtin_add_overflow(sizeof(struct arena_blk), cap, &size)) {
+		(void)fprintf(stderr, "arena: %s\n", strerror(ENOMEM));
+		return nullptr;
+	}
+
+	struct arena_blk *const blk = malloc(size);
+	if (!blk) {
+		perror("malloc");
+		return nullptr;
+	}
+
+	blk->prev = prev;
+	blk->cap = cap;
+	(void)__atomic_fetch_add(&str_stats.blocks, 1U, __ATOMIC_RELAXED);
+	(void)__atomic_fetch_add(&str_stats.block_bytes, cap, __ATOMIC_RELAXED);
+	return blk;
+}
+
+void *
+arena_alloc (struct arena *const a,
+             size_t const        size)
+{
+	size_t off = (a->pos + ARENA_ALIGN - 1U) & ~(ARENA_ALIGN - 1U);
+
+	if (!a->blk || off > a->blk->cap || size > a->blk->cap - off) {
+		size_t cap = a->blk ? a->blk->cap : 0U;
+		if (__builtin_mul_overflow(cap, 2U, &cap))
+			cap = SIZE_MAX - sizeof(struct arena_blk);
+		if (cap < ARENA_MIN)
+			cap = ARENA_MIN;
+		if (cap < size)
+			cap = size;
+
+		struct arena_blk *const blk = arena_blk(a->blk, cap);
+		if (!blk)
+			return nullptr;
+
+		a->blk = blk;
+		off = 0U;
+	}
+
+	a->pos = off + size;
+	a->top = &a->blk->data[off];
+	return a->top;
+}
+
+void *
+arena_resize (struct arena *const a,
+              void *const         ptr,
+              size_t const        old,
+              size_t const        size)
+{
+	if (ptr && ptr == a->top) {
+		size_t off = (size_t)((unsigned char *)ptr - a->blk->data);
+		if (size <= a->blk->cap - off) {
+			a->pos = off + size;
+			return ptr;
+		}
+	}
+
+	void *const ret = arena_alloc(a, size);
+	if (ret && old)
+		__builtin_memcpy(ret, ptr, old < size ? old : size);
+	return ret;
+}
+
+void
+arena_reset (struct arena *const a)
+{
+	struct arena_blk *blk = a->blk;
+	if (blk && blk->prev) {
+		size_t cap = 0U;
+		do {
+			struct arena_blk *const prev = blk->prev;
+			cap += blk->cap;
+			free(blk);
+			blk = prev;
+		} while (blk);
+		a->blk = arena_blk(nullptr, cap);
+	}
+
+	a->pos = 0U;
+	a->top = nullptr;
+}
+
+void
+arena_fini (struct arena *const a)
+{
+	for (struct arena_blk *blk = a->blk; blk; ) {
+		struct arena_blk *const prev = blk->prev;
+		free(blk);
+		blk = prev;
+	}
+
+	*a = (struct arena){nullptr, 0U, nullptr};
+}
+
+bool
+buf_reserve (struct buf *const buf,
+             size_t const      size)
+{
+	size_t need;
+	if (__builtin_add_overflow(buf->str.len.n_bytes, size, &need)) {
+		(void)fprintf(stderr, "buf: %s\n", strerror(EOVERFLOW));
+		return false;
+	}
+
+	if (need <= buf->cap)
+		return true;
+
+	if (!buf->mem)
+		return false;
+
+	size_t cap = buf->cap;
+	if (__builtin_mul_overflow(cap, 2U, &cap) || cap < need)
+		cap = need;
+	if (cap < 64U)
+		cap = 64U;
+
+	char *const ptr = arena_resize(buf->mem, buf->str.mut,
+	                               buf->str.len.n_bytes, cap);
+	if (!ptr)
+		return false;
+
+	(void)__atomic_fetch_add(&str_stats.grows, 1U, __ATOMIC_RELAXED);
+	if (buf->str.mut && ptr != buf->str.mut)
+		(void)__atomic_fetch_add(&str_stats.moves, 1U, __ATOMIC_RELAXED);
+
+	buf->str.mut = ptr;
+	buf->cap = cap;
+	return true;
+}
+
+struct ref
+trim (char const *str)
+{
+	struct ref ret = {
+		.imm = nullptr,
+		.len = {0U, 0U}
+	};
+
+	while (is_space(*str))
+		++str;
+	if (!*str)
+		goto end;
+
+	// The first byte isn't whitespace, so this can't run past it
+	size_t n = strlen(str);
+	while (is_space(str[n - 1U]))
+		--n;
+
+	uint8_t const *const p = (uint8_t const *)str;
+	size_t a = utf8_ascii_span(p, n);
+	size_t c = 0;
+	if (a != n && !utf8_count(&p[a], n - a, &c)) {
+		(void)fprintf(stderr, "UTF-8 error: %s\n", strerror(EILSEQ));
+		goto end;
+	}
+
+	ret.imm = str;
+	ret.len.n_bytes = n;
+	ret.len.n_chars = a + c;
+end:
+	return ret;
+}
+
+struct len
+len (char const *const str)
+{
+	if (str) {
+		struct len r = {strlen(str), 0};
+		if (utf8_count((uint8_t const *)str, r.n_bytes, &r.n_chars))
+			return r;
+		(void)fprintf(stderr, "UTF-8 error: %s\n", strerror(EILSEQ));
+	}
+	return (struct len){0, 0};
+}
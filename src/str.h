@@ -0,0 +1,229 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/** @file str.h
+ * @brief String view and string buffer helpers
+ * @author Juuso Alasuutari
+ */
+#ifndef DEEM_SRC_STR_H_
+#define DEEM_SRC_STR_H_
+
+#include <stddef.h>
+
+#include "compat.h"
+
+/** @brief String length
+ */
+struct len {
+	size_t n_bytes; //< String length in bytes
+	size_t n_chars; //< String length in Unicode characters
+};
+
+extern struct len
+len (char const *str);
+
+/** @brief String pointer + length in bytes + length in code points
+ */
+struct ref {
+	union {
+		char       *mut;
+		char const *imm;
+	};
+	struct len len;
+};
+
+static force_inline struct ref
+ref (char const *const str)
+{
+	return (struct ref){
+		.imm = str,
+		.len = len(str)
+	};
+}
+
+/** @brief Arena memory block
+ */
+struct arena_blk {
+	struct arena_blk *prev; //< Previously filled block, if any
+	size_t            cap;  //< Size of `data` in bytes
+	_Alignas(max_align_t) unsigned char data[];
+};
+
+/** @brief Bump allocator
+ *
+ * Allocations are carved out of the current block in order and are
+ * never freed individually. When a block runs out a new one twice as
+ * large is chained in front of it, and @ref arena_reset() merges the
+ * chain back into a single block so that the next round of the same
+ * workload fits without touching the heap.
+ */
+struct arena {
+	struct arena_blk *blk; //< Current block
+	size_t            pos; //< Bytes used in the current block
+	void             *top; //< Most recent allocation
+};
+
+/**
+ * @brief Allocate memory from an arena.
+ *
+ * The returned memory is aligned for any object type and stays valid
+ * until the next call to @ref arena_reset() or @ref arena_fini().
+ *
+ * @param a The arena.
+ * @param size The number of bytes to allocate.
+ * @return Pointer to the allocated memory, or `nullptr` on failure.
+ */
+extern void *
+arena_alloc (struct arena *a,
+             size_t        size);
+
+/**
+ * @brief Resize an arena allocation.
+ *
+ * If `ptr` is the most recent allocation and the current block has
+ * room, it is extended in place. Otherwise a new allocation is made
+ * and the first `old` bytes are copied over.
+ *
+ * @param a The arena.
+ * @param ptr The allocation to resize, or `nullptr`.
+ * @param old The number of bytes to preserve.
+ * @param size The new size in bytes.
+ * @return Pointer to the resized allocation, or `nullptr` on failure.
+ */
+extern void *
+arena_resize (struct arena *a,
+              void         *ptr,
+              size_t        old,
+              size_t        size);
+
+/**
+ * @brief Release every allocation made from an arena.
+ *
+ * The backing memory is kept. If it is spread over more than one block
+ * they are replaced with a single block of the same total size.
+ *
+ * @param a The arena.
+ */
+extern void
+arena_reset (struct arena *a);
+
+/**
+ * @brief Free the backing memory of an arena.
+ * @param a The arena.
+ */
+extern void
+arena_fini (struct arena *a);
+
+/** @brief Heap traffic of arenas and string buffers
+ *
+ * Updated with relaxed atomics on the slow paths only.
+ */
+struct str_stats {
+	size_t blocks;      //< Arena blocks allocated
+	size_t block_bytes; //< Total size of the blocks
+	size_t grows;       //< Buffers grown
+	size_t moves;       //< Buffers which couldn't grow in place
+};
+
+extern struct str_stats str_stats;
+
+/** @brief String buffer
+ */
+struct buf {
+	struct ref    str; //< Address + current length
+	size_t        cap; //< Allocated size
+	struct arena *mem; //< Backing arena, or `nullptr` for a fixed size
+};
+
+/**
+ * @brief Create an empty string buffer backed by an arena.
+ *
+ * Nothing is allocated until the first call to @ref buf_reserve().
+ * The contents share the lifetime of the arena allocations, so there
+ * is nothing to free.
+ *
+ * @param mem The arena.
+ * @return An empty string buffer.
+ */
+static force_inline struct buf
+buf_arena (struct arena *const mem)
+{
+	return (struct buf){
+		.str = {
+			.mut = nullptr,
+			.len = {0U, 0U}
+		},
+		.cap = 0U,
+		.mem = mem
+	};
+}
+
+/**
+ * @brief Make sure a string buffer has room for `size` more bytes.
+ *
+ * Arena-backed buffers grow geometrically, in place if the buffer is
+ * the most recent allocation of its arena. Buffers without an arena
+ * can't grow.
+ *
+ * @param buf The buffer to check.
+ * @param size The number of bytes about to be appended, including the
+ *             null terminator if there is one.
+ * @return `true` if the buffer has enough capacity, `false` if it
+ *         can't grow or the required size overflows.
+ */
+extern bool
+buf_reserve (struct buf *const buf,
+             size_t            size);
+
+static force_inline void
+buf_append_ (struct buf *const      buf,
+            char const *const       str,
+            struct len const *const len)
+{
+	__builtin_memcpy(&buf->str.mut[buf->str.len.n_bytes], str, len->n_bytes);
+	buf->str.len.n_bytes += len->n_bytes;
+	buf->str.len.n_chars += len->n_chars;
+}
+
+static force_inline void
+buf_append (struct buf *const       buf,
+            struct ref const *const ref)
+{
+	buf_append_(buf, ref->imm, &ref->len);
+}
+
+#define buf_append_literal(buf, lit) \
+	buf_append_((buf), (lit), \
+		&(struct len){ \
+			sizeof (lit) - 1U, \
+			sizeof (lit) - 1U \
+		})
+
+static force_inline void
+buf_terminate (struct buf *const buf)
+{
+	buf->str.mut[buf->str.len.n_bytes] = '\0';
+}
+
+/** @brief Check if a byte is whitespace the way make sees it.
+ */
+static const_inline bool
+is_space (char const c)
+{
+	return c >= '\t' && (c <= '\r' || c == ' ');
+}
+
+/**
+ * @brief Trim leading and trailing whitespace from a string.
+ *
+ * Only the bytes between the first and last non-whitespace byte are
+ * looked at for UTF-8 validation. A wide ASCII scan runs first, and
+ * full validation is done only from the first non-ASCII byte on, if
+ * there is one.
+ *
+ * @param str The string to trim.
+ * @return Reference to the trimmed string, or a null reference if the
+ *         string is empty after trimming or isn't valid UTF-8.
+ */
+extern struct ref
+trim (char const *str);
+
+#endif /* DEEM_SRC_STR_H_ */
@@ -0,0 +1,257 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/** @file tmpl.c
+ *
+ * @author Juuso Alasuutari
+ */
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tmpl.h"
+#include "utf8.h"
+
+/** @brief Registered templates
+ */
+static struct tmpl *tmpl_list;
+
+/**
+ * @brief Check for a placeholder at `p`, which points at a `$`.
+ *
+ * @param p Pointer to the `$` byte.
+ * @param arg Receives the placeholder index.
+ * @return The length of the placeholder in bytes, or 0 if `p` isn't
+ *         the start of a placeholder.
+ */
+static size_t
+tmpl_placeholder (char const *const p,
+                  unsigned *const   arg)
+{
+	if (p[1] >= '0' && p[1] <= '9') {
+		*arg = (unsigned)(p[1] - '0');
+		return 2U;
+	}
+
+	char const close = p[1] == '(' ? ')' : p[1] == '{' ? '}' : '\0';
+	if (!close || p[2] < '0' || p[2] > '9')
+		return 0U;
+
+	unsigned n = 0U;
+	char const *q = &p[2];
+	do {
+		n = n * 10U + (unsigned)(*q++ - '0');
+		if (n > TMPL_ARG_MAX)
+			return 0U;
+	} while (*q >= '0' && *q <= '9');
+
+	if (*q != close)
+		return 0U;
+
+	*arg = n;
+	return (size_t)(q + 1 - p);
+}
+
+/**
+ * @brief Split template text into segments.
+ *
+ * Without a template to fill in, only counts the segments, literal
+ * bytes and placeholder indices so that the caller can size the
+ * allocation.
+ *
+ * @param text The template text.
+ * @param t The template to fill in, or `nullptr`.
+ * @param n_seg Receives the number of segments.
+ * @param n_lit Receives the total literal length in bytes.
+ * @param n_arg Receives the highest placeholder index + 1.
+ * @return `false` if a literal isn't valid UTF-8, `true` otherwise.
+ */
+static bool
+tmpl_parse (char const *const  text,
+            struct tmpl *const t,
+            size_t *const      n_seg,
+            size_t *const      n_lit,
+            unsigned *const    n_arg)
+{
+	char *const dst = t ? (char *)t->text : nullptr;
+	char const *lit = text, *p = text;
+	size_t seg = 0U, off = 0U;
+	unsigned max = 0U;
+
+	for (;;) {
+		unsigned arg = TMPL_END;
+		size_t k = 0U;
+
+		while (*p) {
+			if (*p == '$') {
+				if (p[1] == '$') {
+					p += 2;
+					continue;
+				}
+				k = tmpl_placeholder(p, &arg);
+				if (k)
+					break;
+			}
+			++p;
+		}
+
+		size_t n = (size_t)(p - lit);
+		if (t) {
+			struct tmpl_seg *const s = &t->seg[seg];
+			s->off = off;
+			s->lit.n_bytes = n;
+			s->lit.n_chars = 0U;
+			s->arg = arg;
+			if (!utf8_count((uint8_t const *)lit, n, &s->lit.n_chars))
+				return false;
+			__builtin_memcpy(&dst[off], lit, n);
+			t->lit.n_bytes += n;
+			t->lit.n_chars += s->lit.n_chars;
+			if (arg != TMPL_END)
+				++t->uses[arg];
+		}
+		if (arg != TMPL_END && arg >= max)
+			max = arg + 1U;
+
+		++seg;
+		off += n;
+		if (!k)
+			break;
+
+		p += k;
+		lit = p;
+	}
+
+	if (dst)
+		dst[off] = '\0';
+
+	*n_seg = seg;
+	*n_lit = off;
+	*n_arg = max;
+	return true;
+}
+
+static bool
+tmpl_name_eq (struct tmpl const *const t,
+              struct ref const *const  name)
+{
+	return t->name.len.n_bytes == name->len.n_bytes
+	    && !memcmp(t->name.imm, name->imm, name->len.n_bytes);
+}
+
+struct tmpl const *
+tmpl_find (struct ref const *const name)
+{
+	for (struct tmpl const *t = tmpl_list; t; t = t->next)
+		if (tmpl_name_eq(t, name))
+			return t;
+
+	return nullptr;
+}
+
+struct tmpl const *
+tmpl_define (struct ref const *const name,
+             char const *const       text)
+{
+	size_t n_seg, n_lit;
+	unsigned n_arg;
+	(void)tmpl_parse(text, nullptr, &n_seg, &n_lit, &n_arg);
+
+	size_t const o_uses = sizeof(struct tmpl)
+	                    + n_seg * sizeof(struct tmpl_seg);
+	size_t const o_name = o_uses + n_arg * sizeof(size_t);
+	size_t const o_text = o_name + name->len.n_bytes + 1U;
+
+	struct tmpl *const t = malloc(o_text + n_lit + 1U);
+	if (!t) {
+		perror("malloc");
+		return nullptr;
+	}
+
+	char *const mem = (char *)t;
+	*t = (struct tmpl){
+		.next  = nullptr,
+		.name  = {
+			.imm = &mem[o_name],
+			.len = name->len
+		},
+		.text  = &mem[o_text],
+		.uses  = (size_t *)&mem[o_uses],
+		.n_arg = n_arg,
+		.n_seg = n_seg,
+		.lit   = {0U, 0U}
+	};
+	(void)memset(t->uses, 0, n_arg * sizeof(size_t));
+	__builtin_memcpy(&mem[o_name], name->imm, name->len.n_bytes);
+	mem[o_name + name->len.n_bytes] = '\0';
+
+	if (!tmpl_parse(text, t, &n_seg, &n_lit, &n_arg)) {
+		(void)fprintf(stderr, "template %s: %s\n", t->name.imm,
+		              strerror(EILSEQ));
+		free(t);
+		return nullptr;
+	}
+
+	for (struct tmpl **pp = &tmpl_list; *pp; pp = &(*pp)->next) {
+		if (tmpl_name_eq(*pp, name)) {
+			struct tmpl *const old = *pp;
+			t->next = old->next;
+			*pp = t;
+			free(old);
+			return t;
+		}
+	}
+
+	t->next = tmpl_list;
+	tmpl_list = t;
+	return t;
+}
+
+/** @brief Get the replacement text of a placeholder.
+ */
+static force_inline struct ref const *
+tmpl_arg (struct tmpl const *const t,
+          struct ref const *const  arg,
+          size_t const             n_arg,
+          unsigned const           i)
+{
+	static struct ref const none = {
+		.imm = "",
+		.len = {0U, 0U}
+	};
+
+	return !i ? &t->name : i <= n_arg ? &arg[i - 1U] : &none;
+}
+
+bool
+tmpl_render (struct tmpl const *const t,
+             struct buf *const        buf,
+             struct ref const *const  arg,
+             size_t const             n_arg)
+{
+	size_t size = t->lit.n_bytes + 1U;
+	for (unsigned i = 0; i < t->n_arg; ++i) {
+		size_t n;
+		if (__builtin_mul_overflow(t->uses[i],
+		                           tmpl_arg(t, arg, n_arg, i)->len.n_bytes,
+		                           &n) ||
+		    __builtin_add_overflow(size, n, &size)) {
+			(void)fprintf(stderr, "template %s: %s\n",
+			              t->name.imm, strerror(EOVERFLOW));
+			return false;
+		}
+	}
+
+	if (!buf_reserve(buf, size))
+		return false;
+
+	for (size_t i = 0; i < t->n_seg; ++i) {
+		struct tmpl_seg const *const s = &t->seg[i];
+		buf_append_(buf, &t->text[s->off], &s->lit);
+		if (s->arg != TMPL_END)
+			buf_append(buf, tmpl_arg(t, arg, n_arg, s->arg));
+	}
+
+	buf_terminate(buf);
+	return true;
+}
@@ -0,0 +1,94 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/** @file tmpl.h
+ * @brief Precompiled makefile text templates
+ * @author Juuso Alasuutari
+ */
+#ifndef DEEM_SRC_TMPL_H_
+#define DEEM_SRC_TMPL_H_
+
+#include <stddef.h>
+
+#include "compat.h"
+#include "str.h"
+#include "util.h"
+
+/** @brief Template segment
+ *
+ * A literal run of template text followed by a placeholder. The last
+ * segment of a template has no placeholder.
+ */
+struct tmpl_seg {
+	size_t     off; //< Offset of the literal in `tmpl::text`
+	struct len lit; //< Length of the literal
+	unsigned   arg; //< Placeholder index, or @ref TMPL_END
+};
+
+/** @brief Placeholder index of the last template segment
+ */
+#define TMPL_END (~0U)
+
+/** @brief Highest placeholder index accepted in template text
+ */
+#define TMPL_ARG_MAX 999U
+
+/** @brief Compiled template
+ *
+ * Placeholders are written like `$(call)` arguments: `$1` to `$9`,
+ * or `$(N)` and `${N}` for any `N`. `$0` is the template name. `$$`
+ * is copied through as is, so that it is unescaped by the makefile
+ * parser and not by the template engine.
+ */
+struct tmpl {
+	struct tmpl     *next;  //< Next template in the registry
+	struct ref       name;  //< Template name
+	char const      *text;  //< Literal text of all segments
+	size_t          *uses;  //< Occurrence count of each placeholder
+	unsigned         n_arg; //< Highest placeholder index + 1
+	size_t           n_seg; //< Number of segments
+	struct len       lit;   //< Total literal length
+	struct tmpl_seg  seg[];
+};
+
+/**
+ * @brief Compile template text and register it under a name.
+ *
+ * An existing template with the same name is replaced.
+ *
+ * @param name The template name.
+ * @param text The null-terminated template text.
+ * @return The new template, or `nullptr` if the text isn't valid
+ *         UTF-8 or memory allocation failed.
+ */
+extern struct tmpl const *
+tmpl_define (struct ref const *name,
+             char const       *text) nonnull_in();
+
+/**
+ * @brief Look up a template by name.
+ * @param name The template name.
+ * @return The template, or `nullptr` if there is no such template.
+ */
+extern struct tmpl const *
+tmpl_find (struct ref const *name) nonnull_in();
+
+/**
+ * @brief Render a template into a string buffer.
+ *
+ * The output size is computed up front from the cached literal length
+ * and placeholder counts, and the output is written in one pass. The
+ * result is null-terminated. Placeholders without a matching argument
+ * are replaced with nothing.
+ *
+ * @param t The template.
+ * @param buf The output buffer.
+ * @param arg The arguments for placeholders `$1` and up.
+ * @param n_arg The number of elements in `arg`.
+ * @return `true` on success, `false` if the buffer couldn't grow.
+ */
+extern bool
+tmpl_render (struct tmpl const *t,
+             struct buf        *buf,
+             struct ref const  *arg,
+             size_t             n_arg) nonnull_in(1, 2);
+
+#endif /* DEEM_SRC_TMPL_H_ */
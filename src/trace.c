@@ -0,0 +1,161 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/** @file trace.c
+ *
+ * @author Juuso Alasuutari
+ */
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "trace.h"
+
+static int
+trace_ev_cmp (void const *const a,
+              void const *const b)
+{
+	uint64_t const x = ((struct trace_ev const *)a)->ts;
+	uint64_t const y = ((struct trace_ev const *)b)->ts;
+	return (x > y) - (x < y);
+}
+
+/** @brief Assign the commands of a trace to job slots.
+ */
+static void
+trace_slots (struct trace *const t)
+{
+	uint64_t *end = nullptr;
+	for (size_t i = 0; i < t->n; ++i) {
+		unsigned k = 0U;
+		while (k < t->n_slot && end[k] > t->ev[i].ts)
+			++k;
+		if (k == t->n_slot) {
+			uint64_t *const p = realloc(end, (t->n_slot + 1U) * sizeof *end);
+			if (!p) {
+				perror("realloc");
+				for (size_t j = i; j < t->n; ++j) {
+					free((void *)t->ev[j].cat);
+					free((void *)t->ev[j].name);
+				}
+				t->n = i;
+				break;
+			}
+			end = p;
+			++t->n_slot;
+		}
+		end[k] = t->ev[i].ts + t->ev[i].dur;
+		t->ev[i].slot = k;
+	}
+	free(end);
+}
+
+bool
+trace_read (struct trace *const t,
+            char const *const   path)
+{
+	*t = (struct trace){.ev = nullptr, .n = 0U, .n_slot = 0U};
+	FILE *const f = fopen(path, "r");
+	if (!f)
+		return false;
+
+	size_t cap = 0U;
+	char *line = nullptr;
+	size_t line_cap = 0U;
+
+	for (ssize_t len; (len = getline(&line, &line_cap, f)) > 0; ) {
+		if (line[len - 1] == '\n')
+			line[len - 1] = '\0';
+
+		struct trace_ev e;
+		int cat = 0, name = 0;
+		if (sscanf(line, "%" SCNu64 " %" SCNu64 " %ld %n%*s %n",
+		           &e.ts, &e.dur, &e.pid, &cat, &name) < 3 || !name)
+			continue;
+		line[name - 1] = '\0';
+
+		if (t->n == cap) {
+			cap = cap ? cap * 2U : 256U;
+			struct trace_ev *const p = realloc(t->ev, cap * sizeof *p);
+			if (!p) {
+				perror("realloc");
+				break;
+			}
+			t->ev = p;
+		}
+
+		e.cat = strdup(&line[cat]);
+		e.name = strdup(&line[name]);
+		if (!e.cat || !e.name) {
+			free((void *)e.cat);
+			free((void *)e.name);
+			break;
+		}
+		t->ev[t->n++] = e;
+	}
+
+	free(line);
+	(void)fclose(f);
+	if (t->n)
+		qsort(t->ev, t->n, sizeof *t->ev, trace_ev_cmp);
+	trace_slots(t);
+	return true;
+}
+
+/** @brief Write a JSON string.
+ */
+static void
+trace_str (FILE *const       f,
+           char const *const s)
+{
+	(void)fputc('"', f);
+	for (unsigned char const *p = (unsigned char const *)s; *p; ++p) {
+		if (*p == '"' || *p == '\\')
+			(void)fprintf(f, "\\%c", *p);
+		else if (*p < 0x20U)
+			(void)fprintf(f, "\\u%04x", *p);
+		else
+			(void)fputc(*p, f);
+	}
+	(void)fputc('"', f);
+}
+
+bool
+trace_write (struct trace const *const t,
+             char const *const         path)
+{
+	FILE *const f = fopen(path, "w");
+	if (!f)
+		return false;
+
+	(void)fputs("{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n"
+	            "{\"name\": \"process_name\", \"ph\": \"M\", "
+	            "\"pid\": 1, \"args\": {\"name\": \"make\"}}", f);
+	for (unsigned k = 0; k < t->n_slot; ++k)
+		(void)fprintf(f, ",\n{\"name\": \"thread_name\", \"ph\": \"M\", "
+		              "\"pid\": 1, \"tid\": %u, \"args\": {\"name\": "
+		              "\"slot %u\"}}", k, k);
+	for (size_t i = 0; i < t->n; ++i) {
+		struct trace_ev const *const e = &t->ev[i];
+		(void)fputs(",\n{\"name\": ", f);
+		trace_str(f, e->name);
+		(void)fputs(", \"cat\": ", f);
+		trace_str(f, e->cat);
+		(void)fprintf(f, ", \"ph\": \"X\", \"ts\": %" PRIu64 ", "
+		              "\"dur\": %" PRIu64 ", \"pid\": 1, \"tid\": %u, "
+		              "\"args\": {\"pid\": %ld}}", e->ts - t->ev[0].ts,
+		              e->dur, e->slot, e->pid);
+	}
+	(void)fputs("\n]}\n", f);
+	return !fclose(f);
+}
+
+void
+trace_fini (struct trace *const t)
+{
+	for (size_t i = 0; i < t->n; ++i) {
+		free((void *)t->ev[i].cat);
+		free((void *)t->ev[i].name);
+	}
+	free(t->ev);
+	*t = (struct trace){.ev = nullptr, .n = 0U, .n_slot = 0U};
+}
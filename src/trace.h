@@ -0,0 +1,77 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/** @file trace.h
+ * @brief Command trace logs and Chrome traces
+ * @author Juuso Alasuutari
+ */
+#ifndef DEEM_SRC_TRACE_H_
+#define DEEM_SRC_TRACE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "compat.h"
+#include "util.h"
+
+/** @brief Command in a trace log
+ */
+struct trace_ev {
+	uint64_t    ts;   //< Start time in microseconds
+	uint64_t    dur;  //< Duration in microseconds
+	long        pid;  //< Process ID of `deem-cc`
+	char const *cat;  //< Category, e.g. `CC`
+	char const *name; //< Target
+	unsigned    slot; //< Job slot
+};
+
+/** @brief Commands of a trace log
+ */
+struct trace {
+	struct trace_ev *ev;     //< Commands in order of start time
+	size_t           n;      //< Number of commands
+	unsigned         n_slot; //< Number of job slots
+};
+
+/**
+ * @brief Read a trace log.
+ *
+ * Each line of the log is the start time, duration, process ID,
+ * category, and target of a command, separated by spaces. Lines which
+ * don't parse are skipped.
+ *
+ * Which jobserver token a command held can't be known, so commands
+ * are assigned to job slots in order of their start time, each to the
+ * lowest slot which is free by then. The number of slots in use over
+ * time is then the same as the number of commands running.
+ *
+ * @param t Receives the commands, which must be released with
+ *          @ref trace_fini() if the log was read.
+ * @param path The log.
+ * @return `true` if the log was read, even if only in part, `false`
+ *         if it can't be opened.
+ */
+extern bool
+trace_read (struct trace *t,
+            char const   *path) nonnull_in();
+
+/**
+ * @brief Write commands as a Chrome trace.
+ *
+ * The trace can be opened in Perfetto or `chrome://tracing`. Each job
+ * slot is a thread of one process, `make`.
+ *
+ * @param t The commands.
+ * @param path The trace file.
+ * @return `true` on success, `false` with `errno` set on failure.
+ */
+extern bool
+trace_write (struct trace const *t,
+             char const         *path) nonnull_in();
+
+/**
+ * @brief Release the commands of a trace log.
+ * @param t The commands.
+ */
+extern void
+trace_fini (struct trace *t) nonnull_in();
+
+#endif /* DEEM_SRC_TRACE_H_ */
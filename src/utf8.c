@@ -91,6 +91,30 @@ constexpr static const uint16_t utf8_lut[] = {
 
 constexpr static const UTF8_PARSER_STATE_MAP(utf8_dst);
 
+/**
+ * @brief Sequence sizes indexed by state enumeration.
+ */
+constexpr static const uint8_t utf8_len[16] = {
+	#define F(n,m,l,...) [n] = l,
+	UTF8_PARSER_DESCRIPTOR(F)
+	#undef F
+};
+
+/**
+ * @brief Check if a parser state enumeration is a valid place for
+ *        the input to end, i.e. not inside a multi-byte sequence.
+ *
+ * @param st8 The state enumeration to check.
+ * @return `true` if `st8` is @ref utf8_asc, @ref utf8_cb1, or
+ *         @ref utf8_ini, otherwise `false`.
+ */
+static const_inline bool
+utf8_st8_is_final (enum utf8_st8 st8)
+{
+	return (utf8_bit(asc) | utf8_bit(cb1) | utf8_bit(ini)) >> st8 & 1U;
+}
+
+
 /**
  * @brief Convert a parser state from a bit flag representation
  *        to the corresponding parser state enumeration.
@@ -215,12 +239,6 @@ utf8_push_to_cache (struct utf8 *const u8p,
                     enum utf8_st8      st8,
                     uint8_t            byte)
 {
-	constexpr static const uint8_t utf8_len[16] = {
-		#define F(n,m,l,...) [n] = l,
-		UTF8_PARSER_DESCRIPTOR(F)
-		#undef F
-	};
-
 	uint8_t len = utf8_len[st8];
 #ifdef DEBUG
 	uint8_t k = 0;
@@ -250,6 +268,210 @@ utf8_push_to_cache (struct utf8 *const u8p,
 #endif /* DEBUG */
 }
 
+#ifdef UTF8_ENGINE_DFA
+
+/* The DFA engine is a shift-based DFA generated from the parser
+ * descriptor and the state transition map. Each row of the table
+ * packs the successor of every DFA state for one byte value into
+ * a 64-bit word. A DFA state is the offset of its own 6-bit field
+ * in the row, so a transition is one lookup and one shift:
+ *
+ *     s = utf8_dfa[byte] >> (s & 63);
+ *
+ * The DFA states are the distinct sets of allowed next states in
+ * the transition map: one state which expects a leading byte, and
+ * one state per continuation state that must come next. Offset 0
+ * is the error state. No row has bits set there, so it absorbs.
+ */
+#define UTF8_DFA_ERR 0U
+#define UTF8_DFA_ACC 6U
+#define UTF8_DFA_EXP(st8) (6U * ((st8) - 6U))
+
+// Set of states allowed after `st8` as a constant expression
+#define UTF8_DFA_DST(st8) (0U UTF8_PARSER_TRANSITIONS(UTF8_DFA_DST_, st8))
+#define UTF8_DFA_DST_(m, bits, st8) | ((st8) == utf8_##m ? (bits) : 0U)
+
+// DFA state after the parser has entered `st8`
+#define UTF8_DFA_TO(st8)                                   \
+        ((UTF8_DFA_DST(st8) & utf8_bit(asc)) ? UTF8_DFA_ACC \
+        : UTF8_DFA_EXP(__builtin_ctz(UTF8_DFA_DST(st8))))
+
+// DFA state in which the parser can enter `st8`
+#define UTF8_DFA_FROM(st8) ((st8) < 8U ? UTF8_DFA_ACC : UTF8_DFA_EXP(st8))
+
+#define UTF8_DFA_ROW(b) (UINT64_C(0) UTF8_PARSER_DESCRIPTOR(UTF8_DFA_ROW_, b))
+#define UTF8_DFA_ROW_(n, m, l, start, run, skip, run2, b)          \
+        | (UTF8_DFA_IN(b, (start), (run)) ||                       \
+           UTF8_DFA_IN(b, (start) + (run) + (skip), (run2))        \
+           ? (uint64_t)UTF8_DFA_TO(n) << UTF8_DFA_FROM(n) : UINT64_C(0))
+#define UTF8_DFA_IN(b, lo, len) ((int)(b) >= (lo) && (int)(b) < (lo) + (len))
+
+#define X16(h) \
+	UTF8_DFA_ROW(0x##h##0), UTF8_DFA_ROW(0x##h##1), \
+	UTF8_DFA_ROW(0x##h##2), UTF8_DFA_ROW(0x##h##3), \
+	UTF8_DFA_ROW(0x##h##4), UTF8_DFA_ROW(0x##h##5), \
+	UTF8_DFA_ROW(0x##h##6), UTF8_DFA_ROW(0x##h##7), \
+	UTF8_DFA_ROW(0x##h##8), UTF8_DFA_ROW(0x##h##9), \
+	UTF8_DFA_ROW(0x##h##a), UTF8_DFA_ROW(0x##h##b), \
+	UTF8_DFA_ROW(0x##h##c), UTF8_DFA_ROW(0x##h##d), \
+	UTF8_DFA_ROW(0x##h##e), UTF8_DFA_ROW(0x##h##f)
+
+constexpr static const uint64_t utf8_dfa[256] = {
+	X16(0), X16(1), X16(2), X16(3), X16(4), X16(5), X16(6), X16(7),
+	X16(8), X16(9), X16(a), X16(b), X16(c), X16(d), X16(e), X16(f),
+};
+
+#undef X16
+
+/**
+ * @brief DFA states indexed by parser state enumeration, used to
+ *        resume from the state saved in a parser object.
+ */
+constexpr static const uint8_t utf8_dfa_to[16] = {
+	#define F(n,...) [n] = UTF8_DFA_TO(n),
+	UTF8_PARSER_DESCRIPTOR(F)
+	#undef F
+};
+
+#undef UTF8_DFA_IN
+#undef UTF8_DFA_ROW_
+#undef UTF8_DFA_ROW
+#undef UTF8_DFA_FROM
+#undef UTF8_DFA_TO
+#undef UTF8_DFA_DST_
+#undef UTF8_DFA_DST
+
+/**
+ * @brief Decoder engine state.
+ */
+struct utf8_eng {
+	uint64_t s;
+};
+
+static const_inline struct utf8_eng
+utf8_eng (enum utf8_st8 st8)
+{
+	return (struct utf8_eng){ .s = utf8_dfa_to[st8 & 0xfU] };
+}
+
+/**
+ * @brief Feed one byte to the engine.
+ * @return `true` if the byte was a valid transition.
+ */
+static force_inline bool
+utf8_eng_step (struct utf8_eng *const eng,
+               uint8_t                byte)
+{
+	eng->s = utf8_dfa[byte] >> (eng->s & 63U);
+	return (eng->s & 63U) != UTF8_DFA_ERR;
+}
+
+static const_inline bool
+utf8_eng_final (struct utf8_eng eng)
+{
+	return (eng.s & 63U) == UTF8_DFA_ACC;
+}
+
+/**
+ * @brief Feed a bounded byte range to the engine.
+ *
+ * The loop has no branches on the state; the error state absorbs
+ * everything after it, so checking once at the end is enough.
+ *
+ * @return `true` if every byte was a valid transition. The engine
+ *         state is unspecified on failure.
+ */
+nonnull_in()
+static force_inline bool
+utf8_eng_run (struct utf8_eng *const eng,
+              uint8_t const         *ptr,
+              size_t                 n)
+{
+	uint64_t s = eng->s;
+	for (uint8_t const *const end = &ptr[n]; ptr != end; ++ptr)
+		s = utf8_dfa[*ptr] >> (s & 63U);
+	eng->s = s;
+	return (s & 63U) != UTF8_DFA_ERR;
+}
+
+/**
+ * @brief Get the number of continuation bytes the engine expects
+ *        before the current sequence is complete.
+ */
+static const_inline unsigned
+utf8_eng_remaining (struct utf8_eng eng)
+{
+	unsigned s = eng.s & 63U;
+	return s == UTF8_DFA_ACC ? 0U : utf8_len[s / 6U + 6U];
+}
+
+#undef UTF8_DFA_EXP
+#undef UTF8_DFA_ACC
+#undef UTF8_DFA_ERR
+
+#else /* !UTF8_ENGINE_DFA */
+
+/**
+ * @brief Decoder engine state.
+ */
+struct utf8_eng {
+	enum utf8_st8 s;
+};
+
+static const_inline struct utf8_eng
+utf8_eng (enum utf8_st8 st8)
+{
+	return (struct utf8_eng){ .s = st8 };
+}
+
+/**
+ * @brief Feed one byte to the engine.
+ * @return `true` if the byte was a valid transition. The engine
+ *         state is not modified on failure.
+ */
+static force_inline bool
+utf8_eng_step (struct utf8_eng *const eng,
+               uint8_t                byte)
+{
+	int e = utf8_state_from_bit(utf8_lut[byte] &
+	                            utf8_get_allowed_next_states(eng->s));
+	if (e < 0)
+		return false;
+	assume_value_bits(e, 0xf);
+	eng->s = (enum utf8_st8)e;
+	return true;
+}
+
+static const_inline bool
+utf8_eng_final (struct utf8_eng eng)
+{
+	return utf8_st8_is_final(eng.s);
+}
+
+/**
+ * @brief Feed a bounded byte range to the engine.
+ *
+ * Makes exactly the same transitions as @ref utf8_set_state() but
+ * skips the parser cache.
+ *
+ * @return `true` if every byte was a valid transition. The engine
+ *         state is unspecified on failure.
+ */
+nonnull_in()
+static force_inline bool
+utf8_eng_run (struct utf8_eng *const eng,
+              uint8_t const         *ptr,
+              size_t                 n)
+{
+	for (uint8_t const *const end = &ptr[n]; ptr != end; ++ptr) {
+		if (!utf8_eng_step(eng, *ptr))
+			return false;
+	}
+	return true;
+}
+
+#endif /* !UTF8_ENGINE_DFA */
+
 #undef UTF8_PARSER_DESCRIPTOR
 
 /**
@@ -298,6 +520,8 @@ utf8_set_state (struct utf8 *const   u8p,
 	return true;
 }
 
+#ifndef UTF8_ENGINE_DFA
+
 nonnull_in() nonnull_out
 uint8_t const *
 utf8_parse_next_code_point (struct utf8 *const  u8p,
@@ -317,3 +541,664 @@ utf8_parse_next_code_point (struct utf8 *const  u8p,
 
 	return ptr;
 }
+
+#else /* UTF8_ENGINE_DFA */
+
+/* The DFA doesn't distinguish between parser states which have the
+ * same successors, so the exact parser state is only reconstructed
+ * on completion (from the sequence size) and on error (by replaying
+ * the consumed bytes through the state map). The cache position is
+ * derived from the number of continuation bytes still expected.
+ */
+nonnull_in() nonnull_out
+uint8_t const *
+utf8_parse_next_code_point (struct utf8 *const  u8p,
+                            uint8_t const      *ptr)
+{
+	enum utf8_st8 st8 = utf8_ini;
+
+	if (!utf8_get_state(u8p, &st8))
+		return ptr;
+
+	uint8_t const *const start = ptr;
+	struct utf8_eng eng = utf8_eng(st8);
+
+	for (;; ++ptr) {
+		if (!utf8_eng_step(&eng, *ptr))
+			break;
+
+		uint8_t rem = (uint8_t)utf8_eng_remaining(eng);
+		if ((*ptr & 0xc0U) != 0x80U) {
+			// Leading byte or ASCII
+			u8p->cache[0] = rem + 1U;
+			__builtin_memset(&u8p->cache[1], 0, sizeof u8p->cache - 1U);
+		}
+		u8p->cache[u8p->cache[0] - rem] = *ptr;
+
+		if (!rem) {
+			u8p->state = u8p->cache[0] == 1U ? utf8_bit(asc)
+			                                 : utf8_bit(cb1);
+			u8p->error = 0;
+			return ptr + 1;
+		}
+	}
+
+	for (uint8_t const *p = start; p != ptr; ++p)
+		st8 = (enum utf8_st8)utf8_state_from_bit(
+			utf8_lut[*p] & utf8_get_allowed_next_states(st8));
+	u8p->state = (uint16_t)(1U << st8);
+	u8p->error = EILSEQ;
+
+	return ptr;
+}
+
+#endif /* UTF8_ENGINE_DFA */
+
+/**
+ * @brief Decode a bounded byte range with the selected engine.
+ *
+ * The code point is assembled from the bytes alone: the number of
+ * leading one bits tells a continuation byte (one) from a leading
+ * byte (zero or two to four), and also how many payload bits the
+ * byte carries. The result is stored unconditionally and the output
+ * only advanced when a sequence completes, so there is no branch on
+ * the sequence length.
+ */
+nonnull_in()
+bool
+utf8_decode (uint32_t *const      dst,
+             uint8_t const       *ptr,
+             size_t const         n,
+             size_t *const        cnt)
+{
+	struct utf8_eng eng = utf8_eng(utf8_ini);
+	uint32_t *out = dst;
+	uint32_t cp = 0;
+
+	for (uint8_t const *const end = &ptr[n]; ptr != end; ++ptr) {
+		if (!utf8_eng_step(&eng, *ptr))
+			return false;
+
+		unsigned ones = (unsigned)__builtin_clz(
+			~(uint32_t)*ptr << 24U | 1U);
+		cp = (ones == 1U ? cp << 6U : 0U) | (*ptr & (0x7fU >> ones));
+		*out = cp;
+		out += utf8_eng_final(eng);
+	}
+
+	if (!utf8_eng_final(eng))
+		return false;
+
+	*cnt = (size_t)(out - dst);
+	return true;
+}
+
+/**
+ * @brief Count the non-continuation bytes in a byte range.
+ *
+ * In valid UTF-8 this is the number of code points in the range.
+ *
+ * @param ptr Start of the byte range.
+ * @param n Number of bytes to inspect.
+ * @return Number of bytes outside 0x80-0xbf.
+ */
+static force_inline size_t
+utf8_lead_count (uint8_t const *ptr,
+                 size_t         n)
+{
+	size_t c = 0;
+	for (uint8_t const *const end = &ptr[n]; ptr != end; ++ptr)
+		c += (int8_t)*ptr > (int8_t)0xbf;
+	return c;
+}
+
+/**
+ * @brief Generic block-wise validation and counting driver.
+ *
+ * Blocks which are pure ASCII and start on a code point boundary are
+ * skipped without touching the state machine. Everything else, plus
+ * the final partial block, goes through @ref utf8_eng_run(). The ASCII
+ * test and the per-block code point count are supplied by the caller
+ * and inlined into each kernel.
+ *
+ * @param ptr Start of the input buffer.
+ * @param n Size of the input buffer in bytes.
+ * @param w Block size in bytes, must match what `ascii` and `lead`
+ *          inspect.
+ * @param ascii Returns `true` if the `w` bytes at its argument
+ *              are all ASCII.
+ * @param lead Returns the number of non-continuation bytes in the
+ *             `w` bytes at its argument.
+ * @param cnt Where to store the code point count, or `nullptr` if
+ *            only validation is needed. Not modified on failure.
+ * @return `true` if the buffer is valid UTF-8, otherwise `false`.
+ */
+static force_inline bool
+utf8_scan_blocks (uint8_t const *ptr,
+                  size_t         n,
+                  size_t const   w,
+                  bool         (*ascii)(uint8_t const *),
+                  size_t       (*lead)(uint8_t const *),
+                  size_t *const  cnt)
+{
+	struct utf8_eng eng = utf8_eng(utf8_ini);
+	size_t c = 0;
+
+	for (; n >= w; ptr += w, n -= w) {
+		if (utf8_eng_final(eng) && ascii(ptr)) {
+			c += w;
+			continue;
+		}
+		if (!utf8_eng_run(&eng, ptr, w))
+			return false;
+		if (cnt)
+			c += lead(ptr);
+	}
+
+	if (!utf8_eng_run(&eng, ptr, n) || !utf8_eng_final(eng))
+		return false;
+
+	if (cnt)
+		*cnt = c + utf8_lead_count(ptr, n);
+	return true;
+}
+
+/**
+ * @brief Define the validating and counting entry points of a kernel.
+ *
+ * Both are thin wrappers around `utf8_scan_<isa>()`, which must take
+ * the same arguments as @ref utf8_count(). With `cnt` being a constant
+ * `nullptr` in the validating variant the counting code is eliminated
+ * after inlining.
+ *
+ * @param isa Kernel name suffix.
+ * @param ... Optional attributes, e.g. a target specification.
+ */
+#define UTF8_BULK_API(isa, ...)                          \
+__VA_ARGS__ static bool                                  \
+utf8_validate_##isa (uint8_t const *const ptr,           \
+                     size_t const         n)             \
+{                                                        \
+	return utf8_scan_##isa(ptr, n, nullptr);         \
+}                                                        \
+__VA_ARGS__ static bool                                  \
+utf8_count_##isa (uint8_t const *const ptr,              \
+                  size_t const         n,                \
+                  size_t *const        cnt)              \
+{                                                        \
+	return utf8_scan_##isa(ptr, n, cnt);             \
+}
+
+static force_inline bool
+utf8_ascii_swar (uint8_t const *const ptr)
+{
+	uint64_t w;
+	__builtin_memcpy(&w, ptr, sizeof w);
+	return !(w & UINT64_C(0x8080808080808080));
+}
+
+static force_inline size_t
+utf8_lead_swar (uint8_t const *const ptr)
+{
+	uint64_t w;
+	__builtin_memcpy(&w, ptr, sizeof w);
+	// Continuation bytes have bit 7 set and bit 6 clear
+	w &= ~(w << 1U) & UINT64_C(0x8080808080808080);
+	return 8U - (size_t)__builtin_popcountll(w);
+}
+
+static force_inline bool
+utf8_scan_swar (uint8_t const *const ptr,
+                size_t const         n,
+                size_t *const        cnt)
+{
+	return utf8_scan_blocks(ptr, n, 8U, utf8_ascii_swar,
+	                        utf8_lead_swar, cnt);
+}
+
+UTF8_BULK_API(swar, useless)
+
+useless static size_t
+utf8_ascii_span_swar (uint8_t const *const ptr,
+                      size_t const         n)
+{
+	size_t i = 0;
+	for (; n - i >= 8U; i += 8U) {
+		uint64_t w;
+		__builtin_memcpy(&w, &ptr[i], sizeof w);
+		w &= UINT64_C(0x8080808080808080);
+		if (w) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+			return i + ((size_t)__builtin_ctzll(w) >> 3U);
+#else
+			return i + ((size_t)__builtin_clzll(w) >> 3U);
+#endif
+		}
+	}
+	while (i < n && ptr[i] < 0x80U)
+		++i;
+	return i;
+}
+
+#if defined __x86_64__ && defined __ELF__ && __has_attribute(ifunc)
+# include <immintrin.h>
+
+static force_inline bool
+utf8_ascii_sse2 (uint8_t const *const ptr)
+{
+	return !_mm_movemask_epi8(_mm_loadu_si128((__m128i const *)ptr));
+}
+
+static force_inline size_t
+utf8_lead_sse2 (uint8_t const *const ptr)
+{
+	__m128i const v = _mm_loadu_si128((__m128i const *)ptr);
+	return (size_t)__builtin_popcount((unsigned)_mm_movemask_epi8(
+		_mm_cmpgt_epi8(v, _mm_set1_epi8((char)0xbf))));
+}
+
+/* SSE2 has no byte shuffle, so only the ASCII test and the counting
+ * are vectorized here. Non-ASCII blocks are validated by the scalar
+ * state machine.
+ */
+static force_inline bool
+utf8_scan_sse2 (uint8_t const *const ptr,
+                size_t const         n,
+                size_t *const        cnt)
+{
+	return utf8_scan_blocks(ptr, n, 16U, utf8_ascii_sse2,
+	                        utf8_lead_sse2, cnt);
+}
+
+UTF8_BULK_API(sse2)
+
+static size_t
+utf8_ascii_span_sse2 (uint8_t const *const ptr,
+                      size_t const         n)
+{
+	size_t i = 0;
+	for (; n - i >= 16U; i += 16U) {
+		unsigned m = (unsigned)_mm_movemask_epi8(
+			_mm_loadu_si128((__m128i const *)&ptr[i]));
+		if (m)
+			return i + (size_t)__builtin_ctz(m);
+	}
+	while (i < n && ptr[i] < 0x80U)
+		++i;
+	return i;
+}
+
+/* Error classes of the two-byte lookup algorithm described in
+ * "Validating UTF-8 In Less Than One Instruction Per Byte" by
+ * John Keiser and Daniel Lemire. Each class is a bit which must
+ * be set in all three lookups for a byte pair to be in error.
+ */
+#define UTF8_TOO_SHORT      (1U << 0) // 11______ 0_______ | 11______ 11______
+#define UTF8_TOO_LONG       (1U << 1) // 0_______ 10______
+#define UTF8_OVERLONG_3     (1U << 2) // 11100000 100_____
+#define UTF8_TOO_LARGE      (1U << 3) // 11110100 1001____ | 11110100 101_____ | 11110101+ 10______
+#define UTF8_SURROGATE      (1U << 4) // 11101101 101_____
+#define UTF8_OVERLONG_2     (1U << 5) // 1100000_ 10______
+#define UTF8_TOO_LARGE_1000 (1U << 6) // 11110101+ 1000____
+#define UTF8_OVERLONG_4     (1U << 6) // 11110000 1000____
+#define UTF8_TWO_CONTS      (1U << 7) // 10______ 10______
+#define UTF8_CARRY          (UTF8_TOO_SHORT | UTF8_TOO_LONG | UTF8_TWO_CONTS)
+
+/* Error classes indexed by the high nibble of the previous byte.
+ */
+constexpr static const uint8_t utf8_err_b1h[16] = {
+	[0x0 ... 0x7] = UTF8_TOO_LONG,
+	[0x8 ... 0xb] = UTF8_TWO_CONTS,
+	[0xc]         = UTF8_TOO_SHORT | UTF8_OVERLONG_2,
+	[0xd]         = UTF8_TOO_SHORT,
+	[0xe]         = UTF8_TOO_SHORT | UTF8_OVERLONG_3 | UTF8_SURROGATE,
+	[0xf]         = UTF8_TOO_SHORT | UTF8_TOO_LARGE
+	              | UTF8_TOO_LARGE_1000 | UTF8_OVERLONG_4,
+};
+
+/* Error classes indexed by the low nibble of the previous byte.
+ */
+constexpr static const uint8_t utf8_err_b1l[16] = {
+	[0x0]         = UTF8_CARRY | UTF8_OVERLONG_3 | UTF8_OVERLONG_2
+	              | UTF8_OVERLONG_4,
+	[0x1]         = UTF8_CARRY | UTF8_OVERLONG_2,
+	[0x2 ... 0x3] = UTF8_CARRY,
+	[0x4]         = UTF8_CARRY | UTF8_TOO_LARGE,
+	[0x5 ... 0xc] = UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+	[0xd]         = UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000
+	              | UTF8_SURROGATE,
+	[0xe ... 0xf] = UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+};
+
+/* Error classes indexed by the high nibble of the current byte.
+ */
+constexpr static const uint8_t utf8_err_b2h[16] = {
+	[0x0 ... 0x7] = UTF8_TOO_SHORT,
+	[0x8]         = UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS
+	              | UTF8_OVERLONG_3 | UTF8_TOO_LARGE_1000
+	              | UTF8_OVERLONG_4,
+	[0x9]         = UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS
+	              | UTF8_OVERLONG_3 | UTF8_TOO_LARGE,
+	[0xa ... 0xb] = UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS
+	              | UTF8_SURROGATE | UTF8_TOO_LARGE,
+	[0xc ... 0xf] = UTF8_TOO_SHORT,
+};
+
+/* Subtracted from the last block with unsigned saturation; a non-zero
+ * result means the block ends inside a multi-byte sequence.
+ */
+constexpr static const uint8_t utf8_incomplete_max[64] = {
+	[ 0 ... 60] = 0xff,
+	[61]        = 0xf0 - 1U,
+	[62]        = 0xe0 - 1U,
+	[63]        = 0xc0 - 1U,
+};
+
+#undef UTF8_CARRY
+#undef UTF8_TWO_CONTS
+#undef UTF8_OVERLONG_4
+#undef UTF8_TOO_LARGE_1000
+#undef UTF8_OVERLONG_2
+#undef UTF8_SURROGATE
+#undef UTF8_TOO_LARGE
+#undef UTF8_OVERLONG_3
+#undef UTF8_TOO_LONG
+#undef UTF8_TOO_SHORT
+
+#define utf8_avx2 __attribute__((target("avx2")))
+
+utf8_avx2 static force_inline __m256i
+utf8_tbl_avx2 (uint8_t const *const tbl)
+{
+	return _mm256_broadcastsi128_si256(_mm_loadu_si128((__m128i const *)tbl));
+}
+
+/**
+ * @brief Get the error classes of every byte pair in a 32-byte block.
+ * @param cur The current block.
+ * @param prv The previous block, or all zeros.
+ * @return Non-zero bytes where the input is in error.
+ */
+utf8_avx2 static force_inline __m256i
+utf8_check_avx2 (__m256i const cur,
+                 __m256i const prv)
+{
+	__m256i const nib = _mm256_set1_epi8(0x0f);
+	__m256i const cat = _mm256_permute2x128_si256(prv, cur, 0x21);
+	__m256i const pr1 = _mm256_alignr_epi8(cur, cat, 15);
+	__m256i const pr2 = _mm256_alignr_epi8(cur, cat, 14);
+	__m256i const pr3 = _mm256_alignr_epi8(cur, cat, 13);
+
+	__m256i const b1h = _mm256_shuffle_epi8(utf8_tbl_avx2(utf8_err_b1h),
+		_mm256_and_si256(_mm256_srli_epi16(pr1, 4), nib));
+	__m256i const b1l = _mm256_shuffle_epi8(utf8_tbl_avx2(utf8_err_b1l),
+		_mm256_and_si256(pr1, nib));
+	__m256i const b2h = _mm256_shuffle_epi8(utf8_tbl_avx2(utf8_err_b2h),
+		_mm256_and_si256(_mm256_srli_epi16(cur, 4), nib));
+	__m256i const err = _mm256_and_si256(_mm256_and_si256(b1h, b1l), b2h);
+
+	// Bytes which must be the 2nd or 3rd continuation byte of a sequence
+	__m256i const m23 = _mm256_and_si256(_mm256_set1_epi8((char)0x80),
+		_mm256_or_si256(
+			_mm256_subs_epu8(pr2, _mm256_set1_epi8((char)(0xe0 - 0x80))),
+			_mm256_subs_epu8(pr3, _mm256_set1_epi8((char)(0xf0 - 0x80)))));
+
+	return _mm256_xor_si256(m23, err);
+}
+
+utf8_avx2 static force_inline bool
+utf8_scan_avx2 (uint8_t const *ptr,
+                size_t         n,
+                size_t *const  cnt)
+{
+	__m256i const max = _mm256_loadu_si256((__m256i const *)&utf8_incomplete_max[32]);
+	__m256i const cb1 = _mm256_set1_epi8((char)0xbf);
+	__m256i prv = _mm256_setzero_si256();
+	__m256i inc = _mm256_setzero_si256();
+	__m256i err = _mm256_setzero_si256();
+	size_t c = 0;
+
+	for (;; ptr += 32U, n -= 32U) {
+		__m256i cur;
+		uint32_t msk = ~UINT32_C(0);
+		if (n >= 32U) {
+			cur = _mm256_loadu_si256((__m256i const *)ptr);
+		} else {
+			/* The zero padding after the tail acts as ASCII,
+			 * so a truncated sequence at the end is caught
+			 * like any other truncated sequence.
+			 */
+			uint8_t tail[32] = {0};
+			__builtin_memcpy(tail, ptr, n);
+			cur = _mm256_loadu_si256((__m256i const *)tail);
+			msk = ~(~UINT32_C(0) << n);
+		}
+
+		if (!_mm256_movemask_epi8(cur)) {
+			err = _mm256_or_si256(err, inc);
+			inc = _mm256_setzero_si256();
+			if (cnt)
+				c += (size_t)__builtin_popcount(msk);
+		} else {
+			err = _mm256_or_si256(err, utf8_check_avx2(cur, prv));
+			inc = _mm256_subs_epu8(cur, max);
+			if (cnt)
+				c += (size_t)__builtin_popcount(msk &
+					(uint32_t)_mm256_movemask_epi8(
+						_mm256_cmpgt_epi8(cur, cb1)));
+		}
+
+		if (n < 32U)
+			break;
+		prv = cur;
+	}
+
+	if (!_mm256_testz_si256(err, err))
+		return false;
+
+	if (cnt)
+		*cnt = c;
+	return true;
+}
+
+UTF8_BULK_API(avx2, utf8_avx2)
+
+utf8_avx2 static size_t
+utf8_ascii_span_avx2 (uint8_t const *const ptr,
+                      size_t const         n)
+{
+	size_t i = 0;
+	for (; n - i >= 32U; i += 32U) {
+		unsigned m = (unsigned)_mm256_movemask_epi8(
+			_mm256_loadu_si256((__m256i const *)&ptr[i]));
+		if (m)
+			return i + (size_t)__builtin_ctz(m);
+	}
+	while (i < n && ptr[i] < 0x80U)
+		++i;
+	return i;
+}
+
+#undef utf8_avx2
+
+#define utf8_avx512 __attribute__((target("avx512f,avx512bw")))
+
+utf8_avx512 static force_inline __m512i
+utf8_tbl_avx512 (uint8_t const *const tbl)
+{
+	return _mm512_broadcast_i32x4(_mm_loadu_si128((__m128i const *)tbl));
+}
+
+/**
+ * @brief Get the error classes of every byte pair in a 64-byte block.
+ * @param cur The current block.
+ * @param prv The previous block, or all zeros.
+ * @return Non-zero bytes where the input is in error.
+ */
+utf8_avx512 static force_inline __m512i
+utf8_check_avx512 (__m512i const cur,
+                   __m512i const prv)
+{
+	__m512i const nib = _mm512_set1_epi8(0x0f);
+	__m512i const cat = _mm512_permutex2var_epi64(prv,
+		_mm512_set_epi64(13, 12, 11, 10, 9, 8, 7, 6), cur);
+	__m512i const pr1 = _mm512_alignr_epi8(cur, cat, 15);
+	__m512i const pr2 = _mm512_alignr_epi8(cur, cat, 14);
+	__m512i const pr3 = _mm512_alignr_epi8(cur, cat, 13);
+
+	__m512i const b1h = _mm512_shuffle_epi8(utf8_tbl_avx512(utf8_err_b1h),
+		_mm512_and_si512(_mm512_srli_epi16(pr1, 4), nib));
+	__m512i const b1l = _mm512_shuffle_epi8(utf8_tbl_avx512(utf8_err_b1l),
+		_mm512_and_si512(pr1, nib));
+	__m512i const b2h = _mm512_shuffle_epi8(utf8_tbl_avx512(utf8_err_b2h),
+		_mm512_and_si512(_mm512_srli_epi16(cur, 4), nib));
+	__m512i const err = _mm512_and_si512(_mm512_and_si512(b1h, b1l), b2h);
+
+	// Bytes which must be the 2nd or 3rd continuation byte of a sequence
+	__m512i const m23 = _mm512_and_si512(_mm512_set1_epi8((char)0x80),
+		_mm512_or_si512(
+			_mm512_subs_epu8(pr2, _mm512_set1_epi8((char)(0xe0 - 0x80))),
+			_mm512_subs_epu8(pr3, _mm512_set1_epi8((char)(0xf0 - 0x80)))));
+
+	return _mm512_xor_si512(m23, err);
+}
+
+utf8_avx512 static force_inline bool
+utf8_scan_avx512 (uint8_t const *ptr,
+                  size_t         n,
+                  size_t *const  cnt)
+{
+	__m512i const max = _mm512_loadu_si512(utf8_incomplete_max);
+	__m512i const cb1 = _mm512_set1_epi8((char)0xbf);
+	__m512i prv = _mm512_setzero_si512();
+	__m512i inc = _mm512_setzero_si512();
+	__m512i err = _mm512_setzero_si512();
+	size_t c = 0;
+
+	for (;; ptr += 64U, n -= 64U) {
+		// Masked loads don't fault, so the tail needs no copying
+		__mmask64 const msk = n >= 64U ? ~UINT64_C(0)
+		                    : n ? ~UINT64_C(0) >> (64U - n)
+		                    : UINT64_C(0);
+		__m512i const cur = _mm512_maskz_loadu_epi8(msk, ptr);
+
+		if (!_mm512_movepi8_mask(cur)) {
+			err = _mm512_or_si512(err, inc);
+			inc = _mm512_setzero_si512();
+			if (cnt)
+				c += (size_t)__builtin_popcountll(msk);
+		} else {
+			err = _mm512_or_si512(err, utf8_check_avx512(cur, prv));
+			inc = _mm512_subs_epu8(cur, max);
+			if (cnt)
+				c += (size_t)__builtin_popcountll(
+					_mm512_mask_cmpgt_epi8_mask(msk, cur, cb1));
+		}
+
+		if (n < 64U)
+			break;
+		prv = cur;
+	}
+
+	if (_mm512_test_epi8_mask(err, err))
+		return false;
+
+	if (cnt)
+		*cnt = c;
+	return true;
+}
+
+UTF8_BULK_API(avx512, utf8_avx512)
+
+utf8_avx512 static size_t
+utf8_ascii_span_avx512 (uint8_t const *const ptr,
+                        size_t const         n)
+{
+	for (size_t i = 0; i < n; i += 64U) {
+		__mmask64 const msk = n - i >= 64U ? ~UINT64_C(0)
+		                    : ~UINT64_C(0) >> (64U - (n - i));
+		uint64_t m = _mm512_movepi8_mask(_mm512_maskz_loadu_epi8(msk, &ptr[i]));
+		if (m)
+			return i + (size_t)__builtin_ctzll(m);
+	}
+	return n;
+}
+
+#undef utf8_avx512
+
+typedef bool utf8_validate_fn (uint8_t const *, size_t);
+typedef bool utf8_count_fn (uint8_t const *, size_t, size_t *);
+typedef size_t utf8_ascii_span_fn (uint8_t const *, size_t);
+
+/**
+ * @brief Define a GNU indirect function resolver for a bulk API.
+ *
+ * Resolvers run before relocations are done, so they must not call
+ * anything that might need them.
+ *
+ * @param fn Name of the public function.
+ */
+#define UTF8_BULK_RESOLVER(fn)                           \
+static fn##_fn *                                         \
+fn##_resolve (void)                                      \
+{                                                        \
+	__builtin_cpu_init();                            \
+	if (__builtin_cpu_supports("avx512bw"))          \
+		return fn##_avx512;                      \
+	if (__builtin_cpu_supports("avx2"))              \
+		return fn##_avx2;                        \
+	return fn##_sse2;                                \
+}
+
+UTF8_BULK_RESOLVER(utf8_validate)
+UTF8_BULK_RESOLVER(utf8_count)
+UTF8_BULK_RESOLVER(utf8_ascii_span)
+
+#undef UTF8_BULK_RESOLVER
+
+nonnull_in()
+bool
+utf8_validate (uint8_t const *ptr,
+               size_t         n) __attribute__((ifunc("utf8_validate_resolve")));
+
+nonnull_in()
+bool
+utf8_count (uint8_t const *ptr,
+            size_t         n,
+            size_t        *cnt) __attribute__((ifunc("utf8_count_resolve")));
+
+nonnull_in()
+size_t
+utf8_ascii_span (uint8_t const *ptr,
+                 size_t         n) __attribute__((ifunc("utf8_ascii_span_resolve")));
+
+#else /* !__x86_64__ || !__ELF__ || !__has_attribute(ifunc) */
+
+nonnull_in()
+bool
+utf8_validate (uint8_t const *const ptr,
+               size_t const         n)
+{
+	return utf8_validate_swar(ptr, n);
+}
+
+nonnull_in()
+bool
+utf8_count (uint8_t const *const ptr,
+            size_t const         n,
+            size_t *const        cnt)
+{
+	return utf8_count_swar(ptr, n, cnt);
+}
+
+nonnull_in()
+size_t
+utf8_ascii_span (uint8_t const *const ptr,
+                 size_t const         n)
+{
+	return utf8_ascii_span_swar(ptr, n);
+}
+
+#endif /* !__x86_64__ || !__ELF__ || !__has_attribute(ifunc) */
+
+#undef UTF8_BULK_API
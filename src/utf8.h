@@ -42,31 +42,37 @@
  * 3. Code points above the Unicode maximum of 0x10ffff are avoided
  *    by lowering the maximum value of the first continuation byte
  *    following the leading byte 0xf4.
+ *
+ * The start, run, skip, and run columns give the byte values which
+ * lead to each state: `run` bytes from `start`, then after skipping
+ * `skip` bytes another `run` bytes. Any arguments after `F` are
+ * passed on to `F` after the last column, which makes it possible
+ * to generate expressions that depend on an outside value.
  */
-#define UTF8_PARSER_DESCRIPTOR(F)                                                                      \
-        /* ╭───────────────────────────────enumeration                                              */ \
-        /* │      ╭────────────────────────label                                                    */ \
-        /* │      │    ╭───────────────────size                                                     */ \
-        /* │      │    │     ╭─────────────start                                                    */ \
-        /* │      │    │     │    ╭────────run                                                      */ \
-        /* │      │    │     │    │  ╭─────skip                                                     */ \
-        /* │      │    │     │    │  │  ╭──run                                                      */ \
-        F( 0,  asc,    1, 0x01, 127, 0, 0) /* ASCII - never followed by continuation byte 0x80-0xbf */ \
-        F( 1,  lb2,    2, 0xc2,  30, 0, 0) /* start of 2-byte sequence, any continuation may follow */ \
-        F( 2,  lb3_e0, 3, 0xe0,   1, 0, 0) /* start of 3-byte sequence, next byte must be 0xa0-0xbf */ \
-        F( 3,  lb3,    3, 0xe1,  12, 1, 2) /* start of 3-byte sequence, any continuation may follow */ \
-        F( 4,  lb3_ed, 3, 0xed,   1, 0, 0) /* start of 3-byte sequence, next byte must be 0x80-0x9f */ \
-        F( 5,  lb4_f0, 4, 0xf0,   1, 0, 0) /* start of 4-byte sequence, next byte must be 0x90-0xbf */ \
-        F( 6,  lb4,    4, 0xf1,   3, 0, 0) /* start of 4-byte sequence, any continuation may follow */ \
-        F( 7,  lb4_f4, 4, 0xf4,   1, 0, 0) /* start of 4-byte sequence, next byte must be 0x80-0x8f */ \
-        F( 8,  cb3_f4, 3, 0x80,  16, 0, 0) /* 3rd-to-last continuation, follows 0xf4                */ \
-        F( 9,  cb3,    3, 0x80,  64, 0, 0) /* 3rd-to-last continuation, follows 0xf1-0xf3           */ \
-        F(10,  cb3_f0, 3, 0x90,  48, 0, 0) /* 3rd-to-last continuation, follows 0xf0                */ \
-        F(11,  cb2_ed, 2, 0x80,  32, 0, 0) /* 2nd-to-last continuation, follows 0xed                */ \
-        F(12,  cb2,    2, 0x80,  64, 0, 0) /* 2nd-to-last continuation, follows 0xe1-0xec,0xee-0xef */ \
-        F(13,  cb2_e0, 2, 0xa0,  32, 0, 0) /* 2nd-to-last continuation, follows 0xe0                */ \
-        F(14,  cb1,    1, 0x80,  64, 0, 0) /* last continuation, common to all multi-byte sequences */ \
-        F(15,  ini,    0,    0,   0, 0 ,0) /* initial state, not used as a flag in the lookup table */
+#define UTF8_PARSER_DESCRIPTOR(F, ...)                                                                              \
+        /* ╭───────────────────────────────enumeration                                                           */ \
+        /* │      ╭────────────────────────label                                                                 */ \
+        /* │      │    ╭───────────────────size                                                                  */ \
+        /* │      │    │     ╭─────────────start                                                                 */ \
+        /* │      │    │     │    ╭────────run                                                                   */ \
+        /* │      │    │     │    │  ╭─────skip                                                                  */ \
+        /* │      │    │     │    │  │  ╭──run                                                                   */ \
+        F( 0,  asc,    1, 0x00, 128, 0, 0, __VA_ARGS__) /* ASCII - never followed by continuation byte 0x80-0xbf */ \
+        F( 1,  lb2,    2, 0xc2,  30, 0, 0, __VA_ARGS__) /* start of 2-byte sequence, any continuation may follow */ \
+        F( 2,  lb3_e0, 3, 0xe0,   1, 0, 0, __VA_ARGS__) /* start of 3-byte sequence, next byte must be 0xa0-0xbf */ \
+        F( 3,  lb3,    3, 0xe1,  12, 1, 2, __VA_ARGS__) /* start of 3-byte sequence, any continuation may follow */ \
+        F( 4,  lb3_ed, 3, 0xed,   1, 0, 0, __VA_ARGS__) /* start of 3-byte sequence, next byte must be 0x80-0x9f */ \
+        F( 5,  lb4_f0, 4, 0xf0,   1, 0, 0, __VA_ARGS__) /* start of 4-byte sequence, next byte must be 0x90-0xbf */ \
+        F( 6,  lb4,    4, 0xf1,   3, 0, 0, __VA_ARGS__) /* start of 4-byte sequence, any continuation may follow */ \
+        F( 7,  lb4_f4, 4, 0xf4,   1, 0, 0, __VA_ARGS__) /* start of 4-byte sequence, next byte must be 0x80-0x8f */ \
+        F( 8,  cb3_f4, 3, 0x80,  16, 0, 0, __VA_ARGS__) /* 3rd-to-last continuation, follows 0xf4                */ \
+        F( 9,  cb3,    3, 0x80,  64, 0, 0, __VA_ARGS__) /* 3rd-to-last continuation, follows 0xf1-0xf3           */ \
+        F(10,  cb3_f0, 3, 0x90,  48, 0, 0, __VA_ARGS__) /* 3rd-to-last continuation, follows 0xf0                */ \
+        F(11,  cb2_ed, 2, 0x80,  32, 0, 0, __VA_ARGS__) /* 2nd-to-last continuation, follows 0xed                */ \
+        F(12,  cb2,    2, 0x80,  64, 0, 0, __VA_ARGS__) /* 2nd-to-last continuation, follows 0xe1-0xec,0xee-0xef */ \
+        F(13,  cb2_e0, 2, 0xa0,  32, 0, 0, __VA_ARGS__) /* 2nd-to-last continuation, follows 0xe0                */ \
+        F(14,  cb1,    1, 0x80,  64, 0, 0, __VA_ARGS__) /* last continuation, common to all multi-byte sequences */ \
+        F(15,  ini,    0,    0,   0, 0, 0, __VA_ARGS__) /* initial state, not used as a flag in the lookup table */
 
 /**
  * @brief UTF-8 parser state enumeration.
@@ -84,6 +90,45 @@ fixed_enum(utf8_st8, uint8_t) {
  */
 #define utf8_bit(label) (uint16_t)(1U << utf8_##label)
 
+/**
+ * @brief Set of state flags comprising all leading byte states.
+ */
+#define UTF8_PARSER_LEADING_BITS ( \
+        utf8_bit(asc)              \
+      | utf8_bit(lb2)              \
+      | utf8_bit(lb3_e0)           \
+      | utf8_bit(lb3)              \
+      | utf8_bit(lb3_ed)           \
+      | utf8_bit(lb4_f0)           \
+      | utf8_bit(lb4)              \
+      | utf8_bit(lb4_f4)           )
+
+/**
+ * @brief Describe the allowed state transitions from each state,
+ *        using state labels for keys and sets of state flags for
+ *        values.
+ *
+ * Any arguments after `F` are passed on to `F` after the two
+ * columns, the same way as with `UTF8_PARSER_DESCRIPTOR`.
+ */
+#define UTF8_PARSER_TRANSITIONS(F, ...)                        \
+        F(asc,    UTF8_PARSER_LEADING_BITS, __VA_ARGS__)       \
+        F(lb2,    utf8_bit(cb1),            __VA_ARGS__)       \
+        F(lb3_e0, utf8_bit(cb2_e0),         __VA_ARGS__)       \
+        F(lb3,    utf8_bit(cb2),            __VA_ARGS__)       \
+        F(lb3_ed, utf8_bit(cb2_ed),         __VA_ARGS__)       \
+        F(lb4_f0, utf8_bit(cb3_f0),         __VA_ARGS__)       \
+        F(lb4,    utf8_bit(cb3),            __VA_ARGS__)       \
+        F(lb4_f4, utf8_bit(cb3_f4),         __VA_ARGS__)       \
+        F(cb3_f4, utf8_bit(cb2),            __VA_ARGS__)       \
+        F(cb3,    utf8_bit(cb2),            __VA_ARGS__)       \
+        F(cb3_f0, utf8_bit(cb2),            __VA_ARGS__)       \
+        F(cb2_ed, utf8_bit(cb1),            __VA_ARGS__)       \
+        F(cb2,    utf8_bit(cb1),            __VA_ARGS__)       \
+        F(cb2_e0, utf8_bit(cb1),            __VA_ARGS__)       \
+        F(cb1,    UTF8_PARSER_LEADING_BITS, __VA_ARGS__)       \
+        F(ini,    UTF8_PARSER_LEADING_BITS, __VA_ARGS__)
+
 /**
  * @brief Define a lookup table describing allowed state
  *        transitions from each state, using state enums
@@ -99,44 +144,9 @@ fixed_enum(utf8_st8, uint8_t) {
  * @param sym Symbol name for the lookup table.
  */
 #define UTF8_PARSER_STATE_MAP(sym) uint16_t sym[16] = { \
-        [utf8_asc   ] = utf8_bit(asc)                   \
-                      | utf8_bit(lb2)                   \
-                      | utf8_bit(lb3_e0)                \
-                      | utf8_bit(lb3)                   \
-                      | utf8_bit(lb3_ed)                \
-                      | utf8_bit(lb4_f0)                \
-                      | utf8_bit(lb4)                   \
-                      | utf8_bit(lb4_f4),               \
-        [utf8_lb2   ] = utf8_bit(cb1),                  \
-        [utf8_lb3_e0] = utf8_bit(cb2_e0),               \
-        [utf8_lb3   ] = utf8_bit(cb2),                  \
-        [utf8_lb3_ed] = utf8_bit(cb2_ed),               \
-        [utf8_lb4_f0] = utf8_bit(cb3_f0),               \
-        [utf8_lb4   ] = utf8_bit(cb3),                  \
-        [utf8_lb4_f4] = utf8_bit(cb3_f4),               \
-        [utf8_cb3_f4] = utf8_bit(cb2),                  \
-        [utf8_cb3   ] = utf8_bit(cb2),                  \
-        [utf8_cb3_f0] = utf8_bit(cb2),                  \
-        [utf8_cb2_ed] = utf8_bit(cb1),                  \
-        [utf8_cb2   ] = utf8_bit(cb1),                  \
-        [utf8_cb2_e0] = utf8_bit(cb1),                  \
-        [utf8_cb1   ] = utf8_bit(asc)                   \
-                      | utf8_bit(lb2)                   \
-                      | utf8_bit(lb3_e0)                \
-                      | utf8_bit(lb3)                   \
-                      | utf8_bit(lb3_ed)                \
-                      | utf8_bit(lb4_f0)                \
-                      | utf8_bit(lb4)                   \
-                      | utf8_bit(lb4_f4),               \
-        [utf8_ini   ] = utf8_bit(asc)                   \
-                      | utf8_bit(lb2)                   \
-                      | utf8_bit(lb3_e0)                \
-                      | utf8_bit(lb3)                   \
-                      | utf8_bit(lb3_ed)                \
-                      | utf8_bit(lb4_f0)                \
-                      | utf8_bit(lb4)                   \
-                      | utf8_bit(lb4_f4)                \
+        UTF8_PARSER_TRANSITIONS(UTF8_PARSER_STATE_MAP_) \
 }
+#define UTF8_PARSER_STATE_MAP_(m, bits, ...) [utf8_##m] = bits,
 
 /**
  * @brief UTF-8 parser object.
@@ -281,6 +291,84 @@ utf8_expects_leading_byte (struct utf8 const *const u8p)
 	return u8p->state & (utf8_bit(asc) | utf8_bit(cb1) | utf8_bit(ini));
 }
 
+/**
+ * @brief Validate a UTF-8 byte buffer in bulk.
+ *
+ * Accepts and rejects exactly the same inputs as repeated calls
+ * to @ref utf8_parse_next_code_point() would, i.e. overlong forms,
+ * surrogates, and code points above 0x10ffff are all rejected. A
+ * buffer which ends in the middle of a multi-byte sequence is also
+ * rejected. Null bytes are ASCII and don't terminate the input.
+ *
+ * The implementation is picked once when the module is loaded,
+ * based on what the CPU supports: AVX-512BW, AVX2, SSE2, or a
+ * portable 64-bit SWAR fallback. No bytes beyond `ptr[n - 1]`
+ * are ever read.
+ *
+ * @param ptr Start of the input buffer. Must not be null.
+ * @param n Size of the input buffer in bytes.
+ * @return `true` if the buffer is valid UTF-8, otherwise `false`.
+ */
+extern bool
+utf8_validate (uint8_t const *ptr,
+               size_t         n) nonnull_in();
+
+/**
+ * @brief Validate a UTF-8 byte buffer and count its code points.
+ *
+ * Does the same job as @ref utf8_validate() and counts the code
+ * points in the same pass. Pure ASCII blocks are counted by their
+ * size, other blocks by the number of non-continuation bytes. The
+ * implementation is picked the same way as for @ref utf8_validate().
+ *
+ * @param ptr Start of the input buffer. Must not be null.
+ * @param n Size of the input buffer in bytes.
+ * @param cnt Where to store the code point count. Must not be null.
+ *            Not modified if the buffer is invalid.
+ * @return `true` if the buffer is valid UTF-8, otherwise `false`.
+ */
+extern bool
+utf8_count (uint8_t const *ptr,
+            size_t         n,
+            size_t        *cnt) nonnull_in();
+
+/**
+ * @brief Get the length of the pure ASCII prefix of a byte buffer.
+ *
+ * A wide scan for the first byte with the high bit set, using the
+ * same kernel selection as @ref utf8_validate(). Everything before
+ * that byte is valid UTF-8 and one code point per byte.
+ *
+ * @param ptr Start of the input buffer. Must not be null.
+ * @param n Size of the input buffer in bytes.
+ * @return Number of leading ASCII bytes, `n` if all bytes are ASCII.
+ */
+extern size_t
+utf8_ascii_span (uint8_t const *ptr,
+                 size_t         n) nonnull_in();
+
+/**
+ * @brief Decode a UTF-8 byte buffer to UTF-32 in bulk.
+ *
+ * Accepts and rejects the same inputs as @ref utf8_validate().
+ * Decoding is done by whichever engine was selected at build time:
+ * the bit flag state machine by default, or the shift-based DFA if
+ * `UTF8_ENGINE_DFA` is defined.
+ *
+ * @param dst Output buffer with room for at least `n` code points.
+ *            Must not be null. Contents are unspecified on failure.
+ * @param ptr Start of the input buffer. Must not be null.
+ * @param n Size of the input buffer in bytes.
+ * @param cnt Where to store the number of code points written. Must
+ *            not be null. Not modified if the buffer is invalid.
+ * @return `true` if the buffer is valid UTF-8, otherwise `false`.
+ */
+extern bool
+utf8_decode (uint32_t      *dst,
+             uint8_t const *ptr,
+             size_t         n,
+             size_t        *cnt) nonnull_in();
+
 /* Private macro cleanup logic depends on this include being here,
  * right above the closing endif of the header guard. DO NOT MOVE.
  */
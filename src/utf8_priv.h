@@ -1,8 +1,8 @@
 /* SPDX-License-Identifier: LGPL-3.0-or-later */
 /** @file utf8_priv.h
  * @brief Including this private header before utf8.h prevents
- *        `UTF8_PARSER_DESCRIPTOR` from being undefined at the
- *        end of utf8.h.
+ *        `UTF8_PARSER_DESCRIPTOR` and friends from being undefined
+ *        at the end of utf8.h.
  * @author Juuso Alasuutari
  */
 #ifndef DEEM_SRC_UTF8_PRIV_H_
@@ -13,6 +13,10 @@
  * guarded section but before the public header is included.
  */
 #undef UTF8_PARSER_DESCRIPTOR
+#undef UTF8_PARSER_LEADING_BITS
+#undef UTF8_PARSER_TRANSITIONS
+#undef UTF8_PARSER_STATE_MAP
+#undef UTF8_PARSER_STATE_MAP_
 
 #include "utf8.h"
 
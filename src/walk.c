@@ -0,0 +1,403 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/** @file walk.c
+ *
+ * @author Juuso Alasuutari
+ */
+#include <dirent.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "walk.h"
+
+/** @brief Size of the per-thread `getdents64` buffer
+ */
+#define WALK_DENTS 32768U
+
+/** @brief Directory entry as returned by `getdents64`
+ */
+struct walk_dirent {
+	uint64_t       d_ino;
+	int64_t        d_off;
+	unsigned short d_reclen;
+	unsigned char  d_type;
+	char           d_name[];
+};
+
+/** @brief Directory waiting to be read
+ */
+struct walk_dir {
+	struct walk_dir *next;
+	size_t           len;   //< Length of `rel`
+	char             rel[]; //< Path relative to the root, "" for the root
+};
+
+struct walk;
+
+/** @brief Worker thread state
+ *
+ * Each worker pushes the subdirectories it finds to its own stack,
+ * pops from it first, and steals from the other workers when it runs
+ * out of work.
+ */
+struct walk_worker {
+	pthread_mutex_t  lock;
+	struct walk_dir *todo;  //< Directory stack
+	struct arena     mem;   //< Directory and match storage
+	char const     **path;  //< Matches
+	size_t           n;
+	size_t           cap;
+	size_t           bytes; //< Total length of matches
+	struct walk     *w;
+	pthread_t        tid;
+	bool             nomem;
+};
+
+struct walk {
+	struct walk_spec const *spec;
+	int                     rootfd;
+	char const             *prefix; //< Prepended to every match
+	size_t                  plen;
+	size_t                  pending; //< Directories queued or being read
+	pthread_mutex_t         idle_lock;
+	pthread_cond_t          idle;    //< Signalled on new work and when done
+	unsigned long           gen;     //< Bumped on each signal of `idle`
+	struct walk_worker      wk[WALK_THREADS_MAX];
+	unsigned                n_wk;
+};
+
+static bool
+walk_match (char const *const *const pat,
+            size_t const             n,
+            char const *const        name,
+            char const *const        rel)
+{
+	for (size_t i = 0; i < n; ++i) {
+		bool path = strchr(pat[i], '/');
+		if (!fnmatch(pat[i], path ? rel : name,
+		             FNM_PERIOD | (path ? FNM_PATHNAME : 0)))
+			return true;
+	}
+	return false;
+}
+
+/** @brief Wake idle workers, either one for new work or all of them.
+ */
+static void
+walk_wake (struct walk *const w,
+           bool const         all)
+{
+	pthread_mutex_lock(&w->idle_lock);
+	__atomic_add_fetch(&w->gen, 1U, __ATOMIC_RELEASE);
+	if (all)
+		pthread_cond_broadcast(&w->idle);
+	else
+		pthread_cond_signal(&w->idle);
+	pthread_mutex_unlock(&w->idle_lock);
+}
+
+static void
+walk_push (struct walk_worker *const self,
+           struct walk_dir *const    d)
+{
+	__atomic_add_fetch(&self->w->pending, 1U, __ATOMIC_ACQ_REL);
+	pthread_mutex_lock(&self->lock);
+	d->next = self->todo;
+	self->todo = d;
+	pthread_mutex_unlock(&self->lock);
+	walk_wake(self->w, false);
+}
+
+static struct walk_dir *
+walk_pop (struct walk_worker *const wk)
+{
+	pthread_mutex_lock(&wk->lock);
+	struct walk_dir *const d = wk->todo;
+	if (d)
+		wk->todo = d->next;
+	pthread_mutex_unlock(&wk->lock);
+	return d;
+}
+
+static struct walk_dir *
+walk_steal (struct walk_worker *const self)
+{
+	struct walk *const w = self->w;
+	size_t const i = (size_t)(self - w->wk);
+	for (unsigned k = 1U; k < w->n_wk; ++k) {
+		struct walk_worker *const v = &w->wk[(i + k) % w->n_wk];
+		if (__atomic_load_n(&v->todo, __ATOMIC_RELAXED)) {
+			struct walk_dir *const d = walk_pop(v);
+			if (d)
+				return d;
+		}
+	}
+	return nullptr;
+}
+
+static bool
+walk_add (struct walk_worker *const self,
+          char const *const         rel,
+          size_t const              len)
+{
+	struct walk const *const w = self->w;
+
+	if (self->n == self->cap) {
+		size_t cap = self->cap ? self->cap * 2U : 256U;
+		char const **path = realloc(self->path, cap * sizeof *path);
+		if (!path)
+			return false;
+		self->path = path;
+		self->cap = cap;
+	}
+
+	char *const p = arena_alloc(&self->mem, w->plen + len + 1U);
+	if (!p)
+		return false;
+
+	__builtin_memcpy(p, w->prefix, w->plen);
+	__builtin_memcpy(&p[w->plen], rel, len + 1U);
+	self->path[self->n++] = p;
+	self->bytes += w->plen + len;
+	return true;
+}
+
+/** @brief Read one directory, queueing subdirectories and recording
+ *         matching files.
+ */
+static bool
+walk_read (struct walk_worker *const    self,
+           struct walk_dir const *const d)
+{
+	struct walk const *const w = self->w;
+	struct walk_spec const *const spec = w->spec;
+
+	int fd = openat(w->rootfd, d->len ? d->rel : ".",
+	                O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+	if (fd < 0)
+		return true;
+
+	char rel[PATH_MAX];
+	if (d->len)
+		__builtin_memcpy(rel, d->rel, d->len);
+	size_t const base = d->len ? d->len + 1U : 0U;
+	if (d->len)
+		rel[d->len] = '/';
+
+	bool ok = true;
+	unsigned char dents[WALK_DENTS];
+	for (long n; ok && (n = syscall(SYS_getdents64, fd, dents,
+	                                sizeof dents)) > 0; ) {
+		for (long off = 0; off < n; ) {
+			struct walk_dirent const *const e =
+				(struct walk_dirent const *)&dents[off];
+			off += e->d_reclen;
+
+			char const *const name = e->d_name;
+			if (name[0] == '.' && (!name[1] ||
+			    (name[1] == '.' && !name[2])))
+				continue;
+
+			size_t const len = strlen(name);
+			if (base + len >= sizeof rel)
+				continue;
+			__builtin_memcpy(&rel[base], name, len + 1U);
+
+			if (walk_match(spec->excl, spec->n_excl, name, rel))
+				continue;
+
+			unsigned char type = e->d_type;
+			if (type == DT_UNKNOWN) {
+				struct stat st;
+				if (fstatat(fd, name, &st, AT_SYMLINK_NOFOLLOW))
+					continue;
+				type = S_ISDIR(st.st_mode) ? DT_DIR : DT_REG;
+			}
+
+			if (type == DT_DIR) {
+				struct walk_dir *const sub = arena_alloc(&self->mem,
+					sizeof *sub + base + len + 1U);
+				if (!sub) {
+					ok = false;
+					break;
+				}
+				sub->len = base + len;
+				__builtin_memcpy(sub->rel, rel, base + len + 1U);
+				walk_push(self, sub);
+			} else if (!spec->n_pat ||
+			           walk_match(spec->pat, spec->n_pat, name, rel)) {
+				if (!walk_add(self, rel, base + len)) {
+					ok = false;
+					break;
+				}
+			}
+		}
+	}
+
+	(void)close(fd);
+	return ok;
+}
+
+static void *
+walk_worker (void *const arg)
+{
+	struct walk_worker *const self = arg;
+	struct walk *const w = self->w;
+
+	for (;;) {
+		// Work pushed after this shows up as a new generation
+		unsigned long const gen = __atomic_load_n(&w->gen, __ATOMIC_ACQUIRE);
+		struct walk_dir *d = walk_pop(self);
+		if (!d)
+			d = walk_steal(self);
+
+		if (d) {
+			if (!self->nomem && !walk_read(self, d))
+				self->nomem = true;
+			if (!__atomic_sub_fetch(&w->pending, 1U, __ATOMIC_ACQ_REL))
+				walk_wake(w, true);
+			continue;
+		}
+
+		pthread_mutex_lock(&w->idle_lock);
+		while (__atomic_load_n(&w->pending, __ATOMIC_ACQUIRE)
+		       && __atomic_load_n(&w->gen, __ATOMIC_ACQUIRE) == gen)
+			pthread_cond_wait(&w->idle, &w->idle_lock);
+		pthread_mutex_unlock(&w->idle_lock);
+
+		if (!__atomic_load_n(&w->pending, __ATOMIC_ACQUIRE))
+			break;
+	}
+
+	return nullptr;
+}
+
+static int
+walk_cmp (void const *const a,
+          void const *const b)
+{
+	return strcmp(*(char const *const *)a, *(char const *const *)b);
+}
+
+bool
+walk (struct walk_spec const *const spec,
+      struct walk_out *const        out)
+{
+	*out = (struct walk_out){0};
+
+	char const *root = *spec->root ? spec->root : ".";
+	int rootfd = open(root, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (rootfd < 0)
+		return true;
+
+	size_t rlen = strlen(spec->root);
+	bool slash = !rlen || spec->root[rlen - 1U] == '/';
+	char *prefix = malloc(rlen + 2U);
+	struct walk *w = calloc(1U, sizeof *w);
+	if (!prefix || !w) {
+		perror("malloc");
+		free(w);
+		free(prefix);
+		(void)close(rootfd);
+		return false;
+	}
+
+	__builtin_memcpy(prefix, spec->root, rlen);
+	prefix[rlen] = '/';
+	prefix[rlen + !slash] = '\0';
+
+	w->spec = spec;
+	w->rootfd = rootfd;
+	w->prefix = prefix;
+	w->plen = rlen + !slash;
+	(void)pthread_mutex_init(&w->idle_lock, nullptr);
+	(void)pthread_cond_init(&w->idle, nullptr);
+
+	long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+	w->n_wk = ncpu < 1 ? 1U : ncpu > WALK_THREADS_MAX
+	        ? WALK_THREADS_MAX : (unsigned)ncpu;
+	for (unsigned i = 0; i < w->n_wk; ++i) {
+		(void)pthread_mutex_init(&w->wk[i].lock, nullptr);
+		w->wk[i].w = w;
+	}
+
+	struct walk_dir top = {nullptr, 0U};
+	walk_push(&w->wk[0], &top);
+
+	// The calling thread is worker 0
+	unsigned started = 1U;
+	for (; started < w->n_wk; ++started)
+		if (pthread_create(&w->wk[started].tid, nullptr,
+		                   walk_worker, &w->wk[started]))
+			break;
+
+	(void)walk_worker(&w->wk[0]);
+	for (unsigned i = 1U; i < started; ++i)
+		(void)pthread_join(w->wk[i].tid, nullptr);
+
+	// Threads which failed to start may still have been robbed of work
+	for (unsigned i = started; i < w->n_wk; ++i)
+		(void)walk_worker(&w->wk[i]);
+
+	bool ok = true;
+	out->mem = calloc(w->n_wk, sizeof *out->mem);
+	if (!out->mem)
+		ok = false;
+	for (unsigned i = 0; i < w->n_wk; ++i) {
+		struct walk_worker *const wk = &w->wk[i];
+		out->n += wk->n;
+		out->bytes += wk->bytes;
+		ok = ok && !wk->nomem;
+	}
+
+	if (ok && out->n) {
+		out->path = malloc(out->n * sizeof *out->path);
+		ok = out->path;
+	}
+
+	size_t k = 0U;
+	for (unsigned i = 0; i < w->n_wk; ++i) {
+		struct walk_worker *const wk = &w->wk[i];
+		if (ok && wk->n) {
+			__builtin_memcpy(&out->path[k], wk->path,
+			                 wk->n * sizeof *wk->path);
+			k += wk->n;
+		}
+		free(wk->path);
+		if (out->mem)
+			out->mem[out->n_mem++] = wk->mem;
+		else
+			arena_fini(&wk->mem);
+		(void)pthread_mutex_destroy(&wk->lock);
+	}
+
+	if (ok)
+		qsort(out->path, out->n, sizeof *out->path, walk_cmp);
+	else
+		out->n = 0U;
+
+	(void)pthread_cond_destroy(&w->idle);
+	(void)pthread_mutex_destroy(&w->idle_lock);
+	(void)close(rootfd);
+	free(prefix);
+	free(w);
+	return ok;
+}
+
+void
+walk_out_fini (struct walk_out *const out)
+{
+	for (unsigned i = 0; i < out->n_mem; ++i)
+		arena_fini(&out->mem[i]);
+	free(out->mem);
+	free(out->path);
+	*out = (struct walk_out){0};
+}
@@ -0,0 +1,69 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/** @file walk.h
+ * @brief Parallel recursive directory globbing
+ * @author Juuso Alasuutari
+ */
+#ifndef DEEM_SRC_WALK_H_
+#define DEEM_SRC_WALK_H_
+
+#include <stddef.h>
+
+#include "compat.h"
+#include "str.h"
+#include "util.h"
+
+/** @brief Upper limit of worker threads for one walk
+ */
+#define WALK_THREADS_MAX 8U
+
+/** @brief What to look for
+ *
+ * Patterns are `fnmatch()` globs. A pattern without a slash is
+ * matched against file names, a pattern with a slash against paths
+ * relative to the root. A leading dot is only matched explicitly.
+ */
+struct walk_spec {
+	char const        *root;   //< Directory to search
+	char const *const *pat;    //< File patterns; none matches all
+	size_t             n_pat;
+	char const *const *excl;   //< Files and directories to skip
+	size_t             n_excl;
+};
+
+/** @brief Walk results
+ */
+struct walk_out {
+	char const  **path;  //< Sorted matches, including the root prefix
+	size_t        n;     //< Number of matches
+	size_t        bytes; //< Total length of the matches in bytes
+	struct arena *mem;   //< Per-thread storage of the matches
+	unsigned      n_mem;
+};
+
+/**
+ * @brief Find the files under a directory which match a spec.
+ *
+ * Directories are read with `getdents64` by a small pool of threads
+ * which steal work from each other. File types come from `d_type`
+ * where the file system provides it, so most entries are never
+ * stat'ed. Symbolic links to directories are not followed.
+ *
+ * @param spec What to look for.
+ * @param out Receives the results, which must be released with
+ *            @ref walk_out_fini() even if the walk fails.
+ * @return `true` on success, `false` if memory allocation fails. A
+ *         root or subdirectory which can't be read is skipped, like
+ *         make's `$(wildcard)` does.
+ */
+extern bool
+walk (struct walk_spec const *spec,
+      struct walk_out        *out) nonnull_in();
+
+/**
+ * @brief Release walk results.
+ * @param out The results.
+ */
+extern void
+walk_out_fini (struct walk_out *out) nonnull_in();
+
+#endif /* DEEM_SRC_WALK_H_ */